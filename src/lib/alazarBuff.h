@@ -1,40 +1,100 @@
 #ifndef ALAZARBUFF_H_
 #define ALAZARBUFF_H_
 
-#include <mutex>
-#include <queue>
+#include <atomic>
+#include <stdint.h>
 
-template <typename T> class AlazarBufferQ {
+// A DMA buffer of the pool.  The stages hand each other its index in the
+// pool rather than the buffer: the memory belongs to the pool for the whole
+// acquisition.
+enum BufferState : uint32_t {
+  BUFFER_FREE,      // in the pool, not given to the board
+  BUFFER_POSTED,    // posted to the board, waiting to be filled
+  BUFFER_FILLED,    // filled by the board, waiting to be processed
+  BUFFER_PROCESSING // taken by the application or the receive thread
+};
 
-public:
-  std::queue<T> q;
-  std::mutex qmtx;
+struct BufferDescriptor {
+  uint8_t *data = nullptr; // aligned, within the memory of the pool
+  uint32_t length = 0;
+  uint64_t sequence = 0; // order of arrival in the acquisition
+  std::atomic<uint32_t> state{BUFFER_FREE};
+};
 
-  bool push(T &ptr) {
-    std::lock_guard<std::mutex> lock(qmtx);
-    q.push(ptr);
-    return true;
-  }
+// Fixed capacity ring of buffer indices, without locks.  Any number of
+// threads push and pop; each slot holds the position it next expects, so a
+// thread takes a slot with a single compare and swap of the position.
+template <uint32_t N> class AlazarIndexRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N is a power of two");
 
-  bool pop(T &ptr) {
-    std::lock_guard<std::mutex> lock(qmtx);
+public:
+  AlazarIndexRing() {
+    for (uint32_t i = 0; i < N; i++) {
+      slots[i].turn.store(i, std::memory_order_relaxed);
+    }
+  }
 
-    if (q.empty()) {
-      return false;
+  // false when the ring is full
+  bool push(uint32_t index) {
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = slots[pos % N];
+      uint64_t turn = slot.turn.load(std::memory_order_acquire);
+      if (turn == pos) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          slot.index = index;
+          slot.turn.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (turn < pos) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
     }
+  }
 
-    ptr = q.front();
-    q.pop();
+  // false when the ring is empty
+  bool pop(uint32_t &index) {
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = slots[pos % N];
+      uint64_t turn = slot.turn.load(std::memory_order_acquire);
+      if (turn == pos + 1) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          index = slot.index;
+          slot.turn.store(pos + N, std::memory_order_release);
+          return true;
+        }
+      } else if (turn < pos + 1) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
 
-    return true;
+  bool empty() const {
+    return head.load(std::memory_order_acquire) >=
+           tail.load(std::memory_order_acquire);
   }
 
-  void clear(T &ptr) {
-    while (!q.empty()) {
-      ptr = q.front();
-      q.pop();
-    }
+  void clear() {
+    uint32_t index;
+    while (pop(index))
+      ;
   }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> turn;
+    uint32_t index;
+  };
+  Slot slots[N];
+  std::atomic<uint64_t> tail{0};
+  std::atomic<uint64_t> head{0};
 };
 
 #endif
\ No newline at end of file
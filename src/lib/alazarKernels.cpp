@@ -0,0 +1,353 @@
+/*
+Copyright 2026 Raytheon BBN Technologies
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Registry of the processing kernels.  This file is built with the generic
+// flags of the library and holds the scalar variants; the SIMD variants live
+// in one file per instruction set, each built for that instruction set only.
+// The scalar variants have no streaming stores and use their regular
+// conversion instead.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "alazarKernels.h"
+#include <plog/Log.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#else
+#include <atomic>
+#endif
+
+void buildConvertTable(ConvertTable &table, float counts2Volts,
+                       float channelOffset) {
+  table.counts2Volts = counts2Volts;
+  table.channelOffset = channelOffset;
+  for (int32_t code = 0; code < 256; code++) {
+    table.volts[code] = counts2Volts * (code - 128) - channelOffset;
+  }
+}
+
+bool cpuSupports(KernelIsa isa) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  __cpuid(info, 1);
+  bool sse41 = (info[2] & (1 << 19)) != 0;
+  bool f16c = (info[2] & (1 << 29)) != 0;
+  // the OS has to save the ymm and zmm registers
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+  int leaf7[4] = {0, 0, 0, 0};
+  if (maxLeaf >= 7) {
+    __cpuidex(leaf7, 7, 0);
+  }
+  switch (isa) {
+  case ISA_SCALAR:
+    return true;
+  case ISA_SSE41:
+    return sse41;
+  case ISA_AVX2:
+    // the AVX2 kernels pack half precision with F16C
+    return (xcr0 & 0x6) == 0x6 && (leaf7[1] & (1 << 5)) != 0 && f16c;
+  case ISA_AVX512:
+    return (xcr0 & 0xe6) == 0xe6 && (leaf7[1] & (1 << 16)) != 0 &&
+           (leaf7[1] & (1 << 30)) != 0;
+  }
+  return false;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  switch (isa) {
+  case ISA_SCALAR:
+    return true;
+  case ISA_SSE41:
+    return __builtin_cpu_supports("sse4.1");
+  case ISA_AVX2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+  case ISA_AVX512:
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+  }
+  return false;
+#else
+  return isa == ISA_SCALAR;
+#endif
+}
+
+std::string cpuName() {
+  // the brand string is 48 characters in leaves 0x80000002 to 0x80000004
+  uint32_t brand[13] = {0};
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 0x80000000);
+  if (static_cast<uint32_t>(info[0]) < 0x80000004) {
+    return "unknown";
+  }
+  for (int n = 0; n < 3; n++) {
+    __cpuid(reinterpret_cast<int *>(brand + 4 * n), 0x80000002 + n);
+  }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  if (__get_cpuid_max(0x80000000, nullptr) < 0x80000004) {
+    return "unknown";
+  }
+  for (uint32_t n = 0; n < 3; n++) {
+    __get_cpuid(0x80000002 + n, &brand[4 * n], &brand[4 * n + 1],
+                &brand[4 * n + 2], &brand[4 * n + 3]);
+  }
+#else
+  return "unknown";
+#endif
+  std::string name(reinterpret_cast<const char *>(brand));
+  name.erase(0, name.find_first_not_of(' '));
+  name.erase(name.find_last_not_of(' ') + 1);
+  return name.empty() ? "unknown" : name;
+}
+
+uint32_t l2CacheSize() {
+  // leaf 0x80000006 gives the L2 size in KB in bits 16 to 31 of ECX, on
+  // Intel and AMD alike
+  uint32_t info[4] = {0};
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int regs[4];
+  __cpuid(regs, 0x80000000);
+  if (static_cast<uint32_t>(regs[0]) >= 0x80000006) {
+    __cpuid(regs, 0x80000006);
+    info[2] = static_cast<uint32_t>(regs[2]);
+  }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000006) {
+    __get_cpuid(0x80000006, &info[0], &info[1], &info[2], &info[3]);
+  }
+#endif
+  uint32_t size = (info[2] >> 16) * 1024;
+  return size ? size : DEFAULT_L2_CACHE_SIZE;
+}
+
+template <bool accumulate> static inline void store(float &out, float volts) {
+  if (accumulate) {
+    out += volts;
+  } else {
+    out = volts;
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0>
+static void pairsArithmetic(const uint8_t *buff, uint32_t nbrPairs,
+                            const ConvertTable &table, float *ch1,
+                            float *ch2) {
+  uint32_t n = recordLength ? recordLength : nbrPairs;
+  float counts2Volts = table.counts2Volts;
+  float channelOffset = table.channelOffset;
+  for (uint32_t i = 0; i < n; i++) {
+    store<accumulate>(ch1[i],
+                      counts2Volts * (buff[2 * i] - 128) - channelOffset);
+    store<accumulate>(ch2[i],
+                      counts2Volts * (buff[2 * i + 1] - 128) - channelOffset);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0>
+static void samplesArithmetic(const uint8_t *buff, uint32_t nbrSamples,
+                              const ConvertTable &table, float *ch) {
+  uint32_t n = recordLength ? recordLength : nbrSamples;
+  float counts2Volts = table.counts2Volts;
+  float channelOffset = table.channelOffset;
+  for (uint32_t i = 0; i < n; i++) {
+    store<accumulate>(ch[i], counts2Volts * (buff[i] - 128) - channelOffset);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0>
+static void pairsTable(const uint8_t *buff, uint32_t nbrPairs,
+                       const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t n = recordLength ? recordLength : nbrPairs;
+  const float *volts = table.volts;
+  for (uint32_t i = 0; i < n; i++) {
+    store<accumulate>(ch1[i], volts[buff[2 * i]]);
+    store<accumulate>(ch2[i], volts[buff[2 * i + 1]]);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0>
+static void samplesTable(const uint8_t *buff, uint32_t nbrSamples,
+                         const ConvertTable &table, float *ch) {
+  uint32_t n = recordLength ? recordLength : nbrSamples;
+  const float *volts = table.volts;
+  for (uint32_t i = 0; i < n; i++) {
+    store<accumulate>(ch[i], volts[buff[i]]);
+  }
+}
+
+static void packHalfScalar(const float *in, uint32_t nbrSamples,
+                           uint16_t *out) {
+  for (uint32_t i = 0; i < nbrSamples; i++) {
+    out[i] = floatToHalf(in[i]);
+  }
+}
+
+template <typename T>
+static void packScalar(const float *in, uint32_t nbrSamples, float gain,
+                       float offset, T *out) {
+  for (uint32_t i = 0; i < nbrSamples; i++) {
+    out[i] = packInteger<T>((in[i] + offset) * gain);
+  }
+}
+
+void streamFence() {
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+  _mm_sfence();
+#else
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+void evictFromCache(const void *data, size_t size) {
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+  const char *bytes = static_cast<const char *>(data);
+  for (size_t n = 0; n < size; n += 64) {
+    _mm_clflush(bytes + n);
+  }
+  _mm_mfence();
+#else
+  (void)data;
+  (void)size;
+#endif
+}
+
+static std::vector<ProcessingKernels> findKernels() {
+  std::vector<ProcessingKernels> variants;
+  static const RecordKernels arithmeticFixed[NBR_FIXED_RECORD_LENGTHS] =
+      FIXED_RECORD_KERNELS(pairsArithmetic, samplesArithmetic);
+  static const RecordKernels tableFixed[NBR_FIXED_RECORD_LENGTHS] =
+      FIXED_RECORD_KERNELS(pairsTable, samplesTable);
+  variants.push_back({"scalar", pairsArithmetic<false>,
+                      samplesArithmetic<false>, pairsArithmetic<true>,
+                      samplesArithmetic<true>, arithmeticFixed,
+                      pairsArithmetic<false>, samplesArithmetic<false>,
+                      packHalfScalar, packScalar<int16_t>, packScalar<int8_t>,
+                      packScalar<int32_t>});
+  variants.push_back({"scalar-table", pairsTable<false>, samplesTable<false>,
+                      pairsTable<true>, samplesTable<true>, tableFixed,
+                      pairsTable<false>, samplesTable<false>, packHalfScalar,
+                      packScalar<int16_t>, packScalar<int8_t>,
+                      packScalar<int32_t>});
+  if (cpuSupports(ISA_SSE41)) {
+    addKernelsSSE41(variants);
+  }
+  if (cpuSupports(ISA_AVX2)) {
+    addKernelsAVX2(variants);
+  }
+  if (cpuSupports(ISA_AVX512)) {
+    addKernelsAVX512(variants);
+  }
+  return variants;
+}
+
+const std::vector<ProcessingKernels> &kernelVariants() {
+  static const std::vector<ProcessingKernels> variants = findKernels();
+  return variants;
+}
+
+const ProcessingKernels *kernelsByName(const char *name) {
+  for (auto &variant : kernelVariants()) {
+    if (!strcmp(variant.name, name)) {
+      return &variant;
+    }
+  }
+  return nullptr;
+}
+
+RecordKernels recordKernels(const ProcessingKernels &kernels,
+                            uint32_t recordLength) {
+  for (uint32_t n = 0; kernels.fixedLength && n < NBR_FIXED_RECORD_LENGTHS;
+       n++) {
+    if (kernels.fixedLength[n].recordLength == recordLength) {
+      return kernels.fixedLength[n];
+    }
+  }
+  return {0, kernels.convertPairs, kernels.convertSamples,
+          kernels.accumulatePairs, kernels.accumulateSamples};
+}
+
+// Time the variants on buffers that stay in cache, so the choice reflects
+// the arithmetic and not the memory bandwidth, and keep the fastest
+static const ProcessingKernels *timeKernels() {
+  const uint32_t nbrPairs = 16384;
+  const uint32_t nbrRepeats = 16;
+  std::vector<uint8_t> buff(2 * nbrPairs);
+  for (size_t i = 0; i < buff.size(); i++) {
+    buff[i] = static_cast<uint8_t>(rand());
+  }
+  std::vector<float> ch1(nbrPairs, 0);
+  std::vector<float> ch2(nbrPairs, 0);
+  ConvertTable table;
+  buildConvertTable(table, 2.0f / 256, 0.0f);
+
+  const ProcessingKernels *selected = nullptr;
+  double best = 0;
+  for (auto &variant : kernelVariants()) {
+    double fastest = 0;
+    for (uint32_t n = 0; n < nbrRepeats; n++) {
+      auto start = std::chrono::high_resolution_clock::now();
+      variant.convertPairs(buff.data(), nbrPairs, table, ch1.data(),
+                           ch2.data());
+      variant.convertSamples(buff.data(), nbrPairs, table, ch1.data());
+      variant.accumulatePairs(buff.data(), nbrPairs, table, ch1.data(),
+                              ch2.data());
+      variant.accumulateSamples(buff.data(), nbrPairs, table, ch2.data());
+      auto stop = std::chrono::high_resolution_clock::now();
+      double seconds = std::chrono::duration<double>(stop - start).count();
+      if (n == 0 || seconds < fastest) {
+        fastest = seconds;
+      }
+    }
+    LOG(plog::info) << "Processing kernels " << variant.name << ": "
+                    << fastest * 1e6 << " us";
+    if (selected == nullptr || fastest < best) {
+      selected = &variant;
+      best = fastest;
+    }
+  }
+  return selected;
+}
+
+static const ProcessingKernels *findSelectedKernels() {
+  const char *forced = getenv("ALAZAR_KERNELS");
+  if (forced != nullptr && forced[0] != '\0') {
+    const ProcessingKernels *kernels = kernelsByName(forced);
+    if (kernels != nullptr) {
+      LOG(plog::info) << "Processing kernels forced to " << kernels->name;
+      return kernels;
+    }
+    LOG(plog::error) << "ALAZAR_KERNELS " << forced
+                     << " is unknown or not supported by this CPU";
+  }
+  const ProcessingKernels *kernels = timeKernels();
+  LOG(plog::info) << "Selected processing kernels " << kernels->name;
+  return kernels;
+}
+
+const ProcessingKernels &selectKernels() {
+  static const ProcessingKernels *selected = findSelectedKernels();
+  return *selected;
+}
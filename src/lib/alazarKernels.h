@@ -0,0 +1,202 @@
+/*
+Copyright 2026 Raytheon BBN Technologies
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef ALAZARKERNELS_H_
+#define ALAZARKERNELS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Conversion of raw 8 bit samples to volts.  Every code maps to
+// counts2Volts * (code - 128) - channelOffset, so the whole mapping fits in a
+// 256 entry table that is rebuilt whenever the scale or offset change.  The
+// two channels share their scale and offset, and so one table.
+struct ConvertTable {
+  float counts2Volts;
+  float channelOffset;
+  alignas(64) float volts[256];
+};
+
+void buildConvertTable(ConvertTable &table, float counts2Volts,
+                       float channelOffset);
+
+// convert nbrPairs interleaved channel A/B samples
+typedef void (*ConvertPairsKernel)(const uint8_t *buff, uint32_t nbrPairs,
+                                   const ConvertTable &table, float *ch1,
+                                   float *ch2);
+
+// convert nbrSamples contiguous samples of one channel
+typedef void (*ConvertSamplesKernel)(const uint8_t *buff, uint32_t nbrSamples,
+                                     const ConvertTable &table, float *ch);
+
+// pack nbrSamples floats as IEEE half precision
+typedef void (*PackHalfKernel)(const float *in, uint32_t nbrSamples,
+                               uint16_t *out);
+
+// pack nbrSamples floats as the integers (in + offset) * gain, rounded to
+// nearest even and saturated to the type
+template <typename T>
+using PackKernel = void (*)(const float *in, uint32_t nbrSamples, float gain,
+                            float offset, T *out);
+
+// Kernels converting whole records.  Each variant provides one set per fixed
+// record length, with the length a template parameter so the loops have
+// constant trip counts the compiler unrolls; those ignore the count passed
+// in.  A recordLength of 0 marks the set taking any length.
+struct RecordKernels {
+  uint32_t recordLength;
+  ConvertPairsKernel convertPairs;
+  ConvertSamplesKernel convertSamples;
+  ConvertPairsKernel accumulatePairs;
+  ConvertSamplesKernel accumulateSamples;
+};
+
+#define NBR_FIXED_RECORD_LENGTHS 5
+
+// the fixed length record kernels of a kernel family templated on
+// <bool accumulate, uint32_t recordLength>
+#define RECORD_KERNELS(pairs, samples, N)                                      \
+  { N, pairs<false, N>, samples<false, N>, pairs<true, N>, samples<true, N> }
+#define FIXED_RECORD_KERNELS(pairs, samples)                                   \
+  {                                                                            \
+    RECORD_KERNELS(pairs, samples, 256), RECORD_KERNELS(pairs, samples, 512),  \
+        RECORD_KERNELS(pairs, samples, 1024),                                  \
+        RECORD_KERNELS(pairs, samples, 2048),                                  \
+        RECORD_KERNELS(pairs, samples, 4096)                                   \
+  }
+
+// The routines used by the digitizer and averager for one instruction set.
+// The convert kernels store the volts, the accumulate kernels add them to
+// the output.  All the variants produce identical results: the table holds
+// the arithmetic result for each code and the vector arithmetic uses the
+// same operations as the scalar code.
+struct ProcessingKernels {
+  const char *name;
+  ConvertPairsKernel convertPairs;
+  ConvertSamplesKernel convertSamples;
+  ConvertPairsKernel accumulatePairs;
+  ConvertSamplesKernel accumulateSamples;
+  const RecordKernels *fixedLength;
+  // conversions writing the output with non-temporal stores, bypassing the
+  // caches; streamFence has to run before the output is handed off
+  ConvertPairsKernel streamPairs;
+  ConvertSamplesKernel streamSamples;
+  // conversions of the float outputs to the compact output formats
+  PackHalfKernel packHalf;
+  PackKernel<int16_t> packInt16;
+  PackKernel<int8_t> packInt8;
+  PackKernel<int32_t> packInt32;
+};
+
+// round to nearest even as the vector conversions do, then saturate
+template <typename T> static inline T packInteger(float value) {
+  double rounded = std::nearbyint(static_cast<double>(value));
+  rounded = std::max<double>(rounded, std::numeric_limits<T>::min());
+  rounded = std::min<double>(rounded, std::numeric_limits<T>::max());
+  return static_cast<T>(rounded);
+}
+
+// IEEE half precision of value, rounded to nearest even like F16C; NaNs are
+// not expected and come out as infinities
+static inline uint16_t floatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+  uint32_t shift = 13;
+  uint32_t half;
+  if (exponent > 0) {
+    half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> shift);
+  } else if (exponent >= -10) {
+    // subnormal: the implicit bit joins the mantissa, shifted further
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    half = mantissa >> shift;
+  } else {
+    return static_cast<uint16_t>(sign);
+  }
+  // a carry out of the mantissa correctly bumps the exponent
+  uint32_t rest = mantissa & ((1u << shift) - 1);
+  uint32_t halfway = 1u << (shift - 1);
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    half++;
+  }
+  return static_cast<uint16_t>(sign | half);
+}
+
+// orders the non-temporal stores before the stores that follow
+void streamFence();
+
+// write the cache lines of a block back to memory and drop them from every
+// cache level, where the CPU can; the tuner uses it to process buffers that
+// come from memory as a DMA buffer would
+void evictFromCache(const void *data, size_t size);
+
+// floats to skip from out to reach an address aligned to alignment bytes
+static inline uint32_t alignmentGap(const float *out, uintptr_t alignment) {
+  uintptr_t misalignment = reinterpret_cast<uintptr_t>(out) % alignment;
+  return static_cast<uint32_t>(
+      misalignment ? (alignment - misalignment) / sizeof(float) : 0);
+}
+
+// the record kernels of the variant specialized for recordLength, or the
+// ones taking any length
+RecordKernels recordKernels(const ProcessingKernels &kernels,
+                            uint32_t recordLength);
+
+enum KernelIsa {
+  ISA_SCALAR,
+  ISA_SSE41,
+  ISA_AVX2,
+  ISA_AVX512,
+};
+
+// true when both the CPU and the operating system support the instruction set
+bool cpuSupports(KernelIsa isa);
+
+// brand string of the CPU, "unknown" where it cannot be read
+std::string cpuName();
+
+// bytes of L2 cache per core, DEFAULT_L2_CACHE_SIZE where it cannot be read
+#define DEFAULT_L2_CACHE_SIZE 0x100000 // 1M
+uint32_t l2CacheSize();
+
+// variants the CPU can run, the scalar arithmetic one first
+const std::vector<ProcessingKernels> &kernelVariants();
+
+// variant of that name if the CPU can run it, otherwise NULL
+const ProcessingKernels *kernelsByName(const char *name);
+
+// The kernels used by the library, chosen once per process.  The
+// ALAZAR_KERNELS environment variable forces a variant by name, otherwise
+// the variants the CPU supports are timed and the fastest is kept.
+const ProcessingKernels &selectKernels();
+
+// Each instruction set file appends its variants when it was compiled for
+// that instruction set; the registry only calls it once cpuSupports agrees.
+void addKernelsSSE41(std::vector<ProcessingKernels> &variants);
+void addKernelsAVX2(std::vector<ProcessingKernels> &variants);
+void addKernelsAVX512(std::vector<ProcessingKernels> &variants);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+Copyright 2026 Raytheon BBN Technologies
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// AVX2 processing kernels.  This file alone is compiled for AVX2 and the
+// registry only adds its variants once cpuSupports has confirmed the CPU can
+// run them.  Without AVX2 support in the compiler there are no variants.
+
+#include <algorithm>
+
+#include "alazarKernels.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+// channel A bytes in the low half, channel B bytes in the high half
+static inline __m128i deinterleave(const uint8_t *buff) {
+  const __m128i order =
+      _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buff));
+  return _mm_shuffle_epi8(raw, order);
+}
+
+// counts2Volts * (code - 128) - channelOffset with the operations of the
+// scalar code, so the results are identical
+static inline __m256 convert(__m256i codes, __m256 counts2Volts,
+                             __m256 channelOffset) {
+  __m256 counts =
+      _mm256_cvtepi32_ps(_mm256_sub_epi32(codes, _mm256_set1_epi32(128)));
+  return _mm256_sub_ps(_mm256_mul_ps(counts2Volts, counts), channelOffset);
+}
+
+template <bool accumulate, bool stream = false>
+static inline void store(float *out, __m256 volts) {
+  if (accumulate) {
+    volts = _mm256_add_ps(_mm256_loadu_ps(out), volts);
+  }
+  if (stream) {
+    _mm256_stream_ps(out, volts);
+  } else {
+    _mm256_storeu_ps(out, volts);
+  }
+}
+
+template <bool accumulate> static inline void store(float &out, float volts) {
+  if (accumulate) {
+    out += volts;
+  } else {
+    out = volts;
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0, bool stream = false>
+static void pairsShuffle(const uint8_t *buff, uint32_t nbrPairs,
+                         const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t n = recordLength ? recordLength : nbrPairs;
+  __m256 counts2Volts = _mm256_set1_ps(table.counts2Volts);
+  __m256 channelOffset = _mm256_set1_ps(table.channelOffset);
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i codes = deinterleave(buff + 2 * i);
+    __m256i codesA = _mm256_cvtepu8_epi32(codes);
+    __m256i codesB = _mm256_cvtepu8_epi32(_mm_srli_si128(codes, 8));
+    store<accumulate, stream>(ch1 + i,
+                              convert(codesA, counts2Volts, channelOffset));
+    store<accumulate, stream>(ch2 + i,
+                              convert(codesB, counts2Volts, channelOffset));
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch1[i], table.volts[buff[2 * i]]);
+    store<accumulate>(ch2[i], table.volts[buff[2 * i + 1]]);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0, bool stream = false>
+static void samplesShuffle(const uint8_t *buff, uint32_t nbrSamples,
+                           const ConvertTable &table, float *ch) {
+  uint32_t n = recordLength ? recordLength : nbrSamples;
+  __m256 counts2Volts = _mm256_set1_ps(table.counts2Volts);
+  __m256 channelOffset = _mm256_set1_ps(table.channelOffset);
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i codes =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(buff + i));
+    store<accumulate, stream>(ch + i, convert(_mm256_cvtepu8_epi32(codes),
+                                              counts2Volts, channelOffset));
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch[i], table.volts[buff[i]]);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0>
+static void pairsGather(const uint8_t *buff, uint32_t nbrPairs,
+                        const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t n = recordLength ? recordLength : nbrPairs;
+  const float *volts = table.volts;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i codes = deinterleave(buff + 2 * i);
+    __m256i codesA = _mm256_cvtepu8_epi32(codes);
+    __m256i codesB = _mm256_cvtepu8_epi32(_mm_srli_si128(codes, 8));
+    store<accumulate>(ch1 + i, _mm256_i32gather_ps(volts, codesA, 4));
+    store<accumulate>(ch2 + i, _mm256_i32gather_ps(volts, codesB, 4));
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch1[i], volts[buff[2 * i]]);
+    store<accumulate>(ch2[i], volts[buff[2 * i + 1]]);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0>
+static void samplesGather(const uint8_t *buff, uint32_t nbrSamples,
+                          const ConvertTable &table, float *ch) {
+  uint32_t n = recordLength ? recordLength : nbrSamples;
+  const float *volts = table.volts;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i codes =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(buff + i));
+    store<accumulate>(
+        ch + i, _mm256_i32gather_ps(volts, _mm256_cvtepu8_epi32(codes), 4));
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch[i], volts[buff[i]]);
+  }
+}
+
+// The streaming stores need outputs aligned to the vector: the samples before
+// ch1 is aligned take the regular path, as does everything when ch2 is
+// aligned differently
+static void streamPairs(const uint8_t *buff, uint32_t nbrPairs,
+                        const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t head = std::min(nbrPairs, alignmentGap(ch1, 32));
+  pairsShuffle<false>(buff, head, table, ch1, ch2);
+  if (alignmentGap(ch2 + head, 32) != 0) {
+    pairsShuffle<false>(buff + 2 * head, nbrPairs - head, table, ch1 + head,
+                        ch2 + head);
+  } else {
+    pairsShuffle<false, 0, true>(buff + 2 * head, nbrPairs - head, table,
+                                 ch1 + head, ch2 + head);
+  }
+}
+
+static void streamSamples(const uint8_t *buff, uint32_t nbrSamples,
+                          const ConvertTable &table, float *ch) {
+  uint32_t head = std::min(nbrSamples, alignmentGap(ch, 32));
+  samplesShuffle<false>(buff, head, table, ch);
+  samplesShuffle<false, 0, true>(buff + head, nbrSamples - head, table,
+                                 ch + head);
+}
+
+// (in + offset) * gain rounded to the nearest even integer
+static inline __m256i scaled(const float *in, __m256 gain, __m256 offset) {
+  return _mm256_cvtps_epi32(
+      _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(in), offset), gain));
+}
+
+// F16C came with the AVX2 processors and is built alongside it
+static void packHalf(const float *in, uint32_t nbrSamples, uint16_t *out) {
+  uint32_t i = 0;
+#if defined(__F16C__) || defined(_MSC_VER)
+  for (; i + 8 <= nbrSamples; i += 8) {
+    __m128i half =
+        _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), half);
+  }
+#endif
+  for (; i < nbrSamples; i++) {
+    out[i] = floatToHalf(in[i]);
+  }
+}
+
+// the packs work within each 128 bit lane, the permutes restore the order
+static void packInt16(const float *in, uint32_t nbrSamples, float gain,
+                      float offset, int16_t *out) {
+  __m256 vgain = _mm256_set1_ps(gain);
+  __m256 voffset = _mm256_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 16 <= nbrSamples; i += 16) {
+    __m256i packed = _mm256_packs_epi32(scaled(in + i, vgain, voffset),
+                                        scaled(in + i + 8, vgain, voffset));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_permute4x64_epi64(packed,
+                                                 _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int16_t>((in[i] + offset) * gain);
+  }
+}
+
+static void packInt8(const float *in, uint32_t nbrSamples, float gain,
+                     float offset, int8_t *out) {
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256 vgain = _mm256_set1_ps(gain);
+  __m256 voffset = _mm256_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 32 <= nbrSamples; i += 32) {
+    __m256i low = _mm256_packs_epi32(scaled(in + i, vgain, voffset),
+                                     scaled(in + i + 8, vgain, voffset));
+    __m256i high = _mm256_packs_epi32(scaled(in + i + 16, vgain, voffset),
+                                      scaled(in + i + 24, vgain, voffset));
+    __m256i packed = _mm256_packs_epi16(low, high);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_permutevar8x32_epi32(packed, order));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int8_t>((in[i] + offset) * gain);
+  }
+}
+
+static void packInt32(const float *in, uint32_t nbrSamples, float gain,
+                      float offset, int32_t *out) {
+  __m256 vgain = _mm256_set1_ps(gain);
+  __m256 voffset = _mm256_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 8 <= nbrSamples; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        scaled(in + i, vgain, voffset));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int32_t>((in[i] + offset) * gain);
+  }
+}
+
+void addKernelsAVX2(std::vector<ProcessingKernels> &variants) {
+  static const RecordKernels shuffleFixed[NBR_FIXED_RECORD_LENGTHS] =
+      FIXED_RECORD_KERNELS(pairsShuffle, samplesShuffle);
+  static const RecordKernels gatherFixed[NBR_FIXED_RECORD_LENGTHS] =
+      FIXED_RECORD_KERNELS(pairsGather, samplesGather);
+  variants.push_back({"avx2", pairsShuffle<false>, samplesShuffle<false>,
+                      pairsShuffle<true>, samplesShuffle<true>, shuffleFixed,
+                      streamPairs, streamSamples, packHalf, packInt16,
+                      packInt8, packInt32});
+  variants.push_back({"avx2-gather", pairsGather<false>, samplesGather<false>,
+                      pairsGather<true>, samplesGather<true>, gatherFixed,
+                      streamPairs, streamSamples, packHalf, packInt16,
+                      packInt8, packInt32});
+}
+
+#else
+
+void addKernelsAVX2(std::vector<ProcessingKernels> &) {}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+Copyright 2026 Raytheon BBN Technologies
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// AVX-512 processing kernels, compiled for AVX-512F/BW alone.  They convert
+// sixteen samples of each channel per step.
+
+#include <algorithm>
+
+#include "alazarKernels.h"
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+
+#include <immintrin.h>
+
+// The GCC 12 intrinsics start some conversions from _mm512_undefined values
+// and warn about them wherever they are inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// channel A bytes in the low 128 bits, channel B bytes in the high 128 bits
+static inline __m256i deinterleave(const uint8_t *buff) {
+  const __m256i order = _mm256_setr_epi8(
+      0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0, 2, 4, 6, 8, 10,
+      12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buff));
+  // each lane holds 8 A then 8 B samples, gather the A and B quarters
+  return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(raw, order),
+                                  _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+// counts2Volts * (code - 128) - channelOffset for sixteen bytes, with the
+// operations of the scalar code.  AVX-512 implies FMA and the compiler would
+// fuse a plain multiply and subtract, changing the rounding; the explicitly
+// rounded multiply keeps the two steps apart.
+static inline __m512 convert(__m128i codes, __m512 counts2Volts,
+                             __m512 channelOffset) {
+  __m512i wide =
+      _mm512_sub_epi32(_mm512_cvtepu8_epi32(codes), _mm512_set1_epi32(128));
+  __m512 scaled =
+      _mm512_mul_round_ps(counts2Volts, _mm512_cvtepi32_ps(wide),
+                          _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  return _mm512_sub_ps(scaled, channelOffset);
+}
+
+template <bool accumulate, bool stream = false>
+static inline void store(float *out, __m512 volts) {
+  if (accumulate) {
+    volts = _mm512_add_ps(_mm512_loadu_ps(out), volts);
+  }
+  if (stream) {
+    _mm512_stream_ps(out, volts);
+  } else {
+    _mm512_storeu_ps(out, volts);
+  }
+}
+
+template <bool accumulate> static inline void store(float &out, float volts) {
+  if (accumulate) {
+    out += volts;
+  } else {
+    out = volts;
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0, bool stream = false>
+static void pairs(const uint8_t *buff, uint32_t nbrPairs,
+                  const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t n = recordLength ? recordLength : nbrPairs;
+  __m512 counts2Volts = _mm512_set1_ps(table.counts2Volts);
+  __m512 channelOffset = _mm512_set1_ps(table.channelOffset);
+  uint32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i codes = deinterleave(buff + 2 * i);
+    __m512 voltsA = convert(_mm256_castsi256_si128(codes), counts2Volts,
+                            channelOffset);
+    __m512 voltsB = convert(_mm256_extracti128_si256(codes, 1), counts2Volts,
+                            channelOffset);
+    store<accumulate, stream>(ch1 + i, voltsA);
+    store<accumulate, stream>(ch2 + i, voltsB);
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch1[i], table.volts[buff[2 * i]]);
+    store<accumulate>(ch2[i], table.volts[buff[2 * i + 1]]);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0, bool stream = false>
+static void samples(const uint8_t *buff, uint32_t nbrSamples,
+                    const ConvertTable &table, float *ch) {
+  uint32_t n = recordLength ? recordLength : nbrSamples;
+  __m512 counts2Volts = _mm512_set1_ps(table.counts2Volts);
+  __m512 channelOffset = _mm512_set1_ps(table.channelOffset);
+  uint32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i codes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(buff + i));
+    store<accumulate, stream>(ch + i,
+                              convert(codes, counts2Volts, channelOffset));
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch[i], table.volts[buff[i]]);
+  }
+}
+
+// The streaming stores need outputs aligned to the vector: the samples before
+// ch1 is aligned take the regular path, as does everything when ch2 is
+// aligned differently
+static void streamPairs(const uint8_t *buff, uint32_t nbrPairs,
+                        const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t head = std::min(nbrPairs, alignmentGap(ch1, 64));
+  pairs<false>(buff, head, table, ch1, ch2);
+  if (alignmentGap(ch2 + head, 64) != 0) {
+    pairs<false>(buff + 2 * head, nbrPairs - head, table, ch1 + head,
+                 ch2 + head);
+  } else {
+    pairs<false, 0, true>(buff + 2 * head, nbrPairs - head, table,
+                          ch1 + head, ch2 + head);
+  }
+}
+
+static void streamSamples(const uint8_t *buff, uint32_t nbrSamples,
+                          const ConvertTable &table, float *ch) {
+  uint32_t head = std::min(nbrSamples, alignmentGap(ch, 64));
+  samples<false>(buff, head, table, ch);
+  samples<false, 0, true>(buff + head, nbrSamples - head, table,
+                          ch + head);
+}
+
+// (in + offset) * gain rounded to the nearest even integer
+static inline __m512i scaled(const float *in, __m512 gain, __m512 offset) {
+  return _mm512_cvtps_epi32(
+      _mm512_mul_ps(_mm512_add_ps(_mm512_loadu_ps(in), offset), gain));
+}
+
+static void packHalf(const float *in, uint32_t nbrSamples, uint16_t *out) {
+  uint32_t i = 0;
+  for (; i + 16 <= nbrSamples; i += 16) {
+    __m256i half = _mm512_cvtps_ph(_mm512_loadu_ps(in + i),
+                                   _MM_FROUND_TO_NEAREST_INT |
+                                       _MM_FROUND_NO_EXC);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), half);
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = floatToHalf(in[i]);
+  }
+}
+
+// the saturating narrowing conversions take the place of the packs
+static void packInt16(const float *in, uint32_t nbrSamples, float gain,
+                      float offset, int16_t *out) {
+  __m512 vgain = _mm512_set1_ps(gain);
+  __m512 voffset = _mm512_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 16 <= nbrSamples; i += 16) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm512_cvtsepi32_epi16(scaled(in + i, vgain, voffset)));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int16_t>((in[i] + offset) * gain);
+  }
+}
+
+static void packInt8(const float *in, uint32_t nbrSamples, float gain,
+                     float offset, int8_t *out) {
+  __m512 vgain = _mm512_set1_ps(gain);
+  __m512 voffset = _mm512_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 16 <= nbrSamples; i += 16) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm512_cvtsepi32_epi8(scaled(in + i, vgain, voffset)));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int8_t>((in[i] + offset) * gain);
+  }
+}
+
+static void packInt32(const float *in, uint32_t nbrSamples, float gain,
+                      float offset, int32_t *out) {
+  __m512 vgain = _mm512_set1_ps(gain);
+  __m512 voffset = _mm512_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 16 <= nbrSamples; i += 16) {
+    _mm512_storeu_si512(out + i, scaled(in + i, vgain, voffset));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int32_t>((in[i] + offset) * gain);
+  }
+}
+
+void addKernelsAVX512(std::vector<ProcessingKernels> &variants) {
+  static const RecordKernels fixed[NBR_FIXED_RECORD_LENGTHS] =
+      FIXED_RECORD_KERNELS(pairs, samples);
+  variants.push_back({"avx512", pairs<false>, samples<false>, pairs<true>,
+                      samples<true>, fixed, streamPairs, streamSamples,
+                      packHalf, packInt16, packInt8, packInt32});
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#else
+
+void addKernelsAVX512(std::vector<ProcessingKernels> &) {}
+
+#endif
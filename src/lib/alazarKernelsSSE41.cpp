@@ -0,0 +1,216 @@
+/*
+Copyright 2026 Raytheon BBN Technologies
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// SSE4.1 processing kernels, compiled for SSE4.1 alone.  They are four lanes
+// wide, for CPUs without AVX2.
+
+#include <algorithm>
+
+#include "alazarKernels.h"
+
+#if defined(__SSE4_1__) ||                                                    \
+    (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+
+#include <smmintrin.h>
+
+// channel A bytes in the low half, channel B bytes in the high half
+static inline __m128i deinterleave(const uint8_t *buff) {
+  const __m128i order =
+      _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buff));
+  return _mm_shuffle_epi8(raw, order);
+}
+
+// counts2Volts * (code - 128) - channelOffset for the four low bytes, with
+// the operations of the scalar code
+static inline __m128 convert(__m128i codes, __m128 counts2Volts,
+                             __m128 channelOffset) {
+  __m128i wide = _mm_sub_epi32(_mm_cvtepu8_epi32(codes), _mm_set1_epi32(128));
+  return _mm_sub_ps(_mm_mul_ps(counts2Volts, _mm_cvtepi32_ps(wide)),
+                    channelOffset);
+}
+
+template <bool accumulate, bool stream = false>
+static inline void store(float *out, __m128 volts) {
+  if (accumulate) {
+    volts = _mm_add_ps(_mm_loadu_ps(out), volts);
+  }
+  if (stream) {
+    _mm_stream_ps(out, volts);
+  } else {
+    _mm_storeu_ps(out, volts);
+  }
+}
+
+template <bool accumulate> static inline void store(float &out, float volts) {
+  if (accumulate) {
+    out += volts;
+  } else {
+    out = volts;
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0, bool stream = false>
+static void pairs(const uint8_t *buff, uint32_t nbrPairs,
+                  const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t n = recordLength ? recordLength : nbrPairs;
+  __m128 counts2Volts = _mm_set1_ps(table.counts2Volts);
+  __m128 channelOffset = _mm_set1_ps(table.channelOffset);
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i codes = deinterleave(buff + 2 * i);
+    // the quarters of codes are A0-3, A4-7, B0-3 and B4-7
+    __m128 volts0 = convert(codes, counts2Volts, channelOffset);
+    __m128 volts1 =
+        convert(_mm_srli_si128(codes, 4), counts2Volts, channelOffset);
+    __m128 volts2 =
+        convert(_mm_srli_si128(codes, 8), counts2Volts, channelOffset);
+    __m128 volts3 =
+        convert(_mm_srli_si128(codes, 12), counts2Volts, channelOffset);
+    store<accumulate, stream>(ch1 + i, volts0);
+    store<accumulate, stream>(ch1 + i + 4, volts1);
+    store<accumulate, stream>(ch2 + i, volts2);
+    store<accumulate, stream>(ch2 + i + 4, volts3);
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch1[i], table.volts[buff[2 * i]]);
+    store<accumulate>(ch2[i], table.volts[buff[2 * i + 1]]);
+  }
+}
+
+template <bool accumulate, uint32_t recordLength = 0, bool stream = false>
+static void samples(const uint8_t *buff, uint32_t nbrSamples,
+                    const ConvertTable &table, float *ch) {
+  uint32_t n = recordLength ? recordLength : nbrSamples;
+  __m128 counts2Volts = _mm_set1_ps(table.counts2Volts);
+  __m128 channelOffset = _mm_set1_ps(table.channelOffset);
+  uint32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i codes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(buff + i));
+    __m128 volts0 = convert(codes, counts2Volts, channelOffset);
+    __m128 volts1 =
+        convert(_mm_srli_si128(codes, 4), counts2Volts, channelOffset);
+    __m128 volts2 =
+        convert(_mm_srli_si128(codes, 8), counts2Volts, channelOffset);
+    __m128 volts3 =
+        convert(_mm_srli_si128(codes, 12), counts2Volts, channelOffset);
+    store<accumulate, stream>(ch + i, volts0);
+    store<accumulate, stream>(ch + i + 4, volts1);
+    store<accumulate, stream>(ch + i + 8, volts2);
+    store<accumulate, stream>(ch + i + 12, volts3);
+  }
+  for (; i < n; i++) {
+    store<accumulate>(ch[i], table.volts[buff[i]]);
+  }
+}
+
+// The streaming stores need outputs aligned to the vector: the samples before
+// ch1 is aligned take the regular path, as does everything when ch2 is
+// aligned differently
+static void streamPairs(const uint8_t *buff, uint32_t nbrPairs,
+                        const ConvertTable &table, float *ch1, float *ch2) {
+  uint32_t head = std::min(nbrPairs, alignmentGap(ch1, 16));
+  pairs<false>(buff, head, table, ch1, ch2);
+  if (alignmentGap(ch2 + head, 16) != 0) {
+    pairs<false>(buff + 2 * head, nbrPairs - head, table, ch1 + head,
+                 ch2 + head);
+  } else {
+    pairs<false, 0, true>(buff + 2 * head, nbrPairs - head, table,
+                          ch1 + head, ch2 + head);
+  }
+}
+
+static void streamSamples(const uint8_t *buff, uint32_t nbrSamples,
+                          const ConvertTable &table, float *ch) {
+  uint32_t head = std::min(nbrSamples, alignmentGap(ch, 16));
+  samples<false>(buff, head, table, ch);
+  samples<false, 0, true>(buff + head, nbrSamples - head, table,
+                          ch + head);
+}
+
+// (in + offset) * gain rounded to the nearest even integer
+static inline __m128i scaled(const float *in, __m128 gain, __m128 offset) {
+  return _mm_cvtps_epi32(
+      _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(in), offset), gain));
+}
+
+// there is no half precision conversion before F16C
+static void packHalf(const float *in, uint32_t nbrSamples, uint16_t *out) {
+  for (uint32_t i = 0; i < nbrSamples; i++) {
+    out[i] = floatToHalf(in[i]);
+  }
+}
+
+static void packInt16(const float *in, uint32_t nbrSamples, float gain,
+                      float offset, int16_t *out) {
+  __m128 vgain = _mm_set1_ps(gain);
+  __m128 voffset = _mm_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 8 <= nbrSamples; i += 8) {
+    __m128i packed = _mm_packs_epi32(scaled(in + i, vgain, voffset),
+                                     scaled(in + i + 4, vgain, voffset));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int16_t>((in[i] + offset) * gain);
+  }
+}
+
+static void packInt8(const float *in, uint32_t nbrSamples, float gain,
+                     float offset, int8_t *out) {
+  __m128 vgain = _mm_set1_ps(gain);
+  __m128 voffset = _mm_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 16 <= nbrSamples; i += 16) {
+    __m128i low = _mm_packs_epi32(scaled(in + i, vgain, voffset),
+                                  scaled(in + i + 4, vgain, voffset));
+    __m128i high = _mm_packs_epi32(scaled(in + i + 8, vgain, voffset),
+                                   scaled(in + i + 12, vgain, voffset));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_packs_epi16(low, high));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int8_t>((in[i] + offset) * gain);
+  }
+}
+
+static void packInt32(const float *in, uint32_t nbrSamples, float gain,
+                      float offset, int32_t *out) {
+  __m128 vgain = _mm_set1_ps(gain);
+  __m128 voffset = _mm_set1_ps(offset);
+  uint32_t i = 0;
+  for (; i + 4 <= nbrSamples; i += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     scaled(in + i, vgain, voffset));
+  }
+  for (; i < nbrSamples; i++) {
+    out[i] = packInteger<int32_t>((in[i] + offset) * gain);
+  }
+}
+
+void addKernelsSSE41(std::vector<ProcessingKernels> &variants) {
+  static const RecordKernels fixed[NBR_FIXED_RECORD_LENGTHS] =
+      FIXED_RECORD_KERNELS(pairs, samples);
+  variants.push_back({"sse41", pairs<false>, samples<false>, pairs<true>,
+                      samples<true>, fixed, streamPairs, streamSamples,
+                      packHalf, packInt16, packInt8, packInt32});
+}
+
+#else
+
+void addKernelsSSE41(std::vector<ProcessingKernels> &) {}
+
+#endif
@@ -15,8 +15,11 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <map>
+#include <mutex>
 #include <math.h>
 #include <string>
 #include <thread>
@@ -30,6 +33,10 @@ limitations under the License.
 
 using namespace moodycamel;
 static ReaderWriterQueue<void *> bufferQ(MAX_NUM_BUFFERS);
+// the buffers are posted from the receive thread and the API thread
+static std::mutex bufferMutex;
+// set by AlazarAbortAsyncRead, which wakes a pending wait
+static std::atomic<bool> aborted(false);
 
 uint32_t dummyBoard;
 uint32_t recordSize;
@@ -37,9 +44,21 @@ uint32_t bufferLenBytes;
 uint32_t samplesPerRecord;
 uint32_t testCyclesPerRecord = 1;
 uint32_t recordCounter = 0;
+uint32_t channelSelect = CHANNEL_A | CHANNEL_B;
+bool interleaveSamples = true;
+// ALAZAR_SIM_OVERFLOW makes the board overflow after that many buffers
+uint32_t overflowBuffers = 0;
+uint32_t buffersCompleted = 0;
+// calls made to the board settings, read by the tests of the configuration
+extern "C" {
+uint32_t simSettingCalls = 0;
+}
+// ALAZAR_SIM_BUFFER_MS delays every buffer as a slow trigger would
+uint32_t bufferDelay = 0;
 
 RETURN_CODE AlazarPostAsyncBuffer(HANDLE hDevice, void *pBuffer,
                                   U32 uBufferLength_bytes) {
+  std::lock_guard<std::mutex> lock(bufferMutex);
   bufferQ.enqueue(pBuffer);
 
   bufferLenBytes = uBufferLength_bytes;
@@ -48,19 +67,71 @@ RETURN_CODE AlazarPostAsyncBuffer(HANDLE hDevice, void *pBuffer,
 
 RETURN_CODE AlazarWaitAsyncBufferComplete(HANDLE hDevice, void *pBuffer,
                                           U32 uTimeout_ms) {
+  if (overflowBuffers > 0 && buffersCompleted >= overflowBuffers) {
+    return ApiBufferOverflow;
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = [start]() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  };
+  while (elapsed() < bufferDelay) {
+    if (aborted) {
+      return ApiWaitCanceled;
+    }
+    if (elapsed() >= uTimeout_ms) {
+      return ApiWaitTimeout;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
   void *bufp;
-  while (!bufferQ.try_dequeue(bufp))
-    ;
+  while (true) {
+    if (aborted) {
+      return ApiWaitCanceled;
+    }
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    if (bufferQ.try_dequeue(bufp)) {
+      break;
+    }
+  }
+  buffersCompleted++;
   if (bufp == pBuffer) {
     int8_t *temp = static_cast<int8_t *>(bufp);
-    // fill in with some dummy data
-    for (uint32_t i = 0; i < (bufferLenBytes / 2) / samplesPerRecord; i++) {
-      int8_t value = static_cast<int8_t>(recordCounter % 256);
-      for (uint32_t j = 0; j < samplesPerRecord; j++) {
-        temp[2 * j + 2 * i * samplesPerRecord] = value;
-        temp[2 * j + 1 + 2 * i * samplesPerRecord] = value + 1;
+    // fill in with some dummy data; channel B is one count above channel A.
+    // Without interleaving the records of channel B follow those of channel
+    // A, and a single channel is never interleaved.
+    if (channelSelect == (CHANNEL_A | CHANNEL_B) && !interleaveSamples) {
+      uint32_t recordsPerBuffer = (bufferLenBytes / 2) / samplesPerRecord;
+      uint32_t channelBytes = recordsPerBuffer * samplesPerRecord;
+      for (uint32_t i = 0; i < recordsPerBuffer; i++) {
+        int8_t value = static_cast<int8_t>(recordCounter % 256);
+        for (uint32_t j = 0; j < samplesPerRecord; j++) {
+          temp[j + i * samplesPerRecord] = value;
+          temp[channelBytes + j + i * samplesPerRecord] = value + 1;
+        }
+        recordCounter++;
+      }
+    } else if (channelSelect == (CHANNEL_A | CHANNEL_B)) {
+      for (uint32_t i = 0; i < (bufferLenBytes / 2) / samplesPerRecord; i++) {
+        int8_t value = static_cast<int8_t>(recordCounter % 256);
+        for (uint32_t j = 0; j < samplesPerRecord; j++) {
+          temp[2 * j + 2 * i * samplesPerRecord] = value;
+          temp[2 * j + 1 + 2 * i * samplesPerRecord] = value + 1;
+        }
+        recordCounter++;
+      }
+    } else {
+      for (uint32_t i = 0; i < bufferLenBytes / samplesPerRecord; i++) {
+        int8_t value = static_cast<int8_t>(recordCounter % 256);
+        if (channelSelect == CHANNEL_B) {
+          value += 1;
+        }
+        for (uint32_t j = 0; j < samplesPerRecord; j++) {
+          temp[j + i * samplesPerRecord] = value;
+        }
+        recordCounter++;
       }
-      recordCounter++;
     }
 
     return ApiSuccess;
@@ -234,21 +305,25 @@ RETURN_CODE AlazarSetLED(HANDLE BoardHandle, U32 LedOn) { return ApiSuccess; }
 RETURN_CODE EXPORT AlazarSetCaptureClock(HANDLE h, U32 Source, U32 Rate,
                                          U32 Edge, U32 Decimation) {
   // todo - parameter checking
+  simSettingCalls++;
   return ApiSuccess;
 }
 
 RETURN_CODE AlazarInputControl(HANDLE h, U8 Channel, U32 Coupling,
                                U32 InputRange, U32 Impedance) {
   // todo - parameter checking
+  simSettingCalls++;
   return ApiSuccess;
 }
 
 RETURN_CODE AlazarSetBWLimit(HANDLE h, U32 Channel, U32 enable) {
   // todo - parameter checking
+  simSettingCalls++;
   return ApiSuccess;
 }
 RETURN_CODE AlazarSetExternalTrigger(HANDLE h, U32 Coupling, U32 Range) {
   // todo - parameter checking
+  simSettingCalls++;
   return ApiSuccess;
 }
 
@@ -257,15 +332,21 @@ AlazarSetTriggerOperation(HANDLE h, U32 TriggerOperation,
                           U32 TriggerEngine1 /*j,K*/, U32 Source1, U32 Slope1,
                           U32 Level1, U32 TriggerEngine2 /*j,K*/, U32 Source2,
                           U32 Slope2, U32 Level2) {
+  simSettingCalls++;
   return ApiSuccess;
 }
 
-RETURN_CODE AlazarSetTriggerDelay(HANDLE h, U32 Delay) { return ApiSuccess; }
+RETURN_CODE AlazarSetTriggerDelay(HANDLE h, U32 Delay) {
+  simSettingCalls++;
+  return ApiSuccess;
+}
 RETURN_CODE EXPORT AlazarSetTriggerTimeOut(HANDLE h, U32 to_ns) {
+  simSettingCalls++;
   return ApiSuccess;
 }
 
 RETURN_CODE AlazarSetRecordSize(HANDLE h, U32 PreSize, U32 PostSize) {
+  simSettingCalls++;
   recordSize = PostSize;
   return ApiSuccess;
 }
@@ -276,7 +357,19 @@ RETURN_CODE AlazarBeforeAsyncRead(HANDLE hBoard, U32 uChannelSelect,
                                   U32 uRecordsPerAcquisition, U32 uFlags) {
 
   recordCounter = 0;
+  buffersCompleted = 0;
+  const char *overflow = getenv("ALAZAR_SIM_OVERFLOW");
+  overflowBuffers = overflow != nullptr ? atoi(overflow) : 0;
+  const char *delay = getenv("ALAZAR_SIM_BUFFER_MS");
+  bufferDelay = delay != nullptr ? atoi(delay) : 0;
+  aborted = false;
+  // the buffers posted since the last acquisition are forgotten
+  std::lock_guard<std::mutex> lock(bufferMutex);
+  while (bufferQ.pop())
+    ;
   samplesPerRecord = uSamplesPerRecord;
+  channelSelect = uChannelSelect;
+  interleaveSamples = (uFlags & ADMA_INTERLEAVE_SAMPLES) != 0;
   return ApiSuccess;
 }
 
@@ -287,7 +380,9 @@ RETURN_CODE AlazarStartCapture(HANDLE h) { return ApiSuccess; }
 RETURN_CODE AlazarCloseAUTODma(HANDLE h) { return ApiSuccess; }
 
 RETURN_CODE AlazarAbortAsyncRead(HANDLE hBoard) {
+  aborted = true;
   // pop until false to clear the queue
+  std::lock_guard<std::mutex> lock(bufferMutex);
   while (bufferQ.pop())
     ;
   return ApiSuccess;
@@ -43,7 +43,8 @@ const option::Descriptor usage[] = {
     {HELP, 0, "", "help", option::Arg::None,
      "	--help	\tPrint usage and exit."},
     {MODE, 0, "", "mode", option::Arg::None,
-     "  --mode\tAcquisition mode, 'digitizer' or 'averager' (default)"},
+     "  --mode\tAcquisition mode, 'digitizer', 'correlator' or 'averager' "
+     "(default)"},
     {SEGMENTS, 0, "", "segments", option::Arg::Numeric,
      "  --segments\tNumber of segments (default = 1)"},
     {WAVEFORMS, 0, "", "waveforms", option::Arg::Numeric,
@@ -98,7 +99,7 @@ int main(int argc, char *argv[]) {
 
   // todo - make more parameters user configurable
   ConfigData_t config = {
-      "averager", // acquire mode - "digitizer" or "averager"
+      "averager", // acquire mode - "digitizer", "averager" or "correlator"
       "Full",     // bandwidth - "Full" or "20MHz"
       "ref",      // todo - clockType, parameter currently not used
       0.0,        // trigger delay in seconds
@@ -0,0 +1,225 @@
+/*
+Copyright 2026 Raytheon BBN Technologies
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+Processing benchmark: times the processing kernels available on this CPU,
+processBuffer for each acquisition mode with the interleaved and the blocked
+DMA layouts, and the averager with and without tiling over a range of record
+lengths and segment counts, and the digitizer with and without streaming
+stores.  The buffers rotate through a ring like the DMA buffers do, so large
+acquisitions are not served from the cache.  Build with SIM=ON so the board
+configuration runs against the simulator.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "libAlazar.h"
+
+// time nbrIterations passes over the buffers of one acquisition and return
+// the throughput in MB/s of raw samples
+static double benchmark(const char *mode, const char *layout,
+                        uint32_t recordLength, uint32_t nbrWaveforms,
+                        uint32_t nbrSegments, uint32_t nbrRoundRobins,
+                        uint32_t nbrIterations, uint32_t averagerTile = 0,
+                        uint32_t streamThreshold = 0) {
+  ConfigData_t config = {};
+  config.acquireMode = mode;
+  config.bandwidth = "Full";
+  config.clockType = "ref";
+  config.recordLength = recordLength;
+  config.nbrSegments = nbrSegments;
+  config.nbrWaveforms = nbrWaveforms;
+  config.nbrRoundRobins = nbrRoundRobins;
+  config.samplingRate = 500e6;
+  config.triggerCoupling = "DC";
+  config.triggerLevel = 1000;
+  config.triggerSlope = "rising";
+  config.triggerSource = "Ext";
+  config.verticalCoupling = "AC";
+  config.verticalScale = 1.0;
+  config.nbrCorrelationLags = 4;
+  config.eventThresholdCh1 = 0.9;
+  config.eventThresholdCh2 = 0.9;
+  config.eventWindow = 256;
+  config.dmaLayout = layout;
+  config.streamThreshold = streamThreshold;
+
+  AlazarATS9870 board;
+  AcquisitionParams_t acqParams;
+  if (board.ConfigureBoard(1, 1, config, acqParams) < 0) {
+    return -1;
+  }
+  if (averagerTile) {
+    board.averagerTile = averagerTile;
+  }
+
+  // noise around mid scale, the layout does not change the statistics
+  std::vector<std::shared_ptr<std::vector<uint8_t>>> buffs(
+      std::min(board.nbrBuffers, 8u));
+  srand(1);
+  for (auto &buff : buffs) {
+    buff = std::make_shared<std::vector<uint8_t>>(board.bufferLen);
+    for (auto &sample : *buff) {
+      sample = static_cast<uint8_t>(128 + rand() % 64 - 32);
+    }
+  }
+
+  std::vector<float> ch1(acqParams.samplesPerAcquisition);
+  std::vector<float> ch2(acqParams.samplesPerAcquisition);
+
+  board.processCounter = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (uint32_t n = 0; n < nbrIterations; n++) {
+    for (uint32_t b = 0; b < board.nbrBuffers; b++) {
+      board.processBuffer(buffs[b % buffs.size()]->data(), ch1.data(),
+                          ch2.data());
+    }
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+
+  double seconds = std::chrono::duration<double>(stop - start).count();
+  double bytes = 1.0 * board.bufferLen * board.nbrBuffers * nbrIterations;
+  return bytes / seconds / 1e6;
+}
+
+// throughput in MB/s of raw samples of the conversion, or accumulation, of a
+// kernel variant on a buffer the size of a DMA buffer
+static double benchmarkKernel(const ProcessingKernels &kernels, bool pairs,
+                              bool accumulate, uint32_t nbrIterations) {
+  const uint32_t nbrSamples = PREF_BUFFER_SIZE;
+  std::vector<uint8_t> buff(nbrSamples);
+  for (auto &sample : buff) {
+    sample = static_cast<uint8_t>(rand());
+  }
+  std::vector<float> ch1(nbrSamples, 0), ch2(nbrSamples, 0);
+  ConvertTable table;
+  buildConvertTable(table, 2.0f / 256, 0.0f);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (uint32_t n = 0; n < nbrIterations; n++) {
+    if (pairs) {
+      (accumulate ? kernels.accumulatePairs : kernels.convertPairs)(
+          buff.data(), nbrSamples / 2, table, ch1.data(), ch2.data());
+    } else {
+      (accumulate ? kernels.accumulateSamples : kernels.convertSamples)(
+          buff.data(), nbrSamples, table, ch1.data());
+    }
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+
+  double seconds = std::chrono::duration<double>(stop - start).count();
+  return 1.0 * nbrSamples * nbrIterations / seconds / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+
+  if ((argc > 1) && !strncmp(argv[1], "-h", 2)) {
+    printf("USAGE: %s [recordLength] [waveforms] [segments] [roundRobins] "
+           "[iterations]\n",
+           argv[0]);
+    exit(-1);
+  }
+
+  uint32_t recordLength = argc > 1 ? atoi(argv[1]) : 4096;
+  uint32_t nbrWaveforms = argc > 2 ? atoi(argv[2]) : 4;
+  uint32_t nbrSegments = argc > 3 ? atoi(argv[3]) : 16;
+  uint32_t nbrRoundRobins = argc > 4 ? atoi(argv[4]) : 4;
+  uint32_t nbrIterations = argc > 5 ? atoi(argv[5]) : 20;
+
+  std::cout << "processing kernels, selected " << selectKernels().name
+            << " (set ALAZAR_KERNELS to force one)" << std::endl;
+  printf("%-12s %14s %14s %14s %14s\n", "kernel", "interleaved", "contiguous",
+         "acc interl.", "acc contig.");
+  for (auto &kernels : kernelVariants()) {
+    printf("%-12s %9.0f MB/s %9.0f MB/s %9.0f MB/s %9.0f MB/s\n", kernels.name,
+           benchmarkKernel(kernels, true, false, nbrIterations),
+           benchmarkKernel(kernels, false, false, nbrIterations),
+           benchmarkKernel(kernels, true, true, nbrIterations),
+           benchmarkKernel(kernels, false, true, nbrIterations));
+  }
+  std::cout << std::endl;
+
+  std::cout << "recordLength " << recordLength << " waveforms "
+            << nbrWaveforms << " segments " << nbrSegments << " round robins "
+            << nbrRoundRobins << std::endl;
+  printf("%-12s %14s %14s\n", "mode", "interleaved", "blocked");
+
+  const char *modes[] = {"digitizer", "averager", "correlator", "events",
+                         "histogram"};
+  for (const char *mode : modes) {
+    double interleaved =
+        benchmark(mode, "interleaved", recordLength, nbrWaveforms,
+                  nbrSegments, nbrRoundRobins, nbrIterations);
+    double blocked = benchmark(mode, "blocked", recordLength, nbrWaveforms,
+                               nbrSegments, nbrRoundRobins, nbrIterations);
+    printf("%-12s %9.0f MB/s %9.0f MB/s\n", mode, interleaved, blocked);
+  }
+
+  // the tile forced on and off, over records longer than the tile; the
+  // tile only pays once the accumulators of a segment outgrow the L2 cache
+  std::cout << std::endl << "averager tiling, " << AVERAGER_TILE
+            << " samples per tile, used above " << l2CacheSize()
+            << " bytes of accumulators" << std::endl;
+  printf("%-12s %-10s %14s %14s\n", "recordLength", "segments", "tiled",
+         "untiled");
+  const uint32_t tiledLengths[] = {8192, 65536, 262144, 1048576};
+  const uint32_t tiledSegments[] = {1, 16};
+  for (uint32_t length : tiledLengths) {
+    for (uint32_t nbrSegs : tiledSegments) {
+      // the acquisitions of the longest records are kept to one segment
+      if (length > 65536 && nbrSegs > 1) {
+        continue;
+      }
+      double tiled =
+          benchmark("averager", "interleaved", length, nbrWaveforms, nbrSegs,
+                    nbrRoundRobins, nbrIterations, AVERAGER_TILE);
+      double untiled =
+          benchmark("averager", "interleaved", length, nbrWaveforms, nbrSegs,
+                    nbrRoundRobins, nbrIterations, length);
+      printf("%-12u %-10u %9.0f MB/s %9.0f MB/s\n", length, nbrSegs, tiled,
+             untiled);
+    }
+  }
+
+  // streaming stores forced on and off for the digitizer, whatever the size
+  const uint32_t lengths[] = {1024, 8192, 65536};
+  const uint32_t segments[] = {1, 16, 64};
+  std::cout << std::endl
+            << "digitizer streaming stores, default threshold "
+            << STREAM_THRESHOLD << " bytes" << std::endl;
+  printf("%-12s %-10s %14s %14s\n", "recordLength", "segments", "streamed",
+         "cached");
+  for (uint32_t length : lengths) {
+    for (uint32_t nbrSegs : segments) {
+      double streamed =
+          benchmark("digitizer", "interleaved", length, nbrWaveforms, nbrSegs,
+                    nbrRoundRobins, nbrIterations, 0, 1);
+      double cached =
+          benchmark("digitizer", "interleaved", length, nbrWaveforms, nbrSegs,
+                    nbrRoundRobins, nbrIterations, 0, 0xffffffff);
+      printf("%-12u %-10u %9.0f MB/s %9.0f MB/s\n", length, nbrSegs, streamed,
+             cached);
+    }
+  }
+
+  return (0);
+}
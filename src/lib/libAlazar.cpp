@@ -18,9 +18,9 @@ limitations under the License.
 #include <algorithm>
 #include <chrono>
 #include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <list>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -28,13 +28,16 @@ limitations under the License.
 #include <cstring>
 #include <cmath>
 #include <mutex>
-
-std::mutex mu;
+#include <set>
 
 #ifndef _WIN32
+  #include <poll.h>
   #include <sys/socket.h>
+  #include <unistd.h>
 #else
   #include <winsock2.h>
+  #include <process.h>
+  #define getpid _getpid
   #include <basetsd.h>
   typedef SSIZE_T ssize_t;
 #endif
@@ -70,13 +73,19 @@ std::string boardInfo(uint32_t systemId, uint32_t boardId) {
 }
 
 
-AlazarATS9870::AlazarATS9870() : threadStop(false), threadRunning(false) {
+AlazarATS9870::AlazarATS9870()
+    : threadStop(false), threadRunning(false), buffersReceived(0),
+      acquisitionsDelivered(0), lastSequence(0), boardOverflow(false),
+      droppedAcquisitions(0), sequenceStep(0), deliveredStep(0),
+      acquiring(false) {
   LOG(plog::verbose) << "Constructing ... ";
 }
 
 AlazarATS9870::~AlazarATS9870() {
   LOG(plog::verbose) << "Destructing ...";
 
+  stopWorker();
+
   RETURN_CODE retCode = AlazarCloseAUTODma(boardHandle);
   if (retCode != ApiSuccess) {
     printError(retCode, __FILE__, __LINE__);
@@ -85,24 +94,240 @@ AlazarATS9870::~AlazarATS9870() {
   AlazarClose(boardHandle);
 }
 
+void StoredConfig::assign(const ConfigData_t &other) {
+  config = other;
+  // the pointers are filled in once the vectors are done growing
+  const char *ConfigData_t::*const stringFields[] = {
+      &ConfigData_t::acquireMode,      &ConfigData_t::bandwidth,
+      &ConfigData_t::clockType,        &ConfigData_t::label,
+      &ConfigData_t::triggerCoupling,  &ConfigData_t::triggerSlope,
+      &ConfigData_t::triggerSource,    &ConfigData_t::verticalCoupling,
+      &ConfigData_t::channels,         &ConfigData_t::dmaLayout,
+      &ConfigData_t::outputFormat};
+  strings.clear();
+  for (auto field : stringFields) {
+    strings.push_back(other.*field ? other.*field : "");
+  }
+  for (size_t n = 0; n < strings.size(); n++) {
+    config.*stringFields[n] = other.*stringFields[n] ? strings[n].c_str()
+                                                     : nullptr;
+  }
+  roiStart.assign(other.roiStart, other.roiStart + other.nbrRois);
+  roiLength.assign(other.roiLength, other.roiLength + other.nbrRois);
+  roiSegments.assign(other.roiSegments,
+                     other.roiSegments + other.nbrRoiSegments);
+  config.roiStart = other.nbrRois ? roiStart.data() : nullptr;
+  config.roiLength = other.nbrRois ? roiLength.data() : nullptr;
+  config.roiSegments = other.nbrRoiSegments ? roiSegments.data() : nullptr;
+}
+
+// The buffer plans found by tune_buffer_plan, by host and geometry.  They
+// are kept in the file named by ALAZAR_PLAN_CACHE, libalazar_plans.txt by
+// default, one per line: the key, a tab and the buffer size.  The tuner
+// only times the processing, which does not depend on the buffer count, so
+// the count is left to the configuration.
+struct TunedPlan {
+  uint32_t bufferSize;
+};
+
+static std::string planCachePath() {
+  const char *path = getenv("ALAZAR_PLAN_CACHE");
+  return path != nullptr && path[0] != '\0' ? path : "libalazar_plans.txt";
+}
+
+static std::map<std::string, TunedPlan> loadTunedPlans() {
+  std::map<std::string, TunedPlan> plans;
+  std::ifstream file(planCachePath());
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t split = line.rfind('\t');
+    TunedPlan plan;
+    if (split != std::string::npos &&
+        sscanf(line.c_str() + split + 1, "%u", &plan.bufferSize) == 1) {
+      plans[line.substr(0, split)] = plan;
+    }
+  }
+  return plans;
+}
+
+static std::mutex tunedPlansMutex;
+
+static std::map<std::string, TunedPlan> &tunedPlans() {
+  static std::map<std::string, TunedPlan> plans = loadTunedPlans();
+  return plans;
+}
+
+static bool findTunedPlan(const std::string &key, uint32_t &bufferSize) {
+  std::lock_guard<std::mutex> lock(tunedPlansMutex);
+  auto plan = tunedPlans().find(key);
+  if (plan == tunedPlans().end()) {
+    return false;
+  }
+  bufferSize = plan->second.bufferSize;
+  return true;
+}
+
+// Move a file over another in one step, so readers of the plan file find
+// the old plans or the new ones and never a partly written file
+static bool replaceFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// The plan file is read again before it is written, so the plans stored by
+// other processes since it was loaded are kept.
+static void storeTunedPlan(const std::string &key, uint32_t bufferSize) {
+  std::lock_guard<std::mutex> lock(tunedPlansMutex);
+  std::map<std::string, TunedPlan> &plans = tunedPlans();
+  for (auto &plan : loadTunedPlans()) {
+    plans[plan.first] = plan.second;
+  }
+  plans[key] = {bufferSize};
+
+  std::string path = planCachePath();
+  std::string temp = path + "." + std::to_string(getpid()) + ".tmp";
+  std::ofstream file(temp, std::ios::trunc);
+  for (auto &plan : plans) {
+    file << plan.first << '\t' << plan.second.bufferSize << '\n';
+  }
+  file.close();
+  if (!file || !replaceFile(temp, path)) {
+    LOG(plog::error) << "Could not write the buffer plans to " << path;
+    std::remove(temp.c_str());
+  }
+}
+
+// The SDK calls that write the board settings, from the values the settings
+// are kept under
+static RETURN_CODE writeCaptureClock(HANDLE handle,
+                                     const std::vector<uint32_t> &values) {
+  return AlazarSetCaptureClock(
+      handle,                   // HANDLE -- board handle
+      EXTERNAL_CLOCK_10MHz_REF, // U32 -- clock source id
+      1000000000,               // U32 -- sample rate id - 1e9
+      CLOCK_EDGE_RISING,        // U32 -- clock edge id
+      values[0]                 // U32 -- clock decimation
+      );
+}
+
+template <uint8_t channel>
+static RETURN_CODE writeInputControl(HANDLE handle,
+                                     const std::vector<uint32_t> &values) {
+  return AlazarInputControl(handle,    // HANDLE -- board handle
+                            channel,   // U8 -- input channel
+                            values[0], // U32 -- input coupling id
+                            // TODO verify values for vertical scale
+                            values[1],       // U32 -- input range id
+                            IMPEDANCE_50_OHM // U32 -- input impedance id
+                            );
+}
+
+template <uint8_t channel>
+static RETURN_CODE writeBWLimit(HANDLE handle,
+                                const std::vector<uint32_t> &values) {
+  return AlazarSetBWLimit(handle,   // HANDLE -- board handle
+                          channel,  // U8 -- channel identifier
+                          values[0] // U32 -- 0 = disable, 1 = enable
+                          );
+}
+
+static RETURN_CODE writeTriggerOperation(HANDLE handle,
+                                         const std::vector<uint32_t> &values) {
+  return AlazarSetTriggerOperation(
+      handle,           // HANDLE -- board handle
+      TRIG_ENGINE_OP_J, // U32 -- trigger operation
+      TRIG_ENGINE_J,    // U32 -- trigger engine id
+      values[0],        // U32 -- trigger source id
+      values[1],        // U32 -- trigger slope id
+      values[2],     // U32 -- trigger level from 0 (-range) to 255 (+range)
+      TRIG_ENGINE_K, // U32 -- trigger engine id
+      TRIG_DISABLE,  // U32 -- trigger source id for engine K
+      TRIGGER_SLOPE_POSITIVE, // U32 -- trigger slope id
+      128 // U32 -- trigger level from 0 (-range) to 255 (+range)
+      );
+}
+
+static RETURN_CODE writeExternalTrigger(HANDLE handle,
+                                        const std::vector<uint32_t> &values) {
+  return AlazarSetExternalTrigger(
+      handle,    // HANDLE -- board handle
+      values[0], // U32 -- external trigger coupling id
+      ETR_5V     // U32 -- external trigger range id
+      );
+}
+
+static RETURN_CODE writeTriggerDelay(HANDLE handle,
+                                     const std::vector<uint32_t> &values) {
+  return AlazarSetTriggerDelay(handle, values[0]);
+}
+
+static RETURN_CODE writeTriggerTimeOut(HANDLE handle,
+                                       const std::vector<uint32_t> &values) {
+  return AlazarSetTriggerTimeOut(
+      handle,   // HANDLE -- board handle
+      values[0] // U32 -- timeout_sec / 10.e-6 (0 means wait forever)
+      );
+}
+
+static RETURN_CODE writeRecordSize(HANDLE handle,
+                                   const std::vector<uint32_t> &values) {
+  return AlazarSetRecordSize(handle, 0, values[0]);
+}
+
 int32_t AlazarATS9870::ConfigureBoard(uint32_t systemId, uint32_t boardId,
                                       const ConfigData_t &config,
                                       AcquisitionParams_t &acqParams) {
 
-  boardHandle = AlazarGetBoardBySystemID(systemId, boardId);
-  if (boardHandle == NULL) {
+  configuredSystem = systemId;
+  configuredBoard = boardId;
+  HANDLE handle = AlazarGetBoardBySystemID(systemId, boardId);
+  if (handle == NULL) {
     LOG(plog::error) << "Open systemId " << systemId << " boardId " << boardId
                        << " failed";
     return -1;
   }
+  // the settings written so far belong to the board they were written to
+  if (handle != boardHandle) {
+    appliedSettings.clear();
+  }
+  boardHandle = handle;
+  // the settings are written once the whole configuration is checked
+  boardSettings.clear();
 
-  // set averager mode or digitizer mode
+  // set averager, correlator or digitizer mode
   const char *acquireModeKey = config.acquireMode;
   if (modeMap.find(acquireModeKey) == modeMap.end()) {
     LOG(plog::error) << "Invalid Mode: " << acquireModeKey;
     return (-1);
   }
-  averager = modeMap[config.acquireMode];
+  acquireMode = modeMap[config.acquireMode];
+
+  // capture both channels unless asked for only one of them
+  const char *channelsKey = config.channels ? config.channels : "AB";
+  if (channelsMap.find(channelsKey) == channelsMap.end()) {
+    LOG(plog::error) << "Invalid Channels: " << channelsKey;
+    return (-1);
+  }
+  channelSelect = channelsMap[channelsKey];
+  numChannels = channelSelect == (CHANNEL_A | CHANNEL_B) ? 2 : 1;
+  if (acquireMode == CORRELATOR_MODE && numChannels != 2) {
+    LOG(plog::error) << "Correlator mode requires both channels";
+    return (-1);
+  }
+  LOG(plog::info) << "Channels: " << channelsKey;
+
+  // a single channel is contiguous whatever the layout
+  const char *layoutKey = config.dmaLayout ? config.dmaLayout : "interleaved";
+  if (dmaLayoutMap.find(layoutKey) == dmaLayoutMap.end()) {
+    LOG(plog::error) << "Invalid DMA Layout: " << layoutKey;
+    return (-1);
+  }
+  dmaLayout = dmaLayoutMap[layoutKey];
+  interleavedSamples = numChannels == 2 && dmaLayout == INTERLEAVED_LAYOUT;
+  LOG(plog::info) << "DMA Layout: " << layoutKey;
 
   // set the sample rate parameters:
   // SampleRateId is set to 1e9 and there is an external ref clock configured
@@ -117,17 +342,7 @@ int32_t AlazarATS9870::ConfigureBoard(uint32_t systemId, uint32_t boardId,
     }
   }
 
-  RETURN_CODE retCode =
-      AlazarSetCaptureClock(boardHandle,              // HANDLE -- board handle
-                            EXTERNAL_CLOCK_10MHz_REF, // U32 -- clock source id
-                            1000000000,        // U32 -- sample rate id - 1e9
-                            CLOCK_EDGE_RISING, // U32 -- clock edge id
-                            decimation         // U32 -- clock decimation
-                            );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  boardSettings.push_back({"captureClock", writeCaptureClock, {decimation}});
 
   // set up the channel parameters for channel A
   channelScale = config.verticalScale;
@@ -150,56 +365,25 @@ int32_t AlazarATS9870::ConfigureBoard(uint32_t systemId, uint32_t boardId,
                     << " ID: " << rangeIdMap[rangeIDKey];
   LOG(plog::info) << "Counts2Volts: " << counts2Volts;
 
-  retCode =
-      AlazarInputControl(boardHandle,              // HANDLE -- board handle
-                         CHANNEL_A,                // U8 -- input channel
-                         couplingMap[couplingKey], // U32 -- input coupling id
-                         // TODO verify values for vertical scale
-                         rangeIdMap[rangeIDKey], // U32 -- input range id
-                         IMPEDANCE_50_OHM        // U32 -- input impedance id
-                         );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  buildConvertTable(convertTable, counts2Volts, channelOffset);
+  kernels = &selectKernels();
 
   const char *bandwidthKey = config.bandwidth;
   if (bandwidthMap.find(bandwidthKey) == bandwidthMap.end()) {
     LOG(plog::error) << "Invalid Mode: " << bandwidthKey;
     return (-1);
   }
-  retCode = AlazarSetBWLimit(
-      boardHandle,                  // HANDLE -- board handle
-      CHANNEL_A,                    // U8 -- channel identifier
-      bandwidthMap[config.bandwidth] // U32 -- 0 = disable, 1 = enable
-      );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
-
-  // set up the channel parameters for channel B
-  retCode = AlazarInputControl(
-      boardHandle,                          // HANDLE -- board handle
-      CHANNEL_B,                            // U8 -- input channel
-      couplingMap[config.verticalCoupling], // U32 -- input coupling id
-      rangeIdMap[rangeIDKey],               // U32 -- input range id
-      IMPEDANCE_50_OHM                      // U32 -- input impedance id
-      );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
 
-  retCode = AlazarSetBWLimit(
-      boardHandle,                  // HANDLE -- board handle
-      CHANNEL_B,                    // U8 -- channel identifier
-      bandwidthMap[config.bandwidth] // U32 -- 0 = disable, 1 = enable
-      );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  // set up the channel parameters of channels A and B
+  std::vector<uint32_t> input = {couplingMap[couplingKey],
+                                 rangeIdMap[rangeIDKey]};
+  std::vector<uint32_t> bandwidth = {bandwidthMap[bandwidthKey]};
+  boardSettings.push_back(
+      {"inputControlA", writeInputControl<CHANNEL_A>, input});
+  boardSettings.push_back(
+      {"inputControlB", writeInputControl<CHANNEL_B>, input});
+  boardSettings.push_back({"bwLimitA", writeBWLimit<CHANNEL_A>, bandwidth});
+  boardSettings.push_back({"bwLimitB", writeBWLimit<CHANNEL_B>, bandwidth});
 
   // Select trigger inputs and levels as required
   // trigLevelCode = uint8(128 +
@@ -222,22 +406,10 @@ int32_t AlazarATS9870::ConfigureBoard(uint32_t systemId, uint32_t boardId,
     return (-1);
   }
 
-  retCode = AlazarSetTriggerOperation(
-      boardHandle,                            // HANDLE -- board handle
-      TRIG_ENGINE_OP_J,                       // U32 -- trigger operation
-      TRIG_ENGINE_J,                          // U32 -- trigger engine id
-      triggerSourceMap[config.triggerSource], // U32 -- trigger source id
-      triggerSlopeMap[config.triggerSlope],   // U32 -- trigger slope id
-      trigLevelCode, // U32 -- trigger level from 0 (-range) to 255 (+range)
-      TRIG_ENGINE_K, // U32 -- trigger engine id
-      TRIG_DISABLE,  // U32 -- trigger source id for engine K
-      TRIGGER_SLOPE_POSITIVE, // U32 -- trigger slope id
-      128 // U32 -- trigger level from 0 (-range) to 255 (+range)
-      );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  boardSettings.push_back({"triggerOperation", writeTriggerOperation,
+                           {triggerSourceMap[config.triggerSource],
+                            triggerSlopeMap[config.triggerSlope],
+                            trigLevelCode}});
 
   // set up external triggerCoupling
   // TODO - add channel based triggering
@@ -247,35 +419,16 @@ int32_t AlazarATS9870::ConfigureBoard(uint32_t systemId, uint32_t boardId,
     return (-1);
   }
 
-  retCode = AlazarSetExternalTrigger(
-      boardHandle,                         // HANDLE -- board handle
-      couplingMap[config.triggerCoupling], // U32 -- external trigger coupling
-                                           // id
-      ETR_5V                               // U32 -- external trigger range id
-      );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  boardSettings.push_back({"externalTrigger", writeExternalTrigger,
+                           {couplingMap[config.triggerCoupling]}});
 
   // set the trigger delay in samples
   uint32_t trigDelayPts = config.samplingRate * config.delay;
   LOG(plog::info) << "Trigger Delay " << trigDelayPts;
-  retCode = AlazarSetTriggerDelay(boardHandle, trigDelayPts);
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  boardSettings.push_back({"triggerDelay", writeTriggerDelay, {trigDelayPts}});
 
   // set timeout to 0 - don't time out waiting for a trigger
-  retCode = AlazarSetTriggerTimeOut(
-      boardHandle, // HANDLE -- board handle
-      0            // U32 -- timeout_sec / 10.e-6 (0 means wait forever)
-      );
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-    return -1;
-  }
+  boardSettings.push_back({"triggerTimeOut", writeTriggerTimeOut, {0}});
 
   recordLength = config.recordLength;
 
@@ -290,77 +443,573 @@ int32_t AlazarATS9870::ConfigureBoard(uint32_t systemId, uint32_t boardId,
   }
 
   LOG(plog::info) << "recordLength: " << recordLength;
-  retCode = AlazarSetRecordSize(boardHandle, 0, recordLength);
-  if (retCode != ApiSuccess) {
-    printError(retCode, __FILE__, __LINE__);
-  }
+  boardSettings.push_back({"recordSize", writeRecordSize, {recordLength}});
 
   nbrSegments = config.nbrSegments;
   nbrWaveforms = config.nbrWaveforms;
   nbrRoundRobins = config.nbrRoundRobins;
 
-  // compute records per buffer and records per acquisition
-  if (getBufferSize() < 0) {
-    return (-1);
+  // lag 0 is always computed
+  nbrCorrelationLags = std::max(config.nbrCorrelationLags, 1u);
+  if (acquireMode == CORRELATOR_MODE && nbrCorrelationLags > recordLength) {
+    LOG(plog::error) << "nbrCorrelationLags exceeds recordLength";
+    return -1;
+  }
+
+  // boxcar downsampling of the digitizer and averager outputs
+  downsampleFactor = std::max(config.downsampleFactor, 1u);
+  if (downsampleFactor > 1 && acquireMode != DIGITIZER_MODE &&
+      acquireMode != AVERAGER_MODE) {
+    LOG(plog::error) << "downsampleFactor requires digitizer or averager mode";
+    return -1;
+  }
+  if (recordLength % downsampleFactor != 0) {
+    LOG(plog::error) << "downsampleFactor does not divide recordLength";
+    return -1;
+  }
+  LOG(plog::info) << "downsampleFactor: " << downsampleFactor;
+
+  if (setRegionsOfInterest(config) < 0) {
+    return -1;
+  }
+
+  // the averager sums the segments one after the other; a segment is summed
+  // a tile at a time only when its accumulators outgrow the L2 cache, below
+  // that the whole records are summed
+  static const uint32_t l2Cache = l2CacheSize();
+  uint64_t accumulators = uint64_t(outputLength) * numChannels * sizeof(float);
+  averagerTile = accumulators > l2Cache ? AVERAGER_TILE : outputLength;
+
+  // windows are searched for events independently
+  eventWindow = config.eventWindow ? config.eventWindow : recordLength;
+  if (acquireMode == EVENTS_MODE && recordLength % eventWindow != 0) {
+    LOG(plog::error) << "eventWindow does not divide recordLength";
+    return -1;
+  }
+
+  // convert the thresholds to counts so the search runs on the raw samples
+  double thresholds[2] = {config.eventThresholdCh1, config.eventThresholdCh2};
+  for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+    if (thresholds[ch] > 0 && channelEnabled(ch)) {
+      eventHigh[ch] = static_cast<int32_t>(
+          std::ceil(128 + (thresholds[ch] + channelOffset) / counts2Volts));
+      eventLow[ch] = static_cast<int32_t>(
+          std::floor(128 + (channelOffset - thresholds[ch]) / counts2Volts));
+    } else {
+      eventHigh[ch] = 256;
+      eventLow[ch] = -1;
+    }
+  }
+
+  // compute records per buffer and records per acquisition, unless they
+  // are known for this geometry already
+  targetBufferSize = config.bufferSize;
+  bufferCount = config.bufferCount;
+  padBuffers = config.padBuffers;
+  // a buffer size tuned for this geometry on this host replaces the default
+  uint32_t tunedSize = 0;
+  if (targetBufferSize == 0 &&
+      findTunedPlan(tuningKey(config), tunedSize)) {
+    targetBufferSize = tunedSize;
+  }
+  std::vector<uint32_t> geometry = {recordLength, nbrSegments, nbrWaveforms,
+                                    nbrRoundRobins, numChannels,
+                                    targetBufferSize, padBuffers};
+  auto plan = bufferPlans.find(geometry);
+  if (plan == bufferPlans.end()) {
+    if (getBufferSize() < 0) {
+      return (-1);
+    }
+    bufferPlans[geometry] = {bufferLen, partialBuffer, roundRobinsPerBuffer,
+                             buffersPerRoundRobin, nbrBuffers,
+                             recordsPerBuffer, recordsPerAcquisition,
+                             paddingRecords};
+  } else {
+    bufferLen = plan->second.bufferLen;
+    partialBuffer = plan->second.partialBuffer;
+    roundRobinsPerBuffer = plan->second.roundRobinsPerBuffer;
+    buffersPerRoundRobin = plan->second.buffersPerRoundRobin;
+    nbrBuffers = plan->second.nbrBuffers;
+    recordsPerBuffer = plan->second.recordsPerBuffer;
+    recordsPerAcquisition = plan->second.recordsPerAcquisition;
+    paddingRecords = plan->second.paddingRecords;
+  }
+
+  // in continuous mode every buffer is an acquisition of its own
+  continuous = config.continuous;
+  if (continuous && (acquireMode == HISTOGRAM_MODE || nbrBuffers != 1)) {
+    LOG(plog::error) << "Continuous mode needs the round robins of an "
+                        "acquisition to fit in one buffer, outside of "
+                        "histogram mode";
+    return -1;
+  }
+
+  // the buffers posted to the board at a time, which are recycled until the
+  // acquisition is done
+  if (bufferCount > 0) {
+    postedBuffers = bufferCount;
+  } else if (continuous) {
+    postedBuffers = CONTINUOUS_NUM_BUFFERS;
+  } else {
+    postedBuffers = nbrBuffers;
+  }
+  postedBuffers =
+      std::min(postedBuffers, static_cast<uint32_t>(MAX_NUM_BUFFERS));
+  postedBuffers =
+      std::max(postedBuffers, static_cast<uint32_t>(MIN_NUM_BUFFERS));
+
+  if (setOutputFormat(config) < 0) {
+    return -1;
+  }
+
+  // the buffer processing specialized for the mode and buffer split
+  if (acquireMode == CORRELATOR_MODE) {
+    processKernel = &AlazarATS9870::processCorrelation;
+  } else if (acquireMode == EVENTS_MODE) {
+    processKernel = &AlazarATS9870::processEvents;
+  } else if (acquireMode == HISTOGRAM_MODE) {
+    processKernel = &AlazarATS9870::processHistogram;
+  } else if (partialBuffer) {
+    processKernel = acquireMode == AVERAGER_MODE
+                        ? &AlazarATS9870::processPartialBuffer<true>
+                        : &AlazarATS9870::processPartialBuffer<false>;
+  } else {
+    processKernel = acquireMode == AVERAGER_MODE
+                        ? &AlazarATS9870::processCompleteBuffer<true>
+                        : &AlazarATS9870::processCompleteBuffer<false>;
   }
 
   // The application uses this info allocate its channel data buffers
   if (!partialBuffer) {
-    if (averager) {
-      acqParams.samplesPerAcquisition = recordLength * nbrSegments;
+    if (acquireMode == AVERAGER_MODE) {
+      acqParams.samplesPerAcquisition = outputLength * nbrRoiSegments;
+    } else if (acquireMode == CORRELATOR_MODE) {
+      acqParams.samplesPerAcquisition =
+          recordLength * nbrSegments * nbrCorrelationLags;
     } else {
       acqParams.samplesPerAcquisition =
-          recordLength * nbrSegments * nbrWaveforms * roundRobinsPerBuffer;
+          outputLength * nbrRoiSegments * nbrWaveforms * roundRobinsPerBuffer;
     }
     acqParams.numberAcquisitions = nbrBuffers;
   } else {
-    if (averager) {
-      acqParams.samplesPerAcquisition = recordLength * nbrSegments;
+    if (acquireMode == AVERAGER_MODE) {
+      acqParams.samplesPerAcquisition = outputLength * nbrRoiSegments;
+    } else if (acquireMode == CORRELATOR_MODE) {
+      acqParams.samplesPerAcquisition =
+          recordLength * nbrSegments * nbrCorrelationLags;
     } else {
       acqParams.samplesPerAcquisition =
-          recordLength * nbrSegments * nbrWaveforms;
+          outputLength * nbrRoiSegments * nbrWaveforms;
     }
     acqParams.numberAcquisitions = nbrBuffers / buffersPerRoundRobin;
   }
 
+  // events are reported per buffer whether or not it holds a round robin
+  if (acquireMode == EVENTS_MODE) {
+    acqParams.samplesPerAcquisition = recordLength * recordsPerBuffer;
+    acqParams.numberAcquisitions = nbrBuffers;
+  }
+
+  // the histogram is delivered once, after the last buffer
+  histogramPerSegment = config.histogramPerSegment;
+  if (acquireMode == HISTOGRAM_MODE) {
+    acqParams.samplesPerAcquisition =
+        HISTOGRAM_BINS * (histogramPerSegment ? nbrSegments : 1);
+    acqParams.numberAcquisitions = 1;
+  }
+
+  if (continuous) {
+    acqParams.numberAcquisitions = 0;
+  }
+
   samplesPerAcquisition = acqParams.samplesPerAcquisition;
   LOG(plog::info) << "samplesPerAcquisition: " << samplesPerAcquisition;
   LOG(plog::info) << "numberAcquisitions: " << acqParams.numberAcquisitions;
 
-  ch1WorkBuff.resize(samplesPerAcquisition);
-  ch2WorkBuff.resize(samplesPerAcquisition);
+  // converting whole records without downsampling, the kernels specialized
+  // for the record length apply when there are some
+  bool wholeRecords = downsampleFactor == 1 && roiWindows.size() == 1 &&
+                      outputLength == recordLength;
+  records = recordKernels(*kernels, wholeRecords ? recordLength : 0);
+  anyLengthRecords = recordKernels(*kernels, 0);
+
+  // digitizer outputs that would push the DMA buffers out of the cache are
+  // written around it; the output is only read back after the handoff, so
+  // not when it is packed from the work buffers
+  uint32_t streamThreshold =
+      config.streamThreshold ? config.streamThreshold : STREAM_THRESHOLD;
+  streamOutput = acquireMode == DIGITIZER_MODE &&
+                 outputFormat == FLOAT32_OUTPUT &&
+                 uint64_t(samplesPerAcquisition) * sizeof(float) >=
+                     streamThreshold;
+  if (streamOutput) {
+    anyLengthRecords.convertPairs = kernels->streamPairs;
+    anyLengthRecords.convertSamples = kernels->streamSamples;
+    records = anyLengthRecords;
+  }
+  LOG(plog::info) << "record kernels: " << kernels->name << " "
+                  << (records.recordLength ? "fixed length" : "any length")
+                  << (streamOutput ? ", streaming stores" : "");
+
+  allocateWork();
 
-  uint32_t m = sizeof(socketbuffsize);
-  #ifdef _WIN32
+  // the socket buffer size does not change, it is looked up once
+  if (socketbuffsize == 0) {
+    uint32_t m = sizeof(socketbuffsize);
+#ifdef _WIN32
     socketbuffsize = 65536; // placeholder for now
     size_t num_floats = socketbuffsize/sizeof(float);
-  #else
+#else
     int32_t fdsocket = socket(AF_UNIX,SOCK_STREAM,0);
     getsockopt(fdsocket,SOL_SOCKET,SO_RCVBUF,(void *)&socketbuffsize, &m);
     size_t num_floats = socketbuffsize/sizeof(float);
     socketbuffsize = (num_floats-1)*sizeof(float);
     close(fdsocket);
-  #endif
+#endif
     LOG(plog::info) << "num floats per send: " << num_floats;
     LOG(plog::info) << "socket buffer size: " << socketbuffsize;
+  }
+  return writeSettings(boardSettings);
+}
+
+// Size the buffers the processing of the configured mode works in.
+void AlazarATS9870::allocateWork(void) {
+  // work buffers are only needed for the channels that are captured
+  ch1WorkBuff.resize(channelEnabled(0) ? samplesPerAcquisition : 0);
+  ch2WorkBuff.resize(channelEnabled(1) ? samplesPerAcquisition : 0);
+
+  if (acquireMode == EVENTS_MODE) {
+    eventList.resize(samplesPerAcquisition / eventWindow);
+  }
+
+  if (acquireMode == HISTOGRAM_MODE) {
+    histCh1.assign(samplesPerAcquisition, 0);
+    histCh2.assign(samplesPerAcquisition, 0);
+    histTables.assign(MAX_NUM_CHANNELS * HISTOGRAM_TABLES * HISTOGRAM_BINS, 0);
+  }
+
+  if (acquireMode == CORRELATOR_MODE) {
+    corrSumAB.resize(samplesPerAcquisition);
+    corrSumBA.resize(samplesPerAcquisition);
+    corrSumA.resize(recordLength * nbrSegments);
+    corrSumB.resize(recordLength * nbrSegments);
+    corrRecordA.resize(recordLength);
+    corrRecordB.resize(recordLength);
+  }
+}
+
+// Write the board settings that differ from the ones last applied.
+int32_t
+AlazarATS9870::writeSettings(const std::vector<BoardSetting> &settings) {
+  for (const BoardSetting &setting : settings) {
+    if (!settingChanged(setting.name, setting.values)) {
+      continue;
+    }
+    RETURN_CODE retCode = setting.write(boardHandle, setting.values);
+    if (retCode != ApiSuccess) {
+      printError(retCode, __FILE__, __LINE__);
+      // AlazarBeforeAsyncRead sets the record size of the acquisition again
+      if (strcmp(setting.name, "recordSize") == 0) {
+        continue;
+      }
+      return -1;
+    }
+    settingApplied(setting.name, setting.values);
+  }
+  return 0;
+}
+
+// Keep the state ConfigureBoard derived, with the board settings and the
+// acquisition parameters, for apply_config.
+void AlazarATS9870::compileConfig(CompiledConfig &compiled,
+                                  const AcquisitionParams_t &acqParams) const {
+  compiled.acqParams = acqParams;
+  compiled.settings = boardSettings;
+  compiled.acquireMode = acquireMode;
+  compiled.channelSelect = channelSelect;
+  compiled.numChannels = numChannels;
+  compiled.dmaLayout = dmaLayout;
+  compiled.interleavedSamples = interleavedSamples;
+  compiled.channelScale = channelScale;
+  compiled.channelOffset = channelOffset;
+  compiled.counts2Volts = counts2Volts;
+  compiled.convertTable = convertTable;
+  compiled.kernels = kernels;
+  compiled.records = records;
+  compiled.anyLengthRecords = anyLengthRecords;
+  compiled.streamOutput = streamOutput;
+  compiled.recordLength = recordLength;
+  compiled.nbrSegments = nbrSegments;
+  compiled.nbrWaveforms = nbrWaveforms;
+  compiled.nbrRoundRobins = nbrRoundRobins;
+  compiled.nbrCorrelationLags = nbrCorrelationLags;
+  compiled.eventWindow = eventWindow;
+  compiled.downsampleFactor = downsampleFactor;
+  compiled.roiWindows = roiWindows;
+  compiled.roiSegmentIndex = roiSegmentIndex;
+  compiled.nbrRoiSegments = nbrRoiSegments;
+  compiled.outputLength = outputLength;
+  compiled.averagerTile = averagerTile;
+  std::copy(eventHigh, eventHigh + 2, compiled.eventHigh);
+  std::copy(eventLow, eventLow + 2, compiled.eventLow);
+  compiled.targetBufferSize = targetBufferSize;
+  compiled.bufferCount = bufferCount;
+  compiled.padBuffers = padBuffers;
+  compiled.plan = {bufferLen, partialBuffer, roundRobinsPerBuffer,
+                   buffersPerRoundRobin, nbrBuffers, recordsPerBuffer,
+                   recordsPerAcquisition, paddingRecords};
+  compiled.continuous = continuous;
+  compiled.postedBuffers = postedBuffers;
+  compiled.outputFormat = outputFormat;
+  compiled.outputHeader = outputHeader;
+  compiled.packGain = packGain;
+  compiled.packOffset = packOffset;
+  compiled.histogramPerSegment = histogramPerSegment;
+  compiled.samplesPerAcquisition = samplesPerAcquisition;
+  compiled.processKernel = processKernel;
+}
+
+// Restore the state of a compiled configuration and write the board
+// settings it changes, without checking or deriving anything again.
+int32_t AlazarATS9870::applyConfig(const CompiledConfig &compiled) {
+  acquireMode = compiled.acquireMode;
+  channelSelect = compiled.channelSelect;
+  numChannels = compiled.numChannels;
+  dmaLayout = compiled.dmaLayout;
+  interleavedSamples = compiled.interleavedSamples;
+  channelScale = compiled.channelScale;
+  channelOffset = compiled.channelOffset;
+  counts2Volts = compiled.counts2Volts;
+  convertTable = compiled.convertTable;
+  kernels = compiled.kernels;
+  records = compiled.records;
+  anyLengthRecords = compiled.anyLengthRecords;
+  streamOutput = compiled.streamOutput;
+  recordLength = compiled.recordLength;
+  nbrSegments = compiled.nbrSegments;
+  nbrWaveforms = compiled.nbrWaveforms;
+  nbrRoundRobins = compiled.nbrRoundRobins;
+  nbrCorrelationLags = compiled.nbrCorrelationLags;
+  eventWindow = compiled.eventWindow;
+  downsampleFactor = compiled.downsampleFactor;
+  roiWindows = compiled.roiWindows;
+  roiSegmentIndex = compiled.roiSegmentIndex;
+  nbrRoiSegments = compiled.nbrRoiSegments;
+  outputLength = compiled.outputLength;
+  averagerTile = compiled.averagerTile;
+  std::copy(compiled.eventHigh, compiled.eventHigh + 2, eventHigh);
+  std::copy(compiled.eventLow, compiled.eventLow + 2, eventLow);
+  targetBufferSize = compiled.targetBufferSize;
+  bufferCount = compiled.bufferCount;
+  padBuffers = compiled.padBuffers;
+  bufferLen = compiled.plan.bufferLen;
+  partialBuffer = compiled.plan.partialBuffer;
+  roundRobinsPerBuffer = compiled.plan.roundRobinsPerBuffer;
+  buffersPerRoundRobin = compiled.plan.buffersPerRoundRobin;
+  nbrBuffers = compiled.plan.nbrBuffers;
+  recordsPerBuffer = compiled.plan.recordsPerBuffer;
+  recordsPerAcquisition = compiled.plan.recordsPerAcquisition;
+  paddingRecords = compiled.plan.paddingRecords;
+  continuous = compiled.continuous;
+  postedBuffers = compiled.postedBuffers;
+  outputFormat = compiled.outputFormat;
+  outputHeader = compiled.outputHeader;
+  packGain = compiled.packGain;
+  packOffset = compiled.packOffset;
+  histogramPerSegment = compiled.histogramPerSegment;
+  samplesPerAcquisition = compiled.samplesPerAcquisition;
+  processKernel = compiled.processKernel;
+  boardSettings = compiled.settings;
+
+  allocateWork();
+  return writeSettings(boardSettings);
+}
+
+// Select the sample windows and segments processed by the digitizer and the
+// averager.  By default the whole record of every segment is processed.
+int32_t AlazarATS9870::setRegionsOfInterest(const ConfigData_t &config) {
+  bool roi = config.nbrRois > 0 || config.nbrRoiSegments > 0;
+  if (roi && acquireMode != DIGITIZER_MODE && acquireMode != AVERAGER_MODE) {
+    LOG(plog::error) << "Regions of interest require digitizer or averager mode";
+    return -1;
+  }
+
+  roiWindows.clear();
+  outputLength = 0;
+  if (config.nbrRois == 0) {
+    roiWindows.push_back(std::make_pair(0u, recordLength));
+  } else if (config.roiStart == nullptr || config.roiLength == nullptr) {
+    LOG(plog::error) << "NULL Pointer to region of interest windows";
+    return -1;
+  }
+  for (uint32_t n = 0; n < config.nbrRois; n++) {
+    uint32_t start = config.roiStart[n];
+    uint32_t length = config.roiLength[n];
+    if (length == 0 || start >= recordLength ||
+        length > recordLength - start) {
+      LOG(plog::error) << "Region of interest " << n << " is outside the record";
+      return -1;
+    }
+    if (start % downsampleFactor != 0 || length % downsampleFactor != 0) {
+      LOG(plog::error) << "Region of interest " << n
+                       << " is not aligned with downsampleFactor";
+      return -1;
+    }
+    roiWindows.push_back(std::make_pair(start, length));
+  }
+  for (auto &window : roiWindows) {
+    outputLength += window.second / downsampleFactor;
+  }
+
+  // selected segments are output in ascending order
+  if (config.nbrRoiSegments == 0) {
+    roiSegmentIndex.assign(nbrSegments, 0);
+  } else if (config.roiSegments == nullptr) {
+    LOG(plog::error) << "NULL Pointer to region of interest segments";
+    return -1;
+  } else {
+    roiSegmentIndex.assign(nbrSegments, -1);
+  }
+  for (uint32_t n = 0; n < config.nbrRoiSegments; n++) {
+    if (config.roiSegments[n] >= nbrSegments) {
+      LOG(plog::error) << "Invalid region of interest segment "
+                       << config.roiSegments[n];
+      return -1;
+    }
+    roiSegmentIndex[config.roiSegments[n]] = 0;
+  }
+  nbrRoiSegments = 0;
+  for (uint32_t k = 0; k < nbrSegments; k++) {
+    if (roiSegmentIndex[k] == 0) {
+      roiSegmentIndex[k] = nbrRoiSegments++;
+    }
+  }
+
+  LOG(plog::info) << "outputLength: " << outputLength;
+  LOG(plog::info) << "nbrRoiSegments: " << nbrRoiSegments;
+  return 0;
+}
+
+// Select the representation of the digitizer and averager outputs and work
+// out how the packed values map back to volts.
+int32_t AlazarATS9870::setOutputFormat(const ConfigData_t &config) {
+  const char *formatKey = config.outputFormat ? config.outputFormat : "float32";
+  if (outputFormatMap.find(formatKey) == outputFormatMap.end()) {
+    LOG(plog::error) << "Invalid Output Format: " << formatKey;
+    return -1;
+  }
+  outputFormat = outputFormatMap[formatKey];
+  if (outputFormat != FLOAT32_OUTPUT && acquireMode != DIGITIZER_MODE &&
+      acquireMode != AVERAGER_MODE) {
+    LOG(plog::error) << "outputFormat requires digitizer or averager mode";
+    return -1;
+  }
+  if (outputFormat == INT8_OUTPUT &&
+      (acquireMode != DIGITIZER_MODE || downsampleFactor > 1)) {
+    LOG(plog::error) << "int8 output requires digitizer mode without "
+                        "downsampling";
+    return -1;
+  }
+
+  // the int32 sums are kept exactly in the float accumulators as long as
+  // they stay below 2^24, i.e. 128 * 131072
+  uint32_t nbrAveraged =
+      partialBuffer ? nbrWaveforms : nbrWaveforms * roundRobinsPerBuffer;
+  if (outputFormat == INT32_OUTPUT &&
+      (acquireMode != AVERAGER_MODE || downsampleFactor > 1 ||
+       nbrAveraged > 131072)) {
+    LOG(plog::error) << "int32 output requires averager mode without "
+                        "downsampling and at most 131072 records averaged";
+    return -1;
+  }
+
+  outputHeader.format = outputFormat;
+  outputHeader.count = 1;
+  outputHeader.scale = 1.0;
+  outputHeader.offset = 0.0;
+  packGain = 1.0f;
+  packOffset = 0.0f;
+  if (outputFormat == INT16_OUTPUT) {
+    packGain = 256 / counts2Volts;
+    packOffset = channelOffset;
+    outputHeader.scale = counts2Volts / 256.0;
+    outputHeader.offset = -channelOffset;
+  } else if (outputFormat == INT8_OUTPUT) {
+    packGain = 1 / counts2Volts;
+    packOffset = channelOffset;
+    outputHeader.scale = counts2Volts;
+    outputHeader.offset = -channelOffset;
+  } else if (outputFormat == INT32_OUTPUT) {
+    // the records are summed in counts rather than volts
+    buildConvertTable(convertTable, 1.0f, 0.0f);
+    outputHeader.count = nbrAveraged;
+    outputHeader.scale = counts2Volts;
+    outputHeader.offset = -channelOffset;
+  }
+  LOG(plog::info) << "outputFormat: " << formatKey;
   return 0;
 }
 
-int32_t AlazarATS9870::rx(int32_t* ready) {
+uint32_t AlazarATS9870::outputSampleSize() const {
+  switch (outputFormat) {
+  case FLOAT16_OUTPUT:
+  case INT16_OUTPUT:
+    return 2;
+  case INT8_OUTPUT:
+    return 1;
+  default:
+    return 4;
+  }
+}
+
+// Pack the float outputs of the captured channels into the output format
+void AlazarATS9870::packOutput(const float *ch1, const float *ch2, void *out1,
+                               void *out2) {
+  for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+    const float *in = ch == 0 ? ch1 : ch2;
+    void *out = ch == 0 ? out1 : out2;
+    if (!channelEnabled(ch)) {
+      continue;
+    }
+    switch (outputFormat) {
+    case FLOAT32_OUTPUT:
+      memcpy(out, in, samplesPerAcquisition * sizeof(float));
+      break;
+    case FLOAT16_OUTPUT:
+      kernels->packHalf(in, samplesPerAcquisition,
+                        static_cast<uint16_t *>(out));
+      break;
+    case INT16_OUTPUT:
+      kernels->packInt16(in, samplesPerAcquisition, packGain, packOffset,
+                         static_cast<int16_t *>(out));
+      break;
+    case INT8_OUTPUT:
+      kernels->packInt8(in, samplesPerAcquisition, packGain, packOffset,
+                        static_cast<int8_t *>(out));
+      break;
+    case INT32_OUTPUT:
+      kernels->packInt32(in, samplesPerAcquisition, packGain, packOffset,
+                         static_cast<int32_t *>(out));
+      break;
+    }
+  }
+}
+
+int32_t AlazarATS9870::rx(void) {
   RETURN_CODE retCode;
   uint32_t count = 0;
-  LOG(plog::verbose) << "STARTING RX THREAD";
-
-  mu.lock();
-  *ready = 1;
-  mu.unlock();
+  LOG(plog::verbose) << "STARTING ACQUISITION";
+  if (sockets[0] != -1 || sockets[1] != -1) {
+    prepareOutputs();
+  }
 
-  while (bufferCounter < static_cast<int32_t>(nbrBuffers)) {
-    std::shared_ptr<std::vector<uint8_t>> buff;
-    while (!bufferQ.pop(buff)) {
+  while (continuous || bufferCounter < static_cast<int32_t>(nbrBuffers)) {
+    uint32_t index;
+    while (!bufferQ.pop(index)) {
       if (threadStop) {
         return 0;
       }
+      std::this_thread::yield();
     }
 
     while (1) {
@@ -369,94 +1018,87 @@ int32_t AlazarATS9870::rx(int32_t* ready) {
         return 0;
       }
       retCode = AlazarWaitAsyncBufferComplete(boardHandle,
-                                              buff.get()->data(),
+                                              descriptors[index].data,
                                               1000); // 1 sec timeout
       if (retCode == ApiWaitTimeout) {
         continue;
       } else if (retCode == ApiSuccess) {
         LOG(plog::verbose) << "GOT BUFFER " << count++;
         break;
+      } else if (threadStop) {
+        // the wait was cut short by the abort of rxThreadStop
+        return 0;
+      } else if (retCode == ApiBufferOverflow) {
+        // the board memory filled up and the capture stopped
+        LOG(plog::error) << "Board overflow after " << buffersReceived
+                         << " buffers, the data was not read out in time";
+        boardOverflow = true;
+        return -1;
       } else {
         printError(retCode, __FILE__, __LINE__);
         return -1;
       }
     }
 
-    // if we have a socket, process the data and send it when we have a full
-    // buffer
+    BufferDescriptor &buff = descriptors[index];
+    buff.sequence = buffersReceived++;
+    buff.state = BUFFER_FILLED;
+
+    // if we have a socket, process the data into the next output slot and
+    // queue it for the sender when we have a full acquisition
     if (sockets[0] != -1 || sockets[1] != -1) {
-      int32_t full = processBuffer(
-                       buff,
-                       ch1WorkBuff.data(),
-                       ch2WorkBuff.data()
-                     );
-      LOG(plog::verbose) << "Full Attempting to write to socket, full: " << full;
-      if (full) {
-        ssize_t status;
-        LOG(plog::verbose) << "Work buff size: " << ch1WorkBuff.size();
-        size_t buf_size = ch1WorkBuff.size() * sizeof(float);
-        size_t buf_size_rem = buf_size;
-        size_t sock_send_size, buf_size_sent = 0;
-        do {
-          sock_send_size = std::min(buf_size_rem,socketbuffsize);
-          char* msg_size = reinterpret_cast<char *>(&sock_send_size);
-          LOG(plog::verbose) << "Sending thru socket: " << sock_send_size;
-          if (sockets[0] != -1) {
-            status = send(sockets[0], msg_size, sizeof(size_t), 0);
-            LOG(plog::verbose) << "Tried to send thru socket: " << sock_send_size;
-            if (status != sizeof(size_t)) {
-              LOG(plog::error) << "Error writing msg_size to socket,"
-              #ifdef _WIN32
-                                 << " received error: " << WSAGetLastError();
-              #else
-                                 << " received error: " << std::strerror(errno);
-              #endif
-              return -1;
-            }
-            status = send(sockets[0], reinterpret_cast<char *>(ch1WorkBuff.data()+buf_size_sent), sock_send_size, 0);
-            if (status < 0 || (size_t)status != sock_send_size) {
-              LOG(plog::error) << "Error writing ch1 buffer to socket. "
-                                 << "Tried to write " << buf_size << " bytes,"
-                                 << "Actually wrote " << status << " bytes.";
-              return -1;
-            }
-          }
-          if (sockets[1] != -1) {
-            status = send(sockets[1], msg_size, sizeof(size_t), 0);
-            if (status != sizeof(size_t)) {
-              LOG(plog::error) << "Error writing msg_size to socket,"
-              #ifdef _WIN32
-                                 << " received error: " << WSAGetLastError();
-              #else
-                                 << " received error: " << std::strerror(errno);
-              #endif
-              return -1;
-            }
-            status = send(sockets[1], reinterpret_cast<char *>(ch2WorkBuff.data()+buf_size_sent), sock_send_size, 0);
-            if (status < 0 || (size_t)status != sock_send_size) {
-              LOG(plog::error) << "Error writing ch2 buffer to socket. "
-                                 << "Tried to write " << buf_size << " bytes,"
-                                 << "Actually wrote " << status << " bytes.";
-              return -1;
-            }
-          }
-          buf_size_rem = buf_size_rem - sock_send_size;
-          buf_size_sent = (buf_size-buf_size_rem)/sizeof(float);
-          LOG(plog::verbose) << "Buff size remaining: " << buf_size_rem;
-          LOG(plog::verbose) << "Buff size sent: " << buf_size_sent;
-        } while(buf_size_rem > 0);
+      uint64_t timestamp =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::system_clock::now().time_since_epoch())
+              .count();
+      OutputSlot &slot = outputSlots[outputsQueued % OUTPUT_NUM_BUFFERS];
+      float *ch1 = channelEnabled(0) ? slot.work[0].data() : nullptr;
+      float *ch2 = channelEnabled(1) ? slot.work[1].data() : nullptr;
+      buff.state = BUFFER_PROCESSING;
+      int32_t full = processBuffer(buff.data, ch1, ch2);
+      LOG(plog::verbose) << "Processed buffer for the socket, full: " << full;
+      if (acquireMode == EVENTS_MODE) {
+        // only buffers holding events produce any traffic
+        packEvents(slot, full, timestamp);
+      } else if (full) {
+        LOG(plog::verbose) << "Work buff size: " << samplesPerAcquisition;
+        slot.frame = frameHeader(timestamp);
+        slot.data[0] = reinterpret_cast<const char *>(ch1);
+        slot.data[1] = reinterpret_cast<const char *>(ch2);
+        if (outputFormat != FLOAT32_OUTPUT) {
+          slot.data[0] = ch1 ? slot.pack[0].data() : nullptr;
+          slot.data[1] = ch2 ? slot.pack[1].data() : nullptr;
+          packOutput(ch1, ch2, slot.pack[0].data(), slot.pack[1].data());
+        }
+      }
+      if (acquireMode == EVENTS_MODE || full) {
+        acquisitionCounter++;
+        if (queueOutput() < 0) {
+          return -1;
+        }
       }
       // repost the buffer if we are not done
-      if (bufferCounter < static_cast<int32_t>(nbrBuffers)) {
-        if (postBuffer(buff) < 0) {
-          LOG(plog::error) << "COULD NOT POST API BUFFER " << std::hex
-          << (uint64_t)(buff.get());
+      if (continuous || bufferCounter < static_cast<int32_t>(nbrBuffers)) {
+        if (postBuffer(index) < 0 && !threadStop) {
+          LOG(plog::error) << "COULD NOT POST API BUFFER " << index;
           return -1;
         }
       }
     } else {
-      // if no socket is available, push it onto dataQ
-      dataQ.push(buff);
+      // When every other buffer is waiting for the application the board
+      // is about to run dry; in continuous mode the oldest one goes back to
+      // the board instead
+      uint32_t oldest;
+      if (continuous && bufferQ.empty() && popData(oldest, false)) {
+        droppedAcquisitions++;
+        LOG(plog::verbose) << "DROPPED BUFFER " << oldest;
+        if (postBuffer(oldest) < 0) {
+          return -1;
+        }
+      }
+      // if no socket is available, push it onto dataQ; it holds every
+      // buffer of the pool
+      dataQ.push(index);
     }
 
     if (threadStop) {
@@ -472,326 +1114,1294 @@ int32_t AlazarATS9870::rx(int32_t* ready) {
   return 0;
 }
 
+// Dimensions of the acquisitions delivered in the mode, outermost first
+uint32_t AlazarATS9870::outputShape(uint32_t shape[4]) const {
+  switch (acquireMode) {
+  case AVERAGER_MODE:
+    shape[0] = nbrRoiSegments;
+    shape[1] = outputLength;
+    return 2;
+  case CORRELATOR_MODE:
+    shape[0] = nbrCorrelationLags;
+    shape[1] = nbrSegments;
+    shape[2] = recordLength;
+    return 3;
+  case HISTOGRAM_MODE:
+    shape[0] = histogramPerSegment ? nbrSegments : 1;
+    shape[1] = HISTOGRAM_BINS;
+    return 2;
+  case EVENTS_MODE:
+    shape[0] = static_cast<uint32_t>(eventList.size());
+    shape[1] = eventWindow;
+    return 2;
+  default:
+    shape[0] = partialBuffer ? 1 : roundRobinsPerBuffer;
+    shape[1] = nbrRoiSegments;
+    shape[2] = nbrWaveforms;
+    shape[3] = outputLength;
+    return 4;
+  }
+}
+
+// Header of the frames of the next acquisition, for the whole output
+FrameHeader_t AlazarATS9870::frameHeader(uint64_t timestamp) const {
+  FrameHeader_t frame = {};
+  frame.magic = FRAME_MAGIC;
+  frame.version = FRAME_VERSION;
+  frame.headerSize = sizeof(FrameHeader_t);
+  frame.acquisition = acquisitionCounter;
+  frame.timestamp = timestamp;
+  frame.dropped = droppedAcquisitions;
+  frame.totalSize = uint64_t(samplesPerAcquisition) * outputSampleSize();
+  frame.format = outputHeader.format;
+  frame.ndim = outputShape(frame.shape);
+  frame.count = outputHeader.count;
+  frame.step = sequenceStep;
+  frame.scale = outputHeader.scale;
+  frame.valueOffset = outputHeader.offset;
+  return frame;
+}
+
+#ifdef MSG_DONTWAIT
+#define SEND_FLAGS MSG_DONTWAIT
+#else
+#define SEND_FLAGS 0
+#endif
+
+// > 0 once the socket has room for more data, 0 after SEND_POLL_MS without
+static int32_t waitWritable(int32_t socket) {
+#ifdef _WIN32
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(socket, &writable);
+  timeval timeout = {0, SEND_POLL_MS * 1000};
+  return select(0, nullptr, &writable, nullptr, &timeout);
+#else
+  pollfd fd = {socket, POLLOUT, 0};
+  int32_t ready = poll(&fd, 1, SEND_POLL_MS);
+  return ready < 0 && errno == EINTR ? 0 : ready;
+#endif
+}
+
+// Send everything or fail, the socket may take the data in pieces.  A client
+// that stops reading holds the send up, so the socket is polled and the data
+// is given up on, possibly within a frame, once stop is set: returns 1 then.
+static int32_t sendAll(int32_t socket, const char *data, size_t size,
+                       const std::atomic<bool> &stop) {
+  while (size > 0) {
+    if (stop) {
+      return 1;
+    }
+    int32_t ready = waitWritable(socket);
+    if (ready == 0) {
+      continue;
+    }
+    ssize_t status = ready < 0 ? -1 : send(socket, data, size, SEND_FLAGS);
+#ifndef _WIN32
+    if (status < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue;
+    }
+#endif
+    if (status <= 0) {
+      LOG(plog::error) << "Error writing to socket,"
+      #ifdef _WIN32
+                         << " received error: " << WSAGetLastError();
+      #else
+                         << " received error: " << std::strerror(errno);
+      #endif
+      return -1;
+    }
+    data += status;
+    size -= status;
+  }
+  return 0;
+}
+
+// Send the channel data of an acquisition through the registered sockets as
+// frames of at most the socket buffer size, each preceded by its header.
+// The channels take turns frame by frame, so a client may read them in
+// lockstep.  Channels that are not captured have no data and are not sent.
+// Returns 1 when stop cut the acquisition short.
+int32_t AlazarATS9870::sendFrames(const char *ch1Data, const char *ch2Data,
+                                  FrameHeader_t &frame) {
+  const char *data[MAX_NUM_CHANNELS] = {ch1Data, ch2Data};
+  uint64_t offset = 0;
+  do {
+    frame.offset = offset;
+    frame.size = std::min<uint64_t>(frame.totalSize - offset, socketbuffsize);
+    if (offset + frame.size == frame.totalSize) {
+      frame.flags |= FRAME_LAST;
+    }
+    LOG(plog::verbose) << "Sending thru socket: " << frame.size;
+    for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+      if (sockets[ch] == -1 || data[ch] == nullptr) {
+        continue;
+      }
+      frame.channel = ch;
+      frame.sequence = frameSequence[ch]++;
+      int32_t status = sendAll(sockets[ch],
+                               reinterpret_cast<const char *>(&frame),
+                               sizeof(frame), threadStop);
+      if (status == 0) {
+        status = sendAll(sockets[ch], data[ch] + offset, frame.size,
+                         threadStop);
+      }
+      if (status < 0) {
+        LOG(plog::error) << "Error writing ch" << ch + 1
+                         << " frame to socket, " << frame.size << " bytes";
+        return -1;
+      } else if (status > 0) {
+        LOG(plog::info) << "Stopped writing ch" << ch + 1 << " frame";
+        return 1;
+      }
+    }
+    offset += frame.size;
+  } while (offset < frame.totalSize);
+
+  return 0;
+}
+
+// Pack the events found in the work buffers of the slot into one message per
+// channel of EventInfo_t headers, each followed by its window of samples.
+// Without events there is nothing to send.
+void AlazarATS9870::packEvents(OutputSlot &slot, uint32_t nbrEvents,
+                               uint64_t timestamp) {
+  size_t windowSize = eventWindow * sizeof(float);
+  size_t eventSize = sizeof(EventInfo_t) + windowSize;
+  for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+    slot.data[ch] = nullptr;
+    if (nbrEvents == 0 || !channelEnabled(ch)) {
+      continue;
+    }
+    slot.pack[ch].resize(nbrEvents * eventSize);
+    for (uint32_t n = 0; n < nbrEvents; n++) {
+      char *p = slot.pack[ch].data() + n * eventSize;
+      memcpy(p, &eventList[n], sizeof(EventInfo_t));
+      memcpy(p + sizeof(EventInfo_t), slot.work[ch].data() + n * eventWindow,
+             windowSize);
+    }
+    slot.data[ch] = slot.pack[ch].data();
+  }
+
+  slot.frame = frameHeader(timestamp);
+  slot.frame.flags = FRAME_EVENTS;
+  slot.frame.shape[0] = nbrEvents;
+  slot.frame.totalSize = nbrEvents * eventSize;
+}
+
 int32_t AlazarATS9870::rxThreadRun(void) {
   if (threadRunning) {
     LOG(plog::error) << "RX THREAD ALREADY RUNNING ";
     return -1;
   }
 
+  // a queued sequence starts over from its first step
+  sequenceStep = 0;
+  deliveredStep = 0;
+  if (!sequence.empty()) {
+    AcquisitionParams_t acqParams;
+    if (ConfigureBoard(configuredSystem, configuredBoard, sequence[0].data(),
+                       acqParams) < 0) {
+      return -1;
+    }
+  }
+
+  if (arm(true) < 0) {
+    return -1;
+  }
+
+  // hand the acquisition to the receive thread
+  startWorker();
+  threadRunning = true;
+  std::unique_lock<std::mutex> lock(workerMutex);
+  workerArmed = true;
+  workerCond.notify_all();
+  workerCond.wait(lock, [this] { return !workerArmed; });
+  LOG(plog::info) << "Alazar ready to acq";
+  return 0;
+}
+
+// Prepare the board and the buffers for an acquisition of the current
+// configuration.  The counters of the acquisition carry on from the step
+// before in a sequence, unless restarting.
+int32_t AlazarATS9870::arm(bool restart) {
+  // without interleaving the board writes the records of each channel
+  // contiguously; a single channel has nothing to interleave with
+  uint32_t admaFlags = ADMA_NPT | ADMA_EXTERNAL_STARTCAPTURE;
+  if (interleavedSamples) {
+    admaFlags |= ADMA_INTERLEAVE_SAMPLES;
+  }
   RETURN_CODE retCode = AlazarBeforeAsyncRead(
-      boardHandle, CHANNEL_A | CHANNEL_B, 0, recordLength, recordsPerBuffer,
-      recordsPerAcquisition,
-      ADMA_NPT | ADMA_EXTERNAL_STARTCAPTURE | ADMA_INTERLEAVE_SAMPLES);
+      boardHandle, channelSelect, 0, recordLength, recordsPerBuffer,
+      continuous ? CONTINUOUS_RECORDS : recordsPerAcquisition, admaFlags);
   if (retCode != ApiSuccess) {
     printError(retCode, __FILE__, __LINE__);
     return -1;
   }
 
-  uint32_t nbrBuffersMaxMin =
-      std::min(nbrBuffers, static_cast<uint32_t>(MAX_NUM_BUFFERS));
-  nbrBuffersMaxMin =
-      std::max(nbrBuffersMaxMin, static_cast<uint32_t>(MIN_NUM_BUFFERS));
+  // reset buffer counters
+  bufferCounter = 0;
+  processCounter = 0;
+  boardOverflow = false;
+  if (restart) {
+    buffersReceived = 0;
+    acquisitionsDelivered = 0;
+    lastSequence = 0;
+    frameSequence[0] = 0;
+    frameSequence[1] = 0;
+    acquisitionCounter = 0;
+    droppedAcquisitions = 0;
+  }
 
-  for (uint32_t i = 0; i < nbrBuffersMaxMin; ++i) {
-    auto buff = std::make_shared<std::vector<uint8_t>>(bufferLen);
-    postBuffer(buff);
+  // reuse the buffers of the previous acquisition when they fit; each
+  // starts on a page of one block
+  size_t stride = (static_cast<size_t>(bufferLen) + BUFFER_ALIGNMENT - 1) /
+                  BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+  if (nbrDescriptors != postedBuffers || descriptors[0].length != bufferLen) {
+    bufferMemory.assign(postedBuffers * stride + BUFFER_ALIGNMENT, 0);
+    uintptr_t start = reinterpret_cast<uintptr_t>(bufferMemory.data());
+    size_t gap = (BUFFER_ALIGNMENT - start % BUFFER_ALIGNMENT) %
+                 BUFFER_ALIGNMENT;
+    for (uint32_t i = 0; i < MAX_NUM_BUFFERS; ++i) {
+      BufferDescriptor &buff = descriptors[i];
+      buff.data = i < postedBuffers ? bufferMemory.data() + gap + i * stride
+                                    : nullptr;
+      buff.length = i < postedBuffers ? bufferLen : 0;
+    }
+    nbrDescriptors = postedBuffers;
+  }
+  for (uint32_t i = 0; i < nbrDescriptors; ++i) {
+    descriptors[i].state = BUFFER_FREE;
+    postBuffer(i);
   }
-  // reset buffer counter
-  bufferCounter = 0;
 
   retCode = AlazarStartCapture(boardHandle);
   if (retCode != ApiSuccess) {
     printError(retCode, __FILE__, __LINE__);
   }
-  int32_t ready = 0;
-  uint32_t sleep_time = 50;
-  rxThread = std::thread(&AlazarATS9870::rx, this, &ready);
-  threadRunning = true;
-  while (ready != 1) {
-    LOG(plog::info) << "Waiting for Alazar to begin acq";
-    std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time));
-  }
-  LOG(plog::info) << "Alazar ready to acq";
   return 0;
 }
 
-void AlazarATS9870::rxThreadStop(void) {
-  LOG(plog::verbose) << "STOPPING RX THREAD " << rxThread.get_id();
+// Move a queued sequence on to its next step, once the application has
+// taken every acquisition of the current one: their processing depends on
+// the configuration of the step.
+bool AlazarATS9870::nextStep(void) {
+  if (sequenceStep + 1 >= sequence.size()) {
+    return false;
+  }
+  while (!threadStop) {
+    std::unique_lock<std::mutex> processLock(processMutex);
+    if (!dataQ.empty()) {
+      processLock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    // the buffers still posted belong to the step that is done
+    bufferQ.clear();
+    sequenceStep++;
+    AcquisitionParams_t acqParams;
+    if (ConfigureBoard(configuredSystem, configuredBoard,
+                       sequence[sequenceStep].data(), acqParams) < 0) {
+      LOG(plog::error) << "Could not configure step " << sequenceStep;
+      return false;
+    }
+    // arming under the worker lock, rxThreadStop aborts either before or
+    // after it
+    std::lock_guard<std::mutex> lock(workerMutex);
+    return !threadStop && arm(false) == 0;
+  }
+  return false;
+}
+
+void AlazarATS9870::worker(void) {
+  std::unique_lock<std::mutex> lock(workerMutex);
+  while (true) {
+    workerCond.wait(lock, [this] { return workerArmed || workerExit; });
+    if (workerExit) {
+      return;
+    }
+    workerArmed = false;
+    acquiring = true;
+    workerCond.notify_all();
+    lock.unlock();
+    // the steps of a queued sequence follow each other without a return
+    // to the application; what went to the sender is sent before the next
+    // step is configured or the acquisition handed back
+    while (true) {
+      int32_t ret = rx();
+      if (drainOutputs() < 0) {
+        ret = -1;
+      }
+      if (ret < 0 || threadStop || !nextStep()) {
+        break;
+      }
+      LOG(plog::info) << "Acquiring step " << sequenceStep;
+    }
+    lock.lock();
+    acquiring = false;
+    workerCond.notify_all();
+  }
+}
+
+void AlazarATS9870::startWorker(void) {
+  if (!rxThread.joinable()) {
+    workerExit = false;
+    rxThread = std::thread(&AlazarATS9870::worker, this);
+    LOG(plog::verbose) << "STARTED RX THREAD " << rxThread.get_id();
+  }
+  if (!senderThread.joinable()) {
+    senderExit = false;
+    senderThread = std::thread(&AlazarATS9870::sender, this);
+  }
+}
+
+// Send the output slots in the order they were queued, until stopWorker
+void AlazarATS9870::sender(void) {
+  std::unique_lock<std::mutex> lock(senderMutex);
+  while (true) {
+    senderCond.wait(lock,
+                    [this] { return outputsSent < outputsQueued || senderExit; });
+    if (senderExit) {
+      return;
+    }
+    OutputSlot &slot = outputSlots[outputsSent % OUTPUT_NUM_BUFFERS];
+    bool failed = senderFailed;
+    lock.unlock();
+    // after a failure the rest are dropped, the receive thread gives up;
+    // after stop they are dropped as well, so stop does not wait on the
+    // client
+    int32_t status = failed || threadStop ? 1 : 0;
+    if (status == 0 && (slot.data[0] || slot.data[1])) {
+      status = sendFrames(slot.data[0], slot.data[1], slot.frame);
+      failed = status < 0;
+    }
+    if (status == 0) {
+      lastSequence = slot.frame.acquisition;
+      acquisitionsDelivered++;
+    }
+    lock.lock();
+    senderFailed = failed;
+    outputsSent++;
+    senderCond.notify_all();
+  }
+}
+
+// Size the output slots for the configuration, while the sender is idle
+void AlazarATS9870::prepareOutputs(void) {
+  for (auto &slot : outputSlots) {
+    for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+      uint32_t samples = channelEnabled(ch) ? samplesPerAcquisition : 0;
+      slot.work[ch].resize(samples);
+      if (outputFormat != FLOAT32_OUTPUT && acquireMode != EVENTS_MODE) {
+        slot.pack[ch].resize(samples * outputSampleSize());
+      }
+    }
+  }
+}
+
+// Hand the slot just processed to the sender and wait for the next one to
+// be free
+int32_t AlazarATS9870::queueOutput(void) {
+  std::unique_lock<std::mutex> lock(senderMutex);
+  outputsQueued++;
+  senderCond.notify_all();
+  senderCond.wait(lock, [this] {
+    return outputsQueued - outputsSent < OUTPUT_NUM_BUFFERS || senderFailed;
+  });
+  return senderFailed ? -1 : 0;
+}
+
+// Wait for the sender to send, or drop after stop, every slot queued; a
+// failure is reported once
+int32_t AlazarATS9870::drainOutputs(void) {
+  std::unique_lock<std::mutex> lock(senderMutex);
+  senderCond.wait(lock, [this] { return outputsSent == outputsQueued; });
+  bool failed = senderFailed;
+  senderFailed = false;
+  return failed ? -1 : 0;
+}
+
+void AlazarATS9870::stopWorker(void) {
   if (threadRunning) {
-    threadStop = true;
+    rxThreadStop();
+  }
+  if (rxThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(workerMutex);
+      workerExit = true;
+    }
+    workerCond.notify_all();
     try {
       rxThread.join();
     } catch (std::exception &e) {
       LOG(plog::error) << "Error occured: " << e.what();
     }
-    threadRunning = false;
+  }
+  if (senderThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(senderMutex);
+      senderExit = true;
+    }
+    senderCond.notify_all();
+    senderThread.join();
+  }
+  bufferMemory = std::vector<uint8_t>();
+  nbrDescriptors = 0;
+}
 
+void AlazarATS9870::rxThreadStop(void) {
+  LOG(plog::verbose) << "STOPPING RX THREAD " << rxThread.get_id();
+  if (threadRunning) {
+    // aborting first wakes the receive thread from a pending wait, rather
+    // than leaving it until the wait times out
+    {
+      std::lock_guard<std::mutex> lock(workerMutex);
+      threadStop = true;
+    }
     RETURN_CODE retCode = AlazarAbortAsyncRead(boardHandle);
     if (retCode != ApiSuccess) {
       printError(retCode, __FILE__, __LINE__);
     }
+    {
+      std::unique_lock<std::mutex> lock(workerMutex);
+      workerCond.wait(lock, [this] { return !acquiring; });
+    }
+    threadRunning = false;
 
-    // Clear the buffers to release the ownership of the shared pointers
-    // This will deallocate the memory allocated for the buffers
+    // Clear the queues; the buffers stay in the pool for the next
+    // acquisition.
     // NOTE:
     // Only do this afer the AlazarAbortAsyncRead to make sure that the
     // alazar is done accessing the memory
-    std::shared_ptr<std::vector<uint8_t>> buff;
-    bufferQ.clear(buff);
-    dataQ.clear(buff);
-    ownerQ.clear(buff);
+    bufferQ.clear();
+    dataQ.clear();
   }
 
   threadStop = false;
 }
 
-int32_t AlazarATS9870::postBuffer(shared_ptr<std::vector<uint8_t>> buff) {
-  // maintain a copy of the shared pointer in the owner Q to prevent the
-  // the pointer from going out of scope in the rx thread
-  while (!ownerQ.push(buff))
-    ;
-  while (!bufferQ.push(buff))
+// A setting is changed unless it was last applied with the same values.  A
+// changed setting is forgotten until it is applied again, so a failure
+// leaves it to be written by the next configuration.
+bool AlazarATS9870::settingChanged(const char *name,
+                                   const std::vector<uint32_t> &values) {
+  auto setting = appliedSettings.find(name);
+  if (setting != appliedSettings.end() && setting->second == values) {
+    return false;
+  }
+  appliedSettings.erase(name);
+  return true;
+}
+
+void AlazarATS9870::settingApplied(const char *name,
+                                   const std::vector<uint32_t> &values) {
+  appliedSettings[name] = values;
+}
+
+// Take the oldest buffer waiting for the application.  Every buffer takes a
+// sequence number as it arrives, delivered or not, so the dropped ones leave
+// a gap.
+bool AlazarATS9870::popData(uint32_t &index, bool deliver) {
+  std::lock_guard<std::mutex> lock(dataMutex);
+  if (!dataQ.pop(index)) {
+    return false;
+  }
+  descriptors[index].state = BUFFER_PROCESSING;
+  if (deliver) {
+    lastSequence = descriptors[index].sequence;
+    deliveredStep = sequenceStep.load();
+    acquisitionsDelivered++;
+  }
+  return true;
+}
+
+void AlazarATS9870::streamStatus(StreamStatus_t &status) {
+  status.received = buffersReceived;
+  status.delivered = acquisitionsDelivered;
+  status.sequence = lastSequence;
+  status.dropped = droppedAcquisitions;
+  status.overflow = boardOverflow;
+  status.running = acquiring;
+  status.step = deliveredStep;
+  status.nbrSteps = sequence.size();
+}
+
+// Everything the processing time depends on goes in the key.  The output
+// format is worked out after the plan, so it is taken from the configuration.
+std::string AlazarATS9870::tuningKey(const ConfigData_t &config) const {
+  static const std::string cpu = cpuName();
+  std::ostringstream key;
+  key << cpu << " mode " << acquireMode << " records " << recordLength
+      << " x " << nbrWaveforms << " x " << nbrSegments << " x "
+      << nbrRoundRobins << " channels " << channelSelect << " layout "
+      << dmaLayout << " padded " << padBuffers << " downsample "
+      << downsampleFactor << " lags " << nbrCorrelationLags << " format "
+      << (config.outputFormat ? config.outputFormat : "float32") << " roi";
+  for (auto &window : roiWindows) {
+    key << ' ' << window.first << ':' << window.second;
+  }
+  key << " segments";
+  if (nbrRoiSegments == nbrSegments) {
+    key << " all";
+  } else {
+    for (uint32_t seg = 0; seg < nbrSegments; seg++) {
+      if (roiSegmentIndex[seg] >= 0) {
+        key << ' ' << seg;
+      }
+    }
+  }
+  return key.str();
+}
+
+// Process TUNE_BYTES of buffers with the current plan and return the
+// seconds per record of the processing alone.  The buffer is flushed from
+// the caches before each pass, so its samples come from memory as those of
+// a DMA buffer do on hosts where the DMA bypasses the cache.  Posting and
+// waiting for the buffers is not timed.
+double AlazarATS9870::timeProcessing(uint32_t samplesPerAcquisition) {
+  uint32_t nbrProcessed = std::max<uint32_t>(1, TUNE_BYTES / bufferLen);
+  std::vector<uint8_t> data(bufferLen);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint8_t>(i * 7 + i / 4093);
+  }
+  std::vector<float> ch1(samplesPerAcquisition);
+  std::vector<float> ch2(samplesPerAcquisition);
+  double seconds = 0;
+  uint64_t records = 0;
+  processCounter = 0;
+  for (uint32_t n = 0; n < nbrProcessed; n++) {
+    evictFromCache(data.data(), bufferLen);
+    records += validRecords();
+    auto start = std::chrono::high_resolution_clock::now();
+    processBuffer(data.data(), ch1.data(), ch2.data());
+    auto stop = std::chrono::high_resolution_clock::now();
+    seconds += std::chrono::duration<double>(stop - start).count();
+  }
+  return seconds / records;
+}
+
+// Time the processing of the configuration with buffers from
+// TUNE_MIN_BUFFER_SIZE to TUNE_MAX_BUFFER_SIZE, keep the fastest size for
+// this host and configure the board with it
+int32_t AlazarATS9870::tuneBufferPlan(uint32_t systemId, uint32_t boardId,
+                                      const ConfigData_t &config,
+                                      AcquisitionParams_t &acqParams) {
+  ConfigData_t candidate = config;
+  std::set<uint32_t> tried;
+  TunedPlan best = {0};
+  double fastest = 0;
+  for (uint32_t size = TUNE_MIN_BUFFER_SIZE; size <= TUNE_MAX_BUFFER_SIZE;
+       size *= 2) {
+    candidate.bufferSize = size;
+    if (ConfigureBoard(systemId, boardId, candidate, acqParams) < 0) {
+      return -1;
+    }
+    // targets beyond the acquisition give the same buffers
+    if (!tried.insert(bufferLen).second) {
+      continue;
+    }
+    // the fastest of a few passes, the others being slowed by the rest of
+    // the system
+    double seconds = timeProcessing(acqParams.samplesPerAcquisition);
+    for (uint32_t n = 1; n < TUNE_REPEATS; n++) {
+      seconds =
+          std::min(seconds, timeProcessing(acqParams.samplesPerAcquisition));
+    }
+    LOG(plog::info) << "Buffer size " << bufferLen << " bytes: "
+                    << seconds * 1e9 << " ns per record";
+    if (best.bufferSize == 0 || seconds < fastest) {
+      best = {size};
+      fastest = seconds;
+    }
+  }
+  storeTunedPlan(tuningKey(config), best.bufferSize);
+  LOG(plog::info) << "Tuned buffer size " << best.bufferSize << " bytes for "
+                  << tuningKey(config);
+
+  return ConfigureBoard(systemId, boardId, config, acqParams);
+}
+
+void AlazarATS9870::bufferPlan(BufferPlan_t &plan) {
+  plan.bufferSize = bufferLen;
+  plan.nbrBuffers = nbrBuffers;
+  plan.postedBuffers = postedBuffers;
+  plan.recordsPerBuffer = recordsPerBuffer;
+  plan.roundRobinsPerBuffer = partialBuffer ? 0 : roundRobinsPerBuffer;
+  plan.buffersPerRoundRobin = partialBuffer ? buffersPerRoundRobin : 0;
+  plan.paddingRecords = paddingRecords;
+}
+
+int32_t AlazarATS9870::postBuffer(uint32_t index) {
+  BufferDescriptor &buff = descriptors[index];
+  if (buff.state.exchange(BUFFER_POSTED) == BUFFER_POSTED) {
+    LOG(plog::error) << "BUFFER " << index << " IS ALREADY POSTED";
+    return (-1);
+  }
+  while (!bufferQ.push(index))
     ;
-  RETURN_CODE retCode =
-      AlazarPostAsyncBuffer(boardHandle, buff.get()->data(), bufferLen);
+  RETURN_CODE retCode = AlazarPostAsyncBuffer(boardHandle, buff.data, bufferLen);
 
   if (retCode != ApiSuccess) {
     printError(retCode, __FILE__, __LINE__);
     return (-1);
   } else {
-    LOG(plog::verbose) << "POSTED BUFFER " << std::hex
-                        << (uint64_t)(buff.get());
+    LOG(plog::verbose) << "POSTED BUFFER " << index;
   }
 
   return (0);
 }
 
+// Largest divisor of n that is at most limit, from the pairs of divisors up
+// to the square root of n
+static uint32_t largestDivisor(uint32_t n, uint32_t limit) {
+  uint32_t best = 1;
+  for (uint32_t d = 1; static_cast<uint64_t>(d) * d <= n; d++) {
+    if (n % d != 0) {
+      continue;
+    }
+    if (d <= limit) {
+      best = std::max(best, d);
+    }
+    if (n / d <= limit) {
+      best = std::max(best, n / d);
+    }
+  }
+  return best;
+}
+
 int32_t AlazarATS9870::getBufferSize(void) {
+  uint64_t recordBytes = static_cast<uint64_t>(recordLength) * numChannels;
 
   // need to fit at least one record in a buffer
-  if (recordLength * numChannels > MAX_BUFFER_SIZE) {
+  if (recordBytes > MAX_BUFFER_SIZE) {
     LOG(plog::error) << "SINGLE RECORD TOO LARGE FOR THE BUFFER";
     return (-1);
   }
 
-  // Find the factors of the number of round robins.
-  // Each buffer will contain an integer number of round robins and the number
-  // of round robins will be divided equally amoung all of the buffers.
-  std::list<uint32_t> rrFactors;
-  for (uint32_t ii = 1; ii <= nbrRoundRobins; ii++) {
-    if (nbrRoundRobins % ii == 0) {
-      rrFactors.push_front(ii);
+  // the target size holds at least one record
+  uint64_t target = targetBufferSize ? targetBufferSize : PREF_BUFFER_SIZE;
+  target = std::max(std::min<uint64_t>(target, MAX_BUFFER_SIZE), recordBytes);
+
+  uint32_t recordsPerRoundRobin = nbrSegments * nbrWaveforms;
+  uint64_t roundRobinBytes = recordBytes * recordsPerRoundRobin;
+  paddingRecords = 0;
+
+  if (roundRobinBytes <= target) {
+    // Each buffer holds an integer number of round robins, and the round
+    // robins are divided equally among the buffers: as many as fit the
+    // target that divide the round robins.  When that leaves the buffers
+    // under half the target, padBuffers fills them instead and pads the
+    // final buffer with less than a round robin per buffer.
+    uint32_t fit = static_cast<uint32_t>(
+        std::min<uint64_t>(target / roundRobinBytes, nbrRoundRobins));
+    roundRobinsPerBuffer = largestDivisor(nbrRoundRobins, fit);
+    nbrBuffers = nbrRoundRobins / roundRobinsPerBuffer;
+    if (padBuffers && 2 * roundRobinsPerBuffer < fit) {
+      nbrBuffers = (nbrRoundRobins + fit - 1) / fit;
+      roundRobinsPerBuffer = (nbrRoundRobins + nbrBuffers - 1) / nbrBuffers;
+      paddingRecords = (nbrBuffers * roundRobinsPerBuffer - nbrRoundRobins) *
+                       recordsPerRoundRobin;
     }
+    recordsPerBuffer = recordsPerRoundRobin * roundRobinsPerBuffer;
+    buffersPerRoundRobin = 0;
+    partialBuffer = false;
+  } else {
+    // A round robin must be equally divided into buffers: the records of a
+    // buffer divide those of a round robin, as many as fit the target.  The
+    // records of a round robin follow each other, so there is no padding.
+    roundRobinsPerBuffer = 0;
+    recordsPerBuffer = largestDivisor(
+        recordsPerRoundRobin, static_cast<uint32_t>(target / recordBytes));
+    buffersPerRoundRobin = recordsPerRoundRobin / recordsPerBuffer;
+    nbrBuffers = buffersPerRoundRobin * nbrRoundRobins;
+    partialBuffer = true;
   }
+  bufferLen = static_cast<uint32_t>(recordsPerBuffer * recordBytes);
+  recordsPerAcquisition = recordsPerBuffer * nbrBuffers;
 
-  // find the maximum number of rr's that can fit in the buffer
-  roundRobinsPerBuffer = 0;
-  for (std::list<uint32_t>::iterator rr = rrFactors.begin();
-       rr != rrFactors.end(); ++rr) {
-    uint64_t bufferSizeTest =
-        recordLength * nbrSegments * nbrWaveforms * *rr * numChannels;
-    if (bufferSizeTest <= PREF_BUFFER_SIZE) {
-      roundRobinsPerBuffer = *rr;
-      LOG(plog::info) << "roundRobinsPerBuffer: " << roundRobinsPerBuffer;
-      break;
-    }
+  LOG(plog::info) << "bufferLen: " << bufferLen;
+  LOG(plog::info) << "nbrBuffers: " << nbrBuffers;
+  LOG(plog::info) << "recordsPerBuffer: " << recordsPerBuffer;
+  LOG(plog::info) << "recordsPerAcquisition: " << recordsPerAcquisition;
+  LOG(plog::info) << "partialBuffer: " << partialBuffer;
+  if (partialBuffer) {
+    LOG(plog::info) << "buffersPerRoundRobin: " << buffersPerRoundRobin;
+  } else {
+    LOG(plog::info) << "roundRobinsPerBuffer: " << roundRobinsPerBuffer;
+  }
+  if (paddingRecords > 0) {
+    LOG(plog::info) << "paddingRecords: " << paddingRecords;
   }
 
-  // if test is 0 then the round robin needs to be divided evenly into an
-  // an integer number of buffers
-  if (roundRobinsPerBuffer >= 1) {
-    // compute the buffer size
-    bufferLen = recordLength * nbrSegments * nbrWaveforms *
-                roundRobinsPerBuffer * numChannels;
-    LOG(plog::info) << "bufferLen: " << bufferLen;
+  if (static_cast<uint64_t>(recordsPerRoundRobin) * recordLength >
+      MAX_BUFFER_SIZE) {
+    LOG(plog::error) << " Exeeded MAX_BUFFER_SIZE";
+    return (-1);
+  }
 
-    nbrBuffers = nbrRoundRobins / roundRobinsPerBuffer;
-    LOG(plog::info) << "nbrBuffers: " << nbrBuffers;
+  return (0);
+}
 
-    recordsPerBuffer = nbrSegments * nbrWaveforms * roundRobinsPerBuffer;
-    LOG(plog::info) << "recordsPerBuffer: " << recordsPerBuffer;
+int32_t AlazarATS9870::processBuffer(const uint8_t *buff, float *ch1,
+                                     float *ch2) {
+  int32_t ret = (this->*processKernel)(buff, ch1, ch2);
+  if (streamOutput) {
+    // the streamed output has to be complete before it is handed off
+    streamFence();
+  }
+  processCounter++;
+  return ret;
+}
 
-    recordsPerAcquisition = recordsPerBuffer * nbrBuffers;
-    LOG(plog::info) << "recordsPerAcquisition: " << recordsPerAcquisition;
+// Convert nbrOut interleaved channel A/B samples to volts, where each output
+// sample is the boxcar sum of downsample adjacent raw samples.  The sums stay
+// in integer counts until the conversion.  With accumulate set the volts are
+// added to ch1/ch2 rather than stored.
+static inline void boxcarConvert(const uint8_t *buff, uint32_t nbrOut,
+                                 uint32_t downsample, float counts2Volts,
+                                 float channelOffset, bool accumulate,
+                                 float *ch1, float *ch2) {
+  float scale = 1.0f / downsample;
+  for (uint32_t i = 0; i < nbrOut; i++) {
+    const uint8_t *p = buff + 2 * i * downsample;
+    uint32_t sum1 = 0;
+    uint32_t sum2 = 0;
+    for (uint32_t d = 0; d < downsample; d++) {
+      sum1 += p[2 * d];
+      sum2 += p[2 * d + 1];
+    }
+    float v1 = counts2Volts * (sum1 * scale - 128) - channelOffset;
+    float v2 = counts2Volts * (sum2 * scale - 128) - channelOffset;
+    if (accumulate) {
+      ch1[i] += v1;
+      ch2[i] += v2;
+    } else {
+      ch1[i] = v1;
+      ch2[i] = v2;
+    }
+  }
+}
 
-    partialBuffer = false;
-    LOG(plog::info) << "partialBuffer: " << partialBuffer;
+// Version of boxcarConvert for the contiguous samples of one channel
+static inline void boxcarConvertSingle(const uint8_t *buff, uint32_t nbrOut,
+                                       uint32_t downsample, float counts2Volts,
+                                       float channelOffset, bool accumulate,
+                                       float *ch) {
+  float scale = 1.0f / downsample;
+  for (uint32_t i = 0; i < nbrOut; i++) {
+    const uint8_t *p = buff + i * downsample;
+    uint32_t sum = 0;
+    for (uint32_t d = 0; d < downsample; d++) {
+      sum += p[d];
+    }
+    float v = counts2Volts * (sum * scale - 128) - channelOffset;
+    if (accumulate) {
+      ch[i] += v;
+    } else {
+      ch[i] = v;
+    }
+  }
+}
 
-    return (0);
+// Convert the regions of interest of record r of the buffer, packed back to
+// back into outputLength samples per channel.  Only the outputs of the
+// captured channels are written.
+void AlazarATS9870::convertRecord(const uint8_t *buff, uint32_t r,
+                                  bool accumulate, float *ch1, float *ch2) {
+  convertRecord(buff, r, accumulate, ch1, ch2, 0, outputLength);
+}
+
+// Version of convertRecord for the output samples [first, first + count) of
+// the record, used to tile the averager.  ch1 and ch2 still point to the
+// start of the record output.
+void AlazarATS9870::convertRecord(const uint8_t *buff, uint32_t r,
+                                  bool accumulate, float *ch1, float *ch2,
+                                  uint32_t first, uint32_t count) {
+  uint32_t last = first + count;
+  uint32_t offset = 0;
+  for (auto &window : roiWindows) {
+    // the part of the window inside the output range, and its first sample
+    uint32_t nbrOut = window.second / downsampleFactor;
+    uint32_t start = std::max(offset, first);
+    uint32_t stop = std::min(offset + nbrOut, last);
+    uint32_t sample = window.first + (start - offset) * downsampleFactor;
+    offset += nbrOut;
+    if (start >= stop) {
+      continue;
+    }
+    uint32_t n = stop - start;
+    if (downsampleFactor == 1) {
+      // without downsampling the kernels chosen for this CPU do the work,
+      // the ones specialized for the record length on whole records
+      const RecordKernels &k =
+          n == records.recordLength ? records : anyLengthRecords;
+      ConvertPairsKernel pairs = accumulate ? k.accumulatePairs : k.convertPairs;
+      ConvertSamplesKernel samples =
+          accumulate ? k.accumulateSamples : k.convertSamples;
+      if (interleavedSamples) {
+        pairs(recordStart(buff, r, 0) + 2 * sample, n, convertTable,
+              ch1 + start, ch2 + start);
+      } else {
+        for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+          if (channelEnabled(ch)) {
+            samples(recordStart(buff, r, ch) + sample, n, convertTable,
+                    (ch == 0 ? ch1 : ch2) + start);
+          }
+        }
+      }
+    } else if (interleavedSamples) {
+      boxcarConvert(recordStart(buff, r, 0) + 2 * sample, n, downsampleFactor,
+                    counts2Volts, channelOffset, accumulate, ch1 + start,
+                    ch2 + start);
+    } else {
+      for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+        if (!channelEnabled(ch)) {
+          continue;
+        }
+        float *out = (ch == 0 ? ch1 : ch2) + start;
+        boxcarConvertSingle(recordStart(buff, r, ch) + sample, n,
+                            downsampleFactor, counts2Volts, channelOffset,
+                            accumulate, out);
+      }
+    }
   }
+}
 
-  // A round robin must be equally divided into buffers
-  // Factor the number of records per round robin.
-  // The number of records per buffer will be one of these factors
-  uint32_t recordsPerRoundRobin = nbrSegments * nbrWaveforms;
-  std::list<uint32_t> recFactors;
-  for (uint32_t ii = 1; ii <= recordsPerRoundRobin; ii++) {
-    if (recordsPerRoundRobin % ii == 0) {
-      recFactors.push_front(ii);
+// Clear, or divide, the outputs of the captured channels
+void AlazarATS9870::clearOutput(float *ch1, float *ch2, uint32_t size) {
+  if (channelEnabled(0)) {
+    memset(ch1, 0, sizeof(float) * size);
+  }
+  if (channelEnabled(1)) {
+    memset(ch2, 0, sizeof(float) * size);
+  }
+}
+
+void AlazarATS9870::divideOutput(float *ch1, float *ch2, uint32_t size,
+                                 float denom) {
+  for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+    float *out = ch == 0 ? ch1 : ch2;
+    if (!channelEnabled(ch)) {
+      continue;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+      out[i] /= denom;
     }
   }
+}
 
-  // Find the number of records that can come closest to the max buffer size
-  buffersPerRoundRobin = 0;
-  for (std::list<uint32_t>::iterator rec = recFactors.begin();
-       rec != recFactors.end(); ++rec) {
-    uint32_t bufferSizeTest = recordLength * *rec * numChannels;
-    if (bufferSizeTest <= PREF_BUFFER_SIZE) {
-      recordsPerBuffer = *rec;
-      LOG(plog::info) << "recordsPerBuffer: " << recordsPerBuffer;
-      break;
+template <bool averager>
+int32_t
+AlazarATS9870::processCompleteBuffer(const uint8_t *buff, float *ch1,
+                                     float *ch2) {
+  // the round robins of padding at the end of the final buffer are left out
+  uint32_t nj = nbrWaveforms;
+  uint32_t nk = nbrSegments;
+  uint32_t nl = validRecords() / (nj * nk);
+
+  // samples per record and segments in the output
+  uint32_t no = outputLength;
+  uint32_t ns = nbrRoiSegments;
+
+  // records of segments outside the region of interest are skipped
+  if (averager) {
+    // accumulate the average in the application buffer which needs to
+    // be cleared to start
+    clearOutput(ch1, ch2, samplesPerAcquisition);
+    // sum along the 2nd and 4th dimension one tile of samples at a time, so
+    // the accumulators stay in cache while every waveform and round robin of
+    // the segment is added; each sample is still summed in record order
+    for (uint32_t k = 0; k < nk; k++) {
+      int32_t s = roiSegmentIndex[k];
+      if (s < 0) {
+        continue;
+      }
+      for (uint32_t t = 0; t < no; t += averagerTile) {
+        uint32_t count = std::min(averagerTile, no - t);
+        for (uint32_t l = 0; l < nl; l++) {
+          for (uint32_t j = 0; j < nj; j++) {
+            uint32_t r = j + k*nj + l*nj*nk;
+            convertRecord(buff, r, true, ch1 + s*no, ch2 + s*no, t, count);
+          }
+        }
+      }
     }
+  } else {
+    for (uint32_t l = 0; l < nl; l++) {
+      for (uint32_t k = 0; k < nk; k++) {
+        int32_t s = roiSegmentIndex[k];
+        if (s < 0) {
+          continue;
+        }
+        for (uint32_t j = 0; j < nj; j++) {
+          uint32_t r = j + k*nj + l*nj*nk;
+          uint32_t offset = (j + s*nj + l*nj*ns) * no;
+          convertRecord(buff, r, false, ch1 + offset, ch2 + offset);
+        }
+      }
+    }
+    // every sample is written but the round robins of padding at the end,
+    // the output is not read back into the cache to clear it
+    uint32_t written = nl * nj * ns * no;
+    clearOutput(ch1 + written, ch2 + written,
+                samplesPerAcquisition - written);
   }
 
-  bufferLen = recordLength * recordsPerBuffer * numChannels;
-  LOG(plog::info) << "bufferLen: " << bufferLen;
+  if (averager && outputFormat != INT32_OUTPUT) {
+    divideOutput(ch1, ch2, no * ns, nj * nl);
+  } else if (averager) {
+    // the sums are left undivided; the header counts the records summed,
+    // fewer in the final buffer when it is padded
+    outputHeader.count = nj * nl;
+  }
 
-  recordsPerAcquisition = nbrSegments * nbrWaveforms * nbrRoundRobins;
-  LOG(plog::info) << "recordsPerAcquisition: " << recordsPerAcquisition;
+  return 1;
+}
 
-  nbrBuffers = recordsPerAcquisition / recordsPerBuffer;
-  LOG(plog::info) << "nbrBuffers: " << nbrBuffers;
+template <bool averager>
+int32_t AlazarATS9870::processPartialBuffer(const uint8_t *buff, float *ch1,
+                                            float *ch2) {
+  uint32_t partialIndex = processCounter % buffersPerRoundRobin;
+  LOG(plog::verbose) << "PARTIAL INDEX " << partialIndex;
 
-  partialBuffer = true;
-  LOG(plog::info) << "partialBuffer: " << partialBuffer;
+  uint32_t nj = nbrWaveforms;
+  uint32_t no = outputLength;
+  uint32_t ns = nbrRoiSegments;
 
-  buffersPerRoundRobin = nbrBuffers / nbrRoundRobins;
-  LOG(plog::info) << "buffersPerRoundRobin: " << buffersPerRoundRobin;
+  // the averager sums each buffer into the application buffer as it
+  // arrives, so it only ever holds one record per segment; it is cleared by
+  // the first buffer of the round robin
+  if (averager && partialIndex == 0) {
+    clearOutput(ch1, ch2, samplesPerAcquisition);
+  }
 
-  if (buffersPerRoundRobin * recordsPerBuffer * recordLength >
-      MAX_BUFFER_SIZE) {
-    LOG(plog::error) << " Exeeded MAX_BUFFER_SIZE";
-    return (-1);
+  uint32_t firstRecord = partialIndex * recordsPerBuffer;
+  for (uint32_t r = 0; r < recordsPerBuffer; r++) {
+    uint32_t j = (firstRecord + r) % nj;
+    uint32_t k = (firstRecord + r) / nj;
+    int32_t s = roiSegmentIndex[k];
+    if (s < 0) {
+      continue;
+    }
+    if (averager) {
+      convertRecord(buff, r, true, ch1 + s * no, ch2 + s * no);
+    } else {
+      uint32_t offset = (j + s * nj) * no;
+      convertRecord(buff, r, false, ch1 + offset, ch2 + offset);
+    }
   }
 
-  return (0);
-}
+  // if it is the last buffer in the round robin, finish the average
+  if (averager && outputFormat != INT32_OUTPUT &&
+      partialIndex == buffersPerRoundRobin - 1) {
+    divideOutput(ch1, ch2, no * ns, nj);
+  }
 
-int32_t AlazarATS9870::processBuffer(
-    std::shared_ptr<std::vector<uint8_t>> buffPtr, float *ch1, float *ch2) {
-  if (partialBuffer) {
-    return processPartialBuffer(buffPtr, ch1, ch2);
+  if (partialIndex == buffersPerRoundRobin - 1) {
+    return 1;
   } else {
-    return processCompleteBuffer(buffPtr, ch1, ch2);
+    return 0;
   }
 }
 
-int32_t
-AlazarATS9870::processCompleteBuffer(std::shared_ptr<std::vector<uint8_t>> buffPtr,
-                             float *ch1, float *ch2) {
+int32_t AlazarATS9870::processCorrelation(const uint8_t *buff, float *ch1,
+                                          float *ch2) {
+  // a complete buffer holds whole round robins, partial buffers are summed
+  // until the last one of the round robin arrives
+  uint32_t partialIndex = 0;
+  uint32_t lastIndex = 0;
+  if (partialBuffer) {
+    partialIndex = processCounter % buffersPerRoundRobin;
+    lastIndex = buffersPerRoundRobin - 1;
+  }
 
-  // accumulate the average in the application buffer which needs to
-  // be cleared to start
-  memset(ch1, 0, sizeof(float) * samplesPerAcquisition);
-  memset(ch2, 0, sizeof(float) * samplesPerAcquisition);
+  uint32_t ni = recordLength;
+  uint32_t nj = nbrWaveforms;
+  uint32_t nk = nbrSegments;
+  uint32_t nl = nbrCorrelationLags;
 
-  // the raw pointer makes the code more readable
-  uint8_t *buff = static_cast<uint8_t *>(buffPtr.get()->data());
+  if (partialIndex == 0) {
+    std::fill(corrSumAB.begin(), corrSumAB.end(), 0);
+    std::fill(corrSumBA.begin(), corrSumBA.end(), 0);
+    std::fill(corrSumA.begin(), corrSumA.end(), 0);
+    std::fill(corrSumB.begin(), corrSumB.end(), 0);
+  }
 
-  if (averager) {
-    // copy and sum along the 2nd and 4th dimension
-    uint32_t ni = recordLength;
-    uint32_t nj = nbrWaveforms;
-    uint32_t nk = nbrSegments;
-    uint32_t nl = roundRobinsPerBuffer;
+  // de-interleave each record into signed counts so the lag loops below
+  // run over contiguous memory
+  int32_t *a = corrRecordA.data();
+  int32_t *b = corrRecordB.data();
+
+  uint32_t firstRecord = partialIndex * recordsPerBuffer;
+  uint32_t nr = validRecords();
+  for (uint32_t r = 0; r < nr; r++) {
+    const uint8_t *recA = recordStart(buff, r, 0);
+    const uint8_t *recB = recordStart(buff, r, 1);
+    uint32_t k = ((firstRecord + r) / nj) % nk;
+
+    if (interleavedSamples) {
+      for (uint32_t i = 0; i < ni; i++) {
+        a[i] = recA[2 * i] - 128;
+        b[i] = recB[2 * i] - 128;
+      }
+    } else {
+      for (uint32_t i = 0; i < ni; i++) {
+        a[i] = recA[i] - 128;
+        b[i] = recB[i] - 128;
+      }
+    }
+
+    int64_t *sumA = corrSumA.data() + k * ni;
+    int64_t *sumB = corrSumB.data() + k * ni;
+    for (uint32_t i = 0; i < ni; i++) {
+      sumA[i] += a[i];
+      sumB[i] += b[i];
+    }
 
     for (uint32_t l = 0; l < nl; l++) {
-      for (uint32_t k = 0; k < nk; k++) {
-        for (uint32_t j = 0; j < nj; j++) {
-          for (uint32_t i = 0; i < ni; i++) {
-            // ch1 and ch2 samples are interleaved for faster transfer times
-            ch1[i + k*ni] +=
-                counts2Volts * (buff[2*i + j*2*ni + k*2*ni*nj + l*2*ni*nj*nk] -
-                                128) -
-                channelOffset;
-            ch2[i + k*ni] +=
-                counts2Volts * (buff[2*i + 1 + j*2*ni + k*2*ni*nj + l*2*ni*nj*nk] -
-                                128) -
-                channelOffset;
-          }
-        }
+      int64_t *sumAB = corrSumAB.data() + l * ni * nk + k * ni;
+      int64_t *sumBA = corrSumBA.data() + l * ni * nk + k * ni;
+      for (uint32_t i = 0; i < ni - l; i++) {
+        sumAB[i] += a[i] * b[i + l];
+        sumBA[i] += b[i] * a[i + l];
       }
     }
+  }
 
-    float denom = nj * nl;
-    for (uint32_t i = 0; i < ni * nk; i++) {
-      ch1[i] /= denom;
-      ch2[i] /= denom;
-    }
-  } else { // digitizer mode
-    for (uint32_t i = 0; i < bufferLen / 2; i++) {
-      ch1[i] = counts2Volts * (buff[2 * i] - 128) - channelOffset;
-      ch2[i] = counts2Volts * (buff[2 * i + 1] - 128) - channelOffset;
+  if (partialIndex != lastIndex) {
+    return 0;
+  }
+
+  // convert the sums of products of counts to the average product of volts:
+  // <(c*a - o)(c*b - o)> = (c^2 * sum(ab) - c*o*(sum(a) + sum(b))) / N + o^2
+  double c = counts2Volts;
+  double o = channelOffset;
+  double denom = partialBuffer ? nj : nr / nk;
+
+  for (uint32_t l = 0; l < nl; l++) {
+    for (uint32_t k = 0; k < nk; k++) {
+      int64_t *sumA = corrSumA.data() + k * ni;
+      int64_t *sumB = corrSumB.data() + k * ni;
+      uint32_t offset = l * ni * nk + k * ni;
+      for (uint32_t i = 0; i < ni; i++) {
+        if (i + l >= ni) {
+          ch1[offset + i] = 0;
+          ch2[offset + i] = 0;
+          continue;
+        }
+        ch1[offset + i] = static_cast<float>(
+            (c * c * corrSumAB[offset + i] - c * o * (sumA[i] + sumB[i + l])) /
+                denom +
+            o * o);
+        ch2[offset + i] = static_cast<float>(
+            (c * c * corrSumBA[offset + i] - c * o * (sumB[i] + sumA[i + l])) /
+                denom +
+            o * o);
+      }
     }
   }
 
   return 1;
 }
 
-int32_t AlazarATS9870::processPartialBuffer(
-    std::shared_ptr<std::vector<uint8_t>> buffPtr, float *ch1, float *ch2) {
-  uint32_t partialIndex = bufferCounter % buffersPerRoundRobin;
-  LOG(plog::verbose) << "PARTIAL INDEX " << partialIndex;
+// Search each window of every record for a sample beyond the threshold of
+// either channel and convert only the windows that contain one.  Returns the
+// number of events, which are described in eventList.
+int32_t AlazarATS9870::processEvents(const uint8_t *buff, float *ch1,
+                                     float *ch2) {
+  uint32_t ni = recordLength;
+  uint32_t nw = eventWindow;
+  int32_t high1 = eventHigh[0], low1 = eventLow[0];
+  int32_t high2 = eventHigh[1], low2 = eventLow[1];
+
+  uint32_t nbrEvents = 0;
+  uint32_t nr = validRecords();
+  for (uint32_t r = 0; r < nr; r++) {
+    for (uint32_t w = 0; w < ni; w += nw) {
+      // branch free so the search over the window vectorizes; contiguous
+      // channels are searched one after the other
+      uint32_t hit = 0;
+      if (interleavedSamples) {
+        const uint8_t *window = recordStart(buff, r, 0) + 2 * w;
+        for (uint32_t i = 0; i < nw; i++) {
+          int32_t a = window[2 * i];
+          int32_t b = window[2 * i + 1];
+          hit |= (a >= high1) | (a <= low1) | (b >= high2) | (b <= low2);
+        }
+      } else {
+        for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+          if (!channelEnabled(ch)) {
+            continue;
+          }
+          const uint8_t *window = recordStart(buff, r, ch) + w;
+          int32_t high = eventHigh[ch], low = eventLow[ch];
+          for (uint32_t i = 0; i < nw; i++) {
+            int32_t a = window[i];
+            hit |= (a >= high) | (a <= low);
+          }
+        }
+      }
+      if (!hit) {
+        continue;
+      }
+
+      if (interleavedSamples) {
+        const uint8_t *window = recordStart(buff, r, 0) + 2 * w;
+        float *pCh1 = ch1 + nbrEvents * nw;
+        float *pCh2 = ch2 + nbrEvents * nw;
+        for (uint32_t i = 0; i < nw; i++) {
+          pCh1[i] = counts2Volts * (window[2 * i] - 128) - channelOffset;
+          pCh2[i] = counts2Volts * (window[2 * i + 1] - 128) - channelOffset;
+        }
+      } else {
+        for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+          if (!channelEnabled(ch)) {
+            continue;
+          }
+          const uint8_t *window = recordStart(buff, r, ch) + w;
+          float *pCh = (ch == 0 ? ch1 : ch2) + nbrEvents * nw;
+          for (uint32_t i = 0; i < nw; i++) {
+            pCh[i] = counts2Volts * (window[i] - 128) - channelOffset;
+          }
+        }
+      }
 
-  // the raw pointer makes the code more readable
-  uint8_t *buff = static_cast<uint8_t *>(buffPtr.get()->data());
+      EventInfo_t &event = eventList[nbrEvents++];
+      event.bufferIndex = processCounter;
+      event.recordIndex = r;
+      event.sampleIndex = w;
+    }
+  }
 
-  if (averager) {
-     float *pCh1Work =  ch1WorkBuff.data();
-     float *pCh2Work =  ch2WorkBuff.data();
+  return nbrEvents;
+}
 
-    // process the buff into the work buffer and if it is the last buffer
-    // in the round robin, run the averager
-    float *pCh1 = (float *)( pCh1Work + bufferLen * partialIndex / 2);
-    float *pCh2 = (float *)( pCh1Work + bufferLen * partialIndex / 2);
+// Count the codes of nbrPairs interleaved channel A/B samples.  Consecutive
+// samples of a channel go to different sub-tables so that runs of the same
+// code do not stall on a store to the counter they are about to reload.
+static void histogramKernel(const uint8_t *buff, uint32_t nbrPairs,
+                            uint32_t *tablesA, uint32_t *tablesB) {
+  uint32_t *a0 = tablesA;
+  uint32_t *a1 = tablesA + HISTOGRAM_BINS;
+  uint32_t *a2 = tablesA + 2 * HISTOGRAM_BINS;
+  uint32_t *a3 = tablesA + 3 * HISTOGRAM_BINS;
+  uint32_t *b0 = tablesB;
+  uint32_t *b1 = tablesB + HISTOGRAM_BINS;
+  uint32_t *b2 = tablesB + 2 * HISTOGRAM_BINS;
+  uint32_t *b3 = tablesB + 3 * HISTOGRAM_BINS;
+
+  uint32_t i = 0;
+  for (; i + 4 <= nbrPairs; i += 4) {
+    const uint8_t *p = buff + 2 * i;
+    a0[p[0]]++;
+    b0[p[1]]++;
+    a1[p[2]]++;
+    b1[p[3]]++;
+    a2[p[4]]++;
+    b2[p[5]]++;
+    a3[p[6]]++;
+    b3[p[7]]++;
+  }
+  for (; i < nbrPairs; i++) {
+    a0[buff[2 * i]]++;
+    b0[buff[2 * i + 1]]++;
+  }
+}
+
+// Version of histogramKernel for the contiguous samples of one channel
+static void histogramKernelSingle(const uint8_t *buff, uint32_t nbrSamples,
+                                  uint32_t *tables) {
+  uint32_t *t0 = tables;
+  uint32_t *t1 = tables + HISTOGRAM_BINS;
+  uint32_t *t2 = tables + 2 * HISTOGRAM_BINS;
+  uint32_t *t3 = tables + 3 * HISTOGRAM_BINS;
+
+  uint32_t i = 0;
+  for (; i + 4 <= nbrSamples; i += 4) {
+    t0[buff[i]]++;
+    t1[buff[i + 1]]++;
+    t2[buff[i + 2]]++;
+    t3[buff[i + 3]]++;
+  }
+  for (; i < nbrSamples; i++) {
+    t0[buff[i]]++;
+  }
+}
 
-    for (uint32_t i = 0; i < bufferLen / 2; i++) {
-      pCh1[i] = counts2Volts * (buff[2 * i] - 128) - channelOffset;
-      pCh2[i] = counts2Volts * (buff[2 * i + 1] - 128) - channelOffset;
+// Merge the sub-tables into a 64 bit histogram and clear them
+static void histogramFlush(uint32_t *tables, uint64_t *hist) {
+  for (uint32_t t = 0; t < HISTOGRAM_TABLES; t++) {
+    uint32_t *table = tables + t * HISTOGRAM_BINS;
+    for (uint32_t bin = 0; bin < HISTOGRAM_BINS; bin++) {
+      hist[bin] += table[bin];
+      table[bin] = 0;
     }
+  }
+}
 
-    if (partialIndex == buffersPerRoundRobin - 1) {
-      // accumulate the average in the application buffer which needs to
-      // be cleared to start
-      memset(ch1, 0, sizeof(float) * samplesPerAcquisition);
-      memset(ch2, 0, sizeof(float) * samplesPerAcquisition);
+// Accumulate the raw codes of the buffer into the acquisition histograms.
+// Returns 1 with the histograms copied to ch1/ch2 once the last buffer of
+// the acquisition has been counted.
+int32_t AlazarATS9870::processHistogram(const uint8_t *buff, float *ch1,
+                                        float *ch2) {
+  if (processCounter == 0) {
+    std::fill(histCh1.begin(), histCh1.end(), 0);
+    std::fill(histCh2.begin(), histCh2.end(), 0);
+  }
 
-      uint32_t ni = recordLength;
-      uint32_t nj = nbrWaveforms;
-      uint32_t nk = nbrSegments;
+  uint32_t ni = recordLength;
+  uint32_t nj = nbrWaveforms;
+  uint32_t nk = nbrSegments;
 
-      // run the averager
-      for (uint32_t k = 0; k < nk; k++) {
-        for (uint32_t j = 0; j < nj; j++) {
-          for (uint32_t i = 0; i < ni; i++) {
-            // ch1 and ch2 samples are interleaved for faster transfer times
-            ch1[i + k * ni] += pCh1Work[i + j * ni + k * ni * nj];
-            ch2[i + k * ni] += pCh2Work[i + j * ni + k * ni * nj];
-          }
-        }
-      }
+  uint32_t *tablesA = histTables.data();
+  uint32_t *tablesB = tablesA + HISTOGRAM_TABLES * HISTOGRAM_BINS;
 
-      float denom = nj;
-      for (uint32_t i = 0; i < ni * nk; i++) {
-        ch1[i] /= denom;
-        ch2[i] /= denom;
-      }
+  uint32_t firstRecord = 0;
+  if (partialBuffer) {
+    firstRecord = (processCounter % buffersPerRoundRobin) * recordsPerBuffer;
+  }
+
+  // count runs of records that share a histogram: the whole buffer, or the
+  // waveforms of one segment
+  uint32_t r = 0;
+  uint32_t nr = validRecords();
+  while (r < nr) {
+    uint32_t k = 0;
+    uint32_t run = nr - r;
+    if (histogramPerSegment) {
+      k = ((firstRecord + r) / nj) % nk;
+      run = std::min(run, nj - (firstRecord + r) % nj);
     }
-  } else {
-    float *pCh1 = (float *)(ch1 + bufferLen * partialIndex / 2);
-    float *pCh2 = (float *)(ch2 + bufferLen * partialIndex / 2);
 
-    for (uint32_t i = 0; i < bufferLen / 2; i++) {
-      pCh1[i] = counts2Volts * (buff[2 * i] - 128) - channelOffset;
-      pCh2[i] = counts2Volts * (buff[2 * i + 1] - 128) - channelOffset;
+    // the records of a channel are contiguous unless interleaved
+    if (interleavedSamples) {
+      histogramKernel(recordStart(buff, r, 0), run * ni, tablesA, tablesB);
+    } else {
+      for (uint32_t ch = 0; ch < MAX_NUM_CHANNELS; ch++) {
+        if (channelEnabled(ch)) {
+          histogramKernelSingle(recordStart(buff, r, ch), run * ni,
+                                ch == 0 ? tablesA : tablesB);
+        }
+      }
     }
+    histogramFlush(tablesA, histCh1.data() + k * HISTOGRAM_BINS);
+    histogramFlush(tablesB, histCh2.data() + k * HISTOGRAM_BINS);
+    r += run;
   }
 
-  if (partialIndex == buffersPerRoundRobin - 1) {
-    return 1;
-  } else {
+  if (processCounter != nbrBuffers - 1) {
     return 0;
   }
+
+  for (uint32_t i = 0; i < samplesPerAcquisition; i++) {
+    if (channelEnabled(0)) {
+      ch1[i] = static_cast<float>(histCh1[i]);
+    }
+    if (channelEnabled(1)) {
+      ch2[i] = static_cast<float>(histCh2[i]);
+    }
+  }
+  return 1;
 }
 
 void AlazarATS9870::printError(RETURN_CODE code, std::string file,
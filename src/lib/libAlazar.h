@@ -20,25 +20,73 @@ limitations under the License.
 
 #include <array>
 #include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <stdint.h>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "AlazarApi.h"
 #include "AlazarCmd.h"
 #include "AlazarError.h"
 #include "alazarBuff.h"
+#include "alazarKernels.h"
 #include "libAlazarAPI.h"
 
 #define MAX_NUM_BUFFERS 32
 #define MIN_NUM_BUFFERS 2
+#define BUFFER_ALIGNMENT 4096 // start of each DMA buffer, a page
 #define MAX_BUFFER_SIZE 256000000 // 256M
 #define PREF_BUFFER_SIZE 4000000 // 4M (suggestion from Alazar manual for DMA transfers)
+// buffer sizes tried by tune_buffer_plan, and the bytes processed for each
+#define TUNE_MIN_BUFFER_SIZE 0x40000   // 256K
+#define TUNE_MAX_BUFFER_SIZE 0x4000000 // 64M
+#define TUNE_BYTES 0x1000000           // 16M
+#define TUNE_REPEATS 3                // timing passes, the fastest is kept
 #define SOCKET_TX_MAX 219264
+#define SEND_POLL_MS 10 // checks for stop while a client is not reading
+#define MAX_NUM_CHANNELS 2
+#define AVERAGER_TILE 2048 // output samples per channel summed at a time
+#define STREAM_THRESHOLD 8000000 // 8M, digitizer output bytes streamed past the cache
+#define CONTINUOUS_NUM_BUFFERS 16 // DMA buffers recycled in continuous mode
+#define OUTPUT_NUM_BUFFERS 2 // socket outputs processed ahead of the sender
+#define CONTINUOUS_RECORDS 0x7fffffff // records per acquisition, until aborted
+
+// processing applied to the DMA buffers before they are handed to the
+// application
+enum AcquireMode {
+  DIGITIZER_MODE,
+  AVERAGER_MODE,
+  CORRELATOR_MODE,
+  EVENTS_MODE,
+  HISTOGRAM_MODE,
+};
+
+// arrangement of the two channels in the DMA buffers: sample by sample, or
+// all the records of channel A followed by all the records of channel B
+enum DmaLayout {
+  INTERLEAVED_LAYOUT,
+  BLOCKED_LAYOUT,
+};
+
+// representation of the digitizer and averager outputs, in the order of the
+// format numbers of OutputHeader_t
+enum OutputFormat {
+  FLOAT32_OUTPUT,
+  FLOAT16_OUTPUT,
+  INT16_OUTPUT,
+  INT8_OUTPUT,
+  INT32_OUTPUT,
+};
+
+#define HISTOGRAM_BINS 256
+#define HISTOGRAM_TABLES 4
+
 
 
 uint32_t systemCount();
@@ -46,82 +94,335 @@ uint32_t boardCount(uint32_t systemId);
 std::string boardInfo(uint32_t systemId, uint32_t boardId);
 
 
+// A ConfigData_t together with copies of its strings and arrays, so it can
+// outlive the structure of the application
+class StoredConfig {
+public:
+  StoredConfig() : config() {}
+  explicit StoredConfig(const ConfigData_t &other) { assign(other); }
+  StoredConfig(const StoredConfig &other) { assign(other.config); }
+  StoredConfig &operator=(const StoredConfig &other) {
+    if (this != &other) {
+      assign(other.config);
+    }
+    return *this;
+  }
+  const ConfigData_t &data() const { return config; }
+
+private:
+  void assign(const ConfigData_t &other);
+  ConfigData_t config;
+  std::vector<std::string> strings;
+  std::vector<uint32_t> roiStart;
+  std::vector<uint32_t> roiLength;
+  std::vector<uint32_t> roiSegments;
+};
+
 class AlazarATS9870 {
 
 public:
-  const uint32_t numChannels = 2;
+  // channels captured by the board; with both the samples are interleaved in
+  // the DMA buffers, a single channel fills them on its own
+  uint32_t numChannels = 2;
+  uint32_t channelSelect = CHANNEL_A | CHANNEL_B;
+  bool channelEnabled(uint32_t ch) const {
+    return channelSelect & (ch == 0 ? CHANNEL_A : CHANNEL_B);
+  }
+
+  DmaLayout dmaLayout = INTERLEAVED_LAYOUT;
+
+  // true when the samples of a channel are two bytes apart in the buffers,
+  // otherwise every record of a channel is contiguous
+  bool interleavedSamples = true;
+
+  // first sample of record r of channel ch in a DMA buffer
+  const uint8_t *recordStart(const uint8_t *buff, uint32_t r,
+                             uint32_t ch) const {
+    if (interleavedSamples) {
+      return buff + 2 * r * recordLength + ch;
+    } else if (numChannels == 2) {
+      return buff + (ch * recordsPerBuffer + r) * recordLength;
+    }
+    return buff + r * recordLength;
+  }
 
   std::atomic<bool> threadStop;
   std::atomic<bool> threadRunning;
 
-  // These ptr queues are used to manage the DMA buffer pointers passed to the
-  // alazar dll.
-  // The library uses the bufferQ ptr to retreive data from the alazar in the
-  // receive thread.  When the data is ready the lib places the ptr into the
-  // dataQ.  The wait_for_acquisition API call polls the dataQ, and then
-  // processes
-  // the data into the application supplied buffers.
-  // The ownerQ is used to maintain a copy of the shared ptr beacuse a ptr
-  // can be popped off the bufferQ in the receive thread and go out of
-  // scope resulting in the allocated buffer memory being freed too soon.
-  AlazarBufferQ<std::shared_ptr<std::vector<uint8_t>>> bufferQ;
-  AlazarBufferQ<std::shared_ptr<std::vector<uint8_t>>> dataQ;
-  AlazarBufferQ<std::shared_ptr<std::vector<uint8_t>>> ownerQ;
+  // The DMA buffers are described by a fixed array of descriptors and the
+  // stages pass their indices through two rings.  The receive thread takes
+  // the posted buffers from bufferQ as the board fills them and places them
+  // on dataQ.  The wait_for_acquisition API call polls the dataQ, processes
+  // the data into the application supplied buffers and posts the buffer
+  // again.  The memory of the buffers is one aligned block, kept between
+  // acquisitions of the same buffer size.
+  std::array<BufferDescriptor, MAX_NUM_BUFFERS> descriptors;
+  AlazarIndexRing<MAX_NUM_BUFFERS> bufferQ;
+  AlazarIndexRing<MAX_NUM_BUFFERS> dataQ;
+  std::vector<uint8_t> bufferMemory;
+  uint32_t nbrDescriptors = 0;
 
   std::atomic<int32_t> bufferCounter;
 
+  // continuous mode runs until stop; the buffers handed to the application
+  // are numbered in order of arrival, counting the dropped ones, so the
+  // application sees the gaps
+  bool continuous = false;
+  std::atomic<uint64_t> buffersReceived;
+  std::atomic<uint64_t> acquisitionsDelivered;
+  std::atomic<uint64_t> lastSequence;
+  std::atomic<bool> boardOverflow;
+  bool popData(uint32_t &index, bool deliver = true);
+  void streamStatus(StreamStatus_t &status);
+  void bufferPlan(BufferPlan_t &plan);
+
   // socket for sending data back to a listening client
   int32_t sockets[2] = {-1, -1};
 
-  static std::map<RETURN_CODE, std::string> errorMap;
+  // numbering of the socket frames, restarted by each acquire
+  uint64_t frameSequence[2] = {0, 0};
+  uint64_t acquisitionCounter = 0;
+  std::atomic<uint64_t> droppedAcquisitions;
 
-  // this working buffer is used for the partial buffer logic when a round
-  // robin is distributed over multiple buffers
+  static std::map<RETURN_CODE, std::string> errorMap;
 
+  // these working buffers hold the processed data before it is packed for
+  // wait_for_packed_acquisition
   std::vector<float> ch1WorkBuff;
   std::vector<float> ch2WorkBuff;
 
-  bool averager;
+  // The output of an acquisition for the sockets.  The receive thread
+  // processes into the slots in turn and the sender thread sends them in
+  // the same order, so processing the next acquisition overlaps sending the
+  // last.  With every slot waiting to be sent the receive thread waits for
+  // the sender.
+  struct OutputSlot {
+    std::vector<float> work[MAX_NUM_CHANNELS];
+    // the packed samples or the event messages, when they are sent
+    std::vector<char> pack[MAX_NUM_CHANNELS];
+    const char *data[MAX_NUM_CHANNELS];
+    FrameHeader_t frame;
+  };
+  std::array<OutputSlot, OUTPUT_NUM_BUFFERS> outputSlots;
+
+  AcquireMode acquireMode;
 
   uint32_t bufferLen;
   bool partialBuffer;
   uint32_t roundRobinsPerBuffer;
   uint32_t buffersPerRoundRobin;
+  // records dropped at the end of the final buffer, see padBuffers
+  uint32_t paddingRecords = 0;
   float counts2Volts;
   float channelOffset;
 
+  // volts for each raw code and the processing kernels chosen for this CPU
+  ConvertTable convertTable;
+  const ProcessingKernels *kernels = nullptr;
+  RecordKernels records;
+  RecordKernels anyLengthRecords;
+  // digitizer output written with non-temporal stores
+  bool streamOutput = false;
+
   uint32_t recordLength;
   uint32_t nbrSegments;
   uint32_t nbrWaveforms;
   uint32_t nbrRoundRobins;
   uint32_t nbrBuffers;
+  uint32_t nbrCorrelationLags;
+  uint32_t eventWindow;
+  uint32_t downsampleFactor;
+
+  // sample windows, as (start, length), and segments processed by the
+  // digitizer and averager; roiSegmentIndex maps a segment to its position
+  // in the output or -1 when it is skipped
+  std::vector<std::pair<uint32_t, uint32_t>> roiWindows;
+  std::vector<int32_t> roiSegmentIndex;
+  uint32_t nbrRoiSegments;
+
+  // samples per record delivered after the windows and downsampling
+  uint32_t outputLength;
+
+  // outputs other than float32 are processed into the work buffers and then
+  // packed into the application buffers, or into the pack buffers for the
+  // sockets; int32 sums the counts and leaves the average undivided
+  OutputFormat outputFormat = FLOAT32_OUTPUT;
+  OutputHeader_t outputHeader;
+  float packGain;
+  float packOffset;
+  uint32_t outputSampleSize() const;
+  uint32_t outputShape(uint32_t shape[4]) const;
+  void packOutput(const float *ch1, const float *ch2, void *out1, void *out2);
+
+  // output samples the averager sums over all the records before moving on,
+  // the whole record unless the accumulators of a segment outgrow the L2
+  // cache
+  uint32_t averagerTile = AVERAGER_TILE;
+
+  // events found in the last buffer processed in events mode
+  std::vector<EventInfo_t> eventList;
+
+  // raw code histograms accumulated over the whole acquisition
+  bool histogramPerSegment;
+  std::vector<uint64_t> histCh1;
+  std::vector<uint64_t> histCh2;
 
   uint32_t samplesPerAcquisition;
 
+  // processing of one buffer, chosen by ConfigureBoard for the mode
+  int32_t (AlazarATS9870::*processKernel)(const uint8_t *, float *,
+                                          float *) = nullptr;
+
+  // number of buffers processed since the acquisition started; the partial
+  // buffer logic uses it to locate a buffer within its round robin
+  uint32_t processCounter;
+  // records of the buffer being processed that belong to the acquisition,
+  // all but the padding of the final buffer
+  uint32_t validRecords() const {
+    return paddingRecords > 0 && processCounter % nbrBuffers == nbrBuffers - 1
+               ? recordsPerBuffer - paddingRecords
+               : recordsPerBuffer;
+  }
+
   AlazarATS9870();
   ~AlazarATS9870();
   int32_t sysInfo(void);
   int32_t rxThreadRun(void);
   void rxThreadStop(void);
+  void startWorker(void);
+  void stopWorker(void);
+  // the next configuration writes every board setting
+  void forgetSettings(void) { appliedSettings.clear(); }
+
+  // a buffer plan as getBufferSize works it out
+  struct StoredPlan {
+    uint32_t bufferLen;
+    bool partialBuffer;
+    uint32_t roundRobinsPerBuffer;
+    uint32_t buffersPerRoundRobin;
+    uint32_t nbrBuffers;
+    uint32_t recordsPerBuffer;
+    uint32_t recordsPerAcquisition;
+    uint32_t paddingRecords;
+  };
+
+  // a board setting: the name it is kept under in appliedSettings, the SDK
+  // call that writes it and the values it is written with
+  struct BoardSetting {
+    const char *name;
+    RETURN_CODE (*write)(HANDLE, const std::vector<uint32_t> &);
+    std::vector<uint32_t> values;
+  };
 
-  int32_t postBuffer(std::shared_ptr<std::vector<uint8_t>>);
+  // The configurations of compile_config, by handle: the state ConfigureBoard
+  // derived from each, with its board settings and acquisition parameters,
+  // which apply_config restores without checking the configuration again
+  struct CompiledConfig {
+    AcquisitionParams_t acqParams;
+    std::vector<BoardSetting> settings;
+    AcquireMode acquireMode;
+    uint32_t channelSelect;
+    uint32_t numChannels;
+    DmaLayout dmaLayout;
+    bool interleavedSamples;
+    float channelScale;
+    float channelOffset;
+    float counts2Volts;
+    ConvertTable convertTable;
+    const ProcessingKernels *kernels;
+    RecordKernels records;
+    RecordKernels anyLengthRecords;
+    bool streamOutput;
+    uint32_t recordLength;
+    uint32_t nbrSegments;
+    uint32_t nbrWaveforms;
+    uint32_t nbrRoundRobins;
+    uint32_t nbrCorrelationLags;
+    uint32_t eventWindow;
+    uint32_t downsampleFactor;
+    std::vector<std::pair<uint32_t, uint32_t>> roiWindows;
+    std::vector<int32_t> roiSegmentIndex;
+    uint32_t nbrRoiSegments;
+    uint32_t outputLength;
+    uint32_t averagerTile;
+    int32_t eventHigh[2];
+    int32_t eventLow[2];
+    uint32_t targetBufferSize;
+    uint32_t bufferCount;
+    bool padBuffers;
+    StoredPlan plan;
+    bool continuous;
+    uint32_t postedBuffers;
+    OutputFormat outputFormat;
+    OutputHeader_t outputHeader;
+    float packGain;
+    float packOffset;
+    bool histogramPerSegment;
+    uint32_t samplesPerAcquisition;
+    int32_t (AlazarATS9870::*processKernel)(const uint8_t *, float *, float *);
+  };
+  std::vector<CompiledConfig> compiledConfigs;
+  void compileConfig(CompiledConfig &compiled,
+                     const AcquisitionParams_t &acqParams) const;
+  int32_t applyConfig(const CompiledConfig &compiled);
+
+  // the steps of queue_acquisitions and the one being acquired; the
+  // application holds processMutex while it takes and processes a buffer,
+  // so the next step is only configured once it is done with the last one
+  std::vector<StoredConfig> sequence;
+  std::atomic<uint32_t> sequenceStep;
+  std::atomic<uint32_t> deliveredStep;
+  std::mutex processMutex;
+
+  int32_t postBuffer(uint32_t index);
   void printError(RETURN_CODE code, std::string file, int32_t line);
   int32_t ConfigureBoard(uint32_t systemId, uint32_t boardId,
                          const ConfigData_t &config,
                          AcquisitionParams_t &acqParams);
+  int32_t tuneBufferPlan(uint32_t systemId, uint32_t boardId,
+                         const ConfigData_t &config,
+                         AcquisitionParams_t &acqParams);
 
-  int32_t processBuffer(std::shared_ptr<std::vector<uint8_t>> buff,
-                        float *ch1, float *ch2);
-  int32_t processCompleteBuffer(std::shared_ptr<std::vector<uint8_t>> buff,
-                                float *ch1, float *ch2);
-  int32_t processPartialBuffer(std::shared_ptr<std::vector<uint8_t>> buff,
-                               float *ch1, float *ch2);
+  void convertRecord(const uint8_t *buff, uint32_t r, bool accumulate,
+                     float *ch1, float *ch2);
+  void convertRecord(const uint8_t *buff, uint32_t r, bool accumulate,
+                     float *ch1, float *ch2, uint32_t first, uint32_t count);
+  void clearOutput(float *ch1, float *ch2, uint32_t size);
+  void divideOutput(float *ch1, float *ch2, uint32_t size, float denom);
+  int32_t processBuffer(const uint8_t *buff, float *ch1, float *ch2);
+  template <bool averager>
+  int32_t processCompleteBuffer(const uint8_t *buff, float *ch1, float *ch2);
+  template <bool averager>
+  int32_t processPartialBuffer(const uint8_t *buff, float *ch1, float *ch2);
+  int32_t processCorrelation(const uint8_t *buff, float *ch1, float *ch2);
+  int32_t processEvents(const uint8_t *buff, float *ch1, float *ch2);
+  int32_t processHistogram(const uint8_t *buff, float *ch1, float *ch2);
   int32_t force_trigger( void );
 
 protected:
   ConfigData_t config;
   std::thread rxThread;
-  HANDLE boardHandle;
+  HANDLE boardHandle = NULL;
+
+  // The board settings last applied, by name, with the values they were
+  // applied with; ConfigureBoard skips the unchanged ones
+  std::map<std::string, std::vector<uint32_t>> appliedSettings;
+  bool settingChanged(const char *name, const std::vector<uint32_t> &values);
+  void settingApplied(const char *name, const std::vector<uint32_t> &values);
+  // the settings of the configuration ConfigureBoard last checked, written
+  // once all of it is known to be valid
+  std::vector<BoardSetting> boardSettings;
+  int32_t writeSettings(const std::vector<BoardSetting> &settings);
+  void allocateWork(void);
+
+  // the buffer plans worked out by getBufferSize, by acquisition geometry,
+  // so configurations seen before are not planned again
+  std::map<std::vector<uint32_t>, StoredPlan> bufferPlans;
+
+  // the host and geometry a tuned buffer plan is stored under, and the
+  // processing time per record of the current plan
+  std::string tuningKey(const ConfigData_t &config) const;
+  double timeProcessing(uint32_t samplesPerAcquisition);
 
   int32_t DisplaySystemInfo(uint32_t);
   int32_t DisplayBoardInfo(uint32_t systemId, uint32_t boardId);
@@ -129,8 +430,33 @@ protected:
   int32_t FlashLed(HANDLE handle, int32_t cycleCount, uint32_t cyclePeriod_ms);
 
   std::string BoardTypeToText(int boardType);
-  int32_t rx(int32_t *ready);
+  int32_t rx(void);
+  void worker(void);
+  int32_t arm(bool restart);
+  bool nextStep(void);
+  // the board given to ConfigureBoard, for the steps of a sequence
+  uint32_t configuredSystem = 0;
+  uint32_t configuredBoard = 0;
+
+  // The receive thread is started once and runs rx for every acquisition:
+  // rxThreadRun arms it and waits for it to take the acquisition, stop
+  // waits for it to be idle again
+  std::mutex workerMutex;
+  std::condition_variable workerCond;
+  bool workerArmed = false;
+  bool workerExit = false;
+  std::atomic<bool> acquiring;
+  FrameHeader_t frameHeader(uint64_t timestamp) const;
+  int32_t sendFrames(const char *ch1Data, const char *ch2Data,
+                     FrameHeader_t &frame);
+  void packEvents(OutputSlot &slot, uint32_t nbrEvents, uint64_t timestamp);
+  void prepareOutputs(void);
+  int32_t queueOutput(void);
+  int32_t drainOutputs(void);
+  void sender(void);
   int32_t getBufferSize(void);
+  int32_t setRegionsOfInterest(const ConfigData_t &config);
+  int32_t setOutputFormat(const ConfigData_t &config);
 
   // map mV input scale to RangeId
   float channelScale;
@@ -155,19 +481,74 @@ protected:
       {"A", 0}, {"B", 1}, {"Ext", 2},
   };
 
+  std::map<std::string, uint32_t> channelsMap = {
+      {"AB", CHANNEL_A | CHANNEL_B}, {"A", CHANNEL_A}, {"B", CHANNEL_B},
+  };
+
+  std::map<std::string, DmaLayout> dmaLayoutMap = {
+      {"interleaved", INTERLEAVED_LAYOUT}, {"blocked", BLOCKED_LAYOUT},
+  };
+
+  std::map<std::string, OutputFormat> outputFormatMap = {
+      {"float32", FLOAT32_OUTPUT}, {"float16", FLOAT16_OUTPUT},
+      {"int16", INT16_OUTPUT},     {"int8", INT8_OUTPUT},
+      {"int32", INT32_OUTPUT},
+  };
+
   std::map<std::string, uint32_t> triggerSlopeMap = {
       {"rising", 1}, {"falling", 2},
   };
 
   uint32_t bufferSize;
+  // the bufferSize, bufferCount and padBuffers of the configuration
+  uint32_t targetBufferSize = 0;
+  uint32_t bufferCount = 0;
+  bool padBuffers = false;
+  // DMA buffers posted to the board at a time
+  uint32_t postedBuffers = MIN_NUM_BUFFERS;
   const uint32_t maxOnboardMemory = 0x10000000; // 256MB
 
   uint32_t recordsPerBuffer;
   uint32_t recordsPerAcquisition;
-  size_t  socketbuffsize;
-
-  std::map<std::string, bool> modeMap = {
-      {"digitizer", false}, {"averager", true},
+  size_t  socketbuffsize = 0;
+
+  // integer accumulators for the correlator; the products and the channel
+  // sums are kept in counts so the offset can be applied once per acquisition
+  std::vector<int64_t> corrSumAB;
+  std::vector<int64_t> corrSumBA;
+  std::vector<int64_t> corrSumA;
+  std::vector<int64_t> corrSumB;
+  // the signed counts of the record being correlated, per channel
+  std::vector<int32_t> corrRecordA;
+  std::vector<int32_t> corrRecordB;
+
+  // a sample is part of an event when its count is at or above eventHigh, or
+  // at or below eventLow, of its channel
+  int32_t eventHigh[2];
+  int32_t eventLow[2];
+
+  // per channel histogram sub-tables, see processHistogram
+  std::vector<uint32_t> histTables;
+
+  // the sender thread and the count of the outputs queued and sent, which
+  // locate the slots being processed and sent
+  std::thread senderThread;
+  std::mutex senderMutex;
+  std::condition_variable senderCond;
+  uint64_t outputsQueued = 0;
+  uint64_t outputsSent = 0;
+  bool senderExit = false;
+  bool senderFailed = false;
+
+  // dataQ pops and the delivery counters they update go together
+  std::mutex dataMutex;
+
+  std::map<std::string, AcquireMode> modeMap = {
+      {"digitizer", DIGITIZER_MODE},
+      {"averager", AVERAGER_MODE},
+      {"correlator", CORRELATOR_MODE},
+      {"events", EVENTS_MODE},
+      {"histogram", HISTOGRAM_MODE},
   };
 };
 
@@ -15,6 +15,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -84,6 +85,12 @@ int32_t connectBoard(uint32_t boardId, const char *logFile) {
   if (boardId > 0 && boardId <= MAX_NUM_BOARDS) {
     AlazarATS9870 &board = boards[boardId - 1];
     board.sysInfo();
+    // pick the processing kernels for this CPU before the first acquisition
+    board.kernels = &selectKernels();
+    // the board may have been changed by others since the last connection
+    board.forgetSettings();
+    // the receive thread serves every acquisition until disconnect
+    board.startWorker();
   } else {
     LOG(plog::error) << "Invalid board address " << boardId;
     return (-1);
@@ -104,11 +111,99 @@ int32_t setAll(uint32_t boardId, const ConfigData_t *config,
   const ConfigData_t &confRef = static_cast<const ConfigData_t &>(*config);
   AcquisitionParams_t &acqRef = static_cast<AcquisitionParams_t &>(*acqParams);
 
+  // a configuration of its own replaces a queued sequence
+  board.sequence.clear();
   int32_t ret = board.ConfigureBoard(1, boardId, confRef, acqRef);
 
   return ret;
 }
 
+int32_t compile_config(uint32_t boardId, const ConfigData_t *config,
+                       AcquisitionParams_t *acqParams, uint32_t *handle) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (config == nullptr || acqParams == nullptr || handle == nullptr) {
+    LOG(plog::error) << "COULD NOT COMPILE CONFIGURATION ";
+    return (-1);
+  }
+
+  if (board.threadRunning) {
+    LOG(plog::error) << "Cannot compile a configuration while acquiring";
+    return -1;
+  }
+
+  board.sequence.clear();
+  if (board.ConfigureBoard(1, boardId, *config, *acqParams) < 0) {
+    return -1;
+  }
+  *handle = static_cast<uint32_t>(board.compiledConfigs.size());
+  board.compiledConfigs.emplace_back();
+  board.compileConfig(board.compiledConfigs.back(), *acqParams);
+
+  return 0;
+}
+
+int32_t apply_config(uint32_t boardId, uint32_t handle,
+                     AcquisitionParams_t *acqParams) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (handle >= board.compiledConfigs.size()) {
+    LOG(plog::error) << "Invalid configuration handle " << handle;
+    return -1;
+  }
+
+  if (board.threadRunning) {
+    LOG(plog::error) << "Cannot apply a configuration while acquiring";
+    return -1;
+  }
+
+  const AlazarATS9870::CompiledConfig &compiled =
+      board.compiledConfigs[handle];
+  board.sequence.clear();
+  if (board.applyConfig(compiled) < 0) {
+    return -1;
+  }
+  if (acqParams != nullptr) {
+    *acqParams = compiled.acqParams;
+  }
+
+  return 0;
+}
+
+int32_t queue_acquisitions(uint32_t boardId, const ConfigData_t *configs,
+                           uint32_t nbrConfigs,
+                           AcquisitionParams_t *acqParams) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (board.threadRunning) {
+    LOG(plog::error) << "Cannot queue acquisitions while acquiring";
+    return -1;
+  }
+
+  if (nbrConfigs > 0 && (configs == nullptr || acqParams == nullptr)) {
+    LOG(plog::error) << "COULD NOT QUEUE ACQUISITIONS ";
+    return (-1);
+  }
+
+  // every step is checked, and its parameters found, up front
+  board.sequence.clear();
+  std::vector<StoredConfig> sequence;
+  for (uint32_t n = 0; n < nbrConfigs; n++) {
+    if (configs[n].continuous) {
+      LOG(plog::error) << "Continuous acquisitions cannot be queued";
+      return -1;
+    }
+    if (board.ConfigureBoard(1, boardId, configs[n], acqParams[n]) < 0) {
+      LOG(plog::error) << "Step " << n << " of the sequence is invalid";
+      return -1;
+    }
+    sequence.push_back(StoredConfig(configs[n]));
+  }
+  board.sequence = sequence;
+
+  return 0;
+}
+
 int32_t acquire(uint32_t boardId) {
   AlazarATS9870 &board = boards[boardId - 1];
   int32_t ret = 0;
@@ -125,48 +220,225 @@ int32_t acquire(uint32_t boardId) {
 // returns 0 (no new data) or 1 (new data)
 int32_t wait_for_acquisition(uint32_t boardId, float *ch1, float *ch2) {
   AlazarATS9870 &board = boards[boardId - 1];
+  // the next step of a sequence reconfigures the board under processMutex,
+  // so the checks, the processing and the repost all hold it
+  std::lock_guard<std::mutex> lock(board.processMutex);
 
   if (board.sockets[0] != -1 || board.sockets[1] != -1) {
       LOG(plog::error) << "wait_for_acquisition should not be used with the socket API.";
       return -1;
   }
 
-  if (ch1 == NULL) {
+  // the buffer of a channel that is not captured may be NULL
+  if (ch1 == NULL && board.channelEnabled(0)) {
     LOG(plog::error) << "NULL Pointer to Ch1";
     return (-1);
   }
 
-  if (ch2 == NULL) {
+  if (ch2 == NULL && board.channelEnabled(1)) {
     LOG(plog::error) << "NULL Pointer to Ch2";
     return (-1);
   }
 
-  // wait for a buffer to be ready
-  shared_ptr<std::vector<uint8_t>> buff;
-  if (!board.dataQ.pop(buff)) {
+  if (board.acquireMode == EVENTS_MODE) {
+    LOG(plog::error) << "wait_for_events should be used in events mode.";
+    return -1;
+  }
+
+  if (board.outputFormat != FLOAT32_OUTPUT) {
+    LOG(plog::error) << "wait_for_packed_acquisition should be used with "
+                        "output formats other than float32.";
+    return -1;
+  }
+
+  uint32_t index;
+  if (!board.popData(index)) {
     return 0;
   }
+  const uint8_t *buff = board.descriptors[index].data;
 
-  LOG(plog::verbose) << "API POPPING DATA " << std::hex
-                      << (uint64_t)(buff.get());
+  LOG(plog::verbose) << "API POPPING DATA " << index;
 
   // if there are multiple buffers per roundrobin the partial index logic
   // is used to process the data from the individual buffers into one
   // application channel buffer
   int32_t ret = board.processBuffer(buff, ch1, ch2);
 
-  if (board.postBuffer(buff) >= 0) {
-    LOG(plog::verbose) << "API POSTED BUFFER " << std::hex
-                        << (uint64_t)(buff.get());
+  if (board.postBuffer(index) >= 0) {
+    LOG(plog::verbose) << "API POSTED BUFFER " << index;
   } else {
-    LOG(plog::error) << "COULD NOT POST API BUFFER " << std::hex
-                       << (uint64_t)(buff.get());
+    LOG(plog::error) << "COULD NOT POST API BUFFER " << index;
     return (-1);
   }
 
   return ret;
 }
 
+// returns 0 (no new data) or 1 (new data) in the output format, with the
+// header describing how the values map to volts
+int32_t wait_for_packed_acquisition(uint32_t boardId, void *ch1, void *ch2,
+                                    OutputHeader_t *header) {
+  AlazarATS9870 &board = boards[boardId - 1];
+  // checked and processed under one lock, as in wait_for_acquisition
+  std::lock_guard<std::mutex> lock(board.processMutex);
+
+  if (board.sockets[0] != -1 || board.sockets[1] != -1) {
+      LOG(plog::error) << "wait_for_packed_acquisition should not be used with the socket API.";
+      return -1;
+  }
+
+  if ((ch1 == NULL && board.channelEnabled(0)) ||
+      (ch2 == NULL && board.channelEnabled(1)) || header == NULL) {
+    LOG(plog::error) << "NULL Pointer to packed data";
+    return (-1);
+  }
+
+  if (board.acquireMode == EVENTS_MODE) {
+    LOG(plog::error) << "wait_for_events should be used in events mode.";
+    return -1;
+  }
+
+  uint32_t index;
+  if (!board.popData(index)) {
+    return 0;
+  }
+  const uint8_t *buff = board.descriptors[index].data;
+
+  // float32 goes straight to the application buffers, the other formats
+  // are packed from the work buffers once the acquisition is complete
+  int32_t ret;
+  if (board.outputFormat == FLOAT32_OUTPUT) {
+    ret = board.processBuffer(buff, static_cast<float *>(ch1),
+                              static_cast<float *>(ch2));
+  } else {
+    float *work1 = board.channelEnabled(0) ? board.ch1WorkBuff.data() : NULL;
+    float *work2 = board.channelEnabled(1) ? board.ch2WorkBuff.data() : NULL;
+    ret = board.processBuffer(buff, work1, work2);
+    if (ret > 0) {
+      board.packOutput(work1, work2, ch1, ch2);
+    }
+  }
+  *header = board.outputHeader;
+
+  if (board.postBuffer(index) < 0) {
+    LOG(plog::error) << "COULD NOT POST API BUFFER " << index;
+    return (-1);
+  }
+
+  return ret;
+}
+
+// returns 0 (no new data) or 1 (new data), with the number of events found
+// in the buffer written to nbrEvents
+int32_t wait_for_events(uint32_t boardId, float *ch1, float *ch2,
+                        EventInfo_t *events, uint32_t *nbrEvents) {
+  AlazarATS9870 &board = boards[boardId - 1];
+  // checked and processed under one lock, as in wait_for_acquisition
+  std::lock_guard<std::mutex> lock(board.processMutex);
+
+  if (board.sockets[0] != -1 || board.sockets[1] != -1) {
+      LOG(plog::error) << "wait_for_events should not be used with the socket API.";
+      return -1;
+  }
+
+  if (board.acquireMode != EVENTS_MODE) {
+    LOG(plog::error) << "wait_for_events requires events mode.";
+    return -1;
+  }
+
+  if ((ch1 == NULL && board.channelEnabled(0)) ||
+      (ch2 == NULL && board.channelEnabled(1)) || events == NULL ||
+      nbrEvents == NULL) {
+    LOG(plog::error) << "NULL Pointer to event data";
+    return (-1);
+  }
+
+  uint32_t index;
+  if (!board.popData(index)) {
+    return 0;
+  }
+  const uint8_t *buff = board.descriptors[index].data;
+
+  int32_t ret = board.processBuffer(buff, ch1, ch2);
+  std::copy(board.eventList.begin(), board.eventList.begin() + ret, events);
+  *nbrEvents = ret;
+
+  if (board.postBuffer(index) < 0) {
+    LOG(plog::error) << "COULD NOT POST API BUFFER " << index;
+    return (-1);
+  }
+
+  return 1;
+}
+
+// copies the exact counts of the histograms accumulated so far
+int32_t get_histogram(uint32_t boardId, uint64_t *ch1, uint64_t *ch2) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (board.acquireMode != HISTOGRAM_MODE) {
+    LOG(plog::error) << "get_histogram requires histogram mode.";
+    return -1;
+  }
+
+  if ((ch1 == NULL && board.channelEnabled(0)) ||
+      (ch2 == NULL && board.channelEnabled(1))) {
+    LOG(plog::error) << "NULL Pointer to histogram data";
+    return (-1);
+  }
+
+  if (board.channelEnabled(0)) {
+    std::copy(board.histCh1.begin(), board.histCh1.end(), ch1);
+  }
+  if (board.channelEnabled(1)) {
+    std::copy(board.histCh2.begin(), board.histCh2.end(), ch2);
+  }
+
+  return 0;
+}
+
+// counters of the acquisition, for continuous mode in particular
+int32_t get_stream_status(uint32_t boardId, StreamStatus_t *status) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (status == NULL) {
+    LOG(plog::error) << "NULL Pointer to stream status";
+    return -1;
+  }
+
+  board.streamStatus(*status);
+  return 0;
+}
+
+int32_t tune_buffer_plan(uint32_t boardId, const ConfigData_t *config,
+                         AcquisitionParams_t *acqParams) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (config == nullptr || acqParams == nullptr) {
+    LOG(plog::error) << "COULD NOT TUNE CONFIGURATION ";
+    return (-1);
+  }
+
+  if (board.threadRunning) {
+    LOG(plog::error) << "Cannot tune the buffer plan while acquiring";
+    return -1;
+  }
+
+  board.sequence.clear();
+  return board.tuneBufferPlan(1, boardId, *config, *acqParams);
+}
+
+int32_t get_buffer_plan(uint32_t boardId, BufferPlan_t *plan) {
+  AlazarATS9870 &board = boards[boardId - 1];
+
+  if (plan == NULL) {
+    LOG(plog::error) << "NULL Pointer to buffer plan";
+    return -1;
+  }
+
+  board.bufferPlan(*plan);
+  return 0;
+}
+
 int32_t stop(uint32_t boardId) {
   AlazarATS9870 &board = boards[boardId - 1];
 
@@ -178,9 +450,8 @@ int32_t stop(uint32_t boardId) {
 int32_t disconnect(uint32_t boardId) {
   AlazarATS9870 &board = boards[boardId - 1];
 
-  if (board.threadRunning) {
-    stop(boardId);
-  }
+  board.stopWorker();
+  board.compiledConfigs.clear();
 
   return 0;
 }
@@ -200,7 +471,7 @@ int32_t flashLED(uint32_t boardId)
 
 int32_t register_socket(uint32_t boardId, uint32_t channel, int32_t socket) {
     AlazarATS9870 &board = boards[boardId - 1];
-    if (channel >= board.numChannels) {
+    if (channel >= MAX_NUM_CHANNELS) {
         LOG(plog::error) << "Invalid channel";
         return -1;
     }
@@ -49,13 +49,148 @@ typedef struct ConfigData {
   const char *verticalCoupling;
   double verticalOffset;
   double verticalScale;
+  uint32_t nbrCorrelationLags; // correlator mode only, 0 is treated as 1
+  double eventThresholdCh1; // events mode only, volts, 0 disables the channel
+  double eventThresholdCh2;
+  uint32_t eventWindow; // events mode only, samples, 0 is the whole record
+  bool histogramPerSegment; // histogram mode only
+  uint32_t downsampleFactor; // digitizer and averager modes, 0 is treated as 1
+  // regions of interest for the digitizer and averager modes: the windows of
+  // each record and the segments that are processed, 0 processes them all
+  const uint32_t *roiStart;
+  const uint32_t *roiLength;
+  uint32_t nbrRois;
+  const uint32_t *roiSegments;
+  uint32_t nbrRoiSegments;
+  // "AB", "A" or "B", NULL is "AB"; a single channel is delivered in the
+  // ch1 or ch2 buffer it belongs to and the other one is left alone
+  const char *channels;
+  // "interleaved" or "blocked" DMA buffers when both channels are captured,
+  // NULL is "interleaved"
+  const char *dmaLayout;
+  // digitizer mode: outputs of at least this many bytes per channel are
+  // written with non-temporal stores that bypass the cache, 0 is 8 MB
+  uint32_t streamThreshold;
+  // digitizer and averager modes: "float32", "float16", "int16", "int8" or
+  // "int32", NULL is "float32"; see OutputHeader_t for the other formats
+  const char *outputFormat;
+  // acquire until stop, recycling the DMA buffers; nbrRoundRobins is then
+  // the round robins of each acquisition, which have to fit in one buffer.
+  // Not available in histogram mode.
+  bool continuous;
+  // DMA buffers: the bytes each one aims for, 0 is 4 MB, and how many are
+  // posted to the board at a time, 0 posts as many as the acquisition has;
+  // between 2 and 32 are posted.  The round robins are split evenly into
+  // buffers, which can leave the buffers much smaller than the target.  With
+  // padBuffers the final buffer is topped up with round robins instead,
+  // which are acquired and dropped.
+  uint32_t bufferSize;
+  uint32_t bufferCount;
+  bool padBuffers;
 } ConfigData_t;
 
 typedef struct AcquisitionParams {
   uint32_t samplesPerAcquisition;
-  uint32_t numberAcquisitions;
+  uint32_t numberAcquisitions; // 0 in continuous mode
 } AcquisitionParams_t;
 
+// Progress of the acquisition.  In continuous mode the buffers are numbered
+// as they arrive; when the application falls behind and the board would run
+// out of buffers, the oldest acquisition waiting for the application is
+// dropped so the capture goes on, which shows as a gap in the sequence.
+typedef struct StreamStatus {
+  uint64_t received;  // buffers received from the board since acquire
+  uint64_t delivered; // acquisitions handed to the application
+  uint64_t sequence;  // number of the last acquisition handed over
+  uint64_t dropped;   // acquisitions dropped before they were handed over
+  uint32_t overflow;  // the board ran out of memory and the capture stopped
+  uint32_t running;
+  uint32_t step;      // step of queue_acquisitions of the last acquisition
+                      // handed over
+  uint32_t nbrSteps;  // steps queued, 0 without queue_acquisitions
+} StreamStatus_t;
+
+// The DMA buffers chosen for the configuration.  A buffer holds
+// roundRobinsPerBuffer whole round robins, or 1 / buffersPerRoundRobin of a
+// round robin that does not fit the target size.  The last paddingRecords
+// records of the final buffer are padding and are dropped; the acquisition
+// delivered from that buffer holds the round robins before them, the rest of
+// a digitizer acquisition is zero.
+typedef struct BufferPlan {
+  uint32_t bufferSize;           // bytes of a buffer
+  uint32_t nbrBuffers;           // buffers of an acquire, 1 when continuous
+  uint32_t postedBuffers;        // buffers posted to the board at a time
+  uint32_t recordsPerBuffer;
+  uint32_t roundRobinsPerBuffer; // 0 when a round robin spans buffers
+  uint32_t buffersPerRoundRobin; // 0 when a buffer holds whole round robins
+  uint32_t paddingRecords;
+} BufferPlan_t;
+
+// In events mode each window of eventWindow samples in which either channel
+// crosses its threshold is emitted, together with one of these.  The sample
+// buffers passed to wait_for_events are filled with the windows back to back
+// and can hold at most samplesPerAcquisition / eventWindow of them.
+//
+// On the socket interface the events of each buffer are sent as the payload
+// of FRAME_EVENTS frames: EventInfo_t headers, each followed by the
+// eventWindow float samples of that channel.
+typedef struct EventInfo {
+  uint32_t bufferIndex; // buffer within the acquisition
+  uint32_t recordIndex; // record within the buffer
+  uint32_t sampleIndex; // first sample of the window within the record
+} EventInfo_t;
+
+// Formats other than float32 are delivered by wait_for_packed_acquisition
+// together with this header; the socket frames carry the same fields.  The
+// volts of a value are scale * value / count + offset:
+//   float16 (format 1) half precision volts, scale 1, offset 0
+//   int16   (format 2) counts scaled by 256, keeping the fractions of
+//           downsampled and averaged samples
+//   int8    (format 3) the raw signed counts, digitizer mode without
+//           downsampling only
+//   int32   (format 4) averager mode only, the exact sums of the counts of
+//           the count records averaged; with padBuffers the final
+//           acquisition has fewer of them and its own count
+typedef struct OutputHeader {
+  uint32_t format; // 0 is float32
+  uint32_t count;
+  double scale;
+  double offset;
+} OutputHeader_t;
+// Each registered socket carries the data of its channel as frames: a
+// FrameHeader_t followed by size bytes of payload, at offset within the
+// acquisition.  The frames of an acquisition arrive in order and the last
+// one is flagged FRAME_LAST.  The fields are in the byte order of the host.
+#define FRAME_MAGIC 0x465a4c41 // "ALZF" in little endian memory
+#define FRAME_VERSION 1
+#define FRAME_LAST 0x1   // last frame of the acquisition
+#define FRAME_EVENTS 0x2 // the payload is events, see EventInfo_t
+
+typedef struct FrameHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint32_t headerSize; // bytes of this header, later versions append fields
+  uint32_t channel;    // 0 or 1
+  uint64_t sequence;   // frames sent through this socket since acquire
+  uint64_t acquisition; // acquisitions, or buffers in events mode, since
+                        // acquire
+  uint64_t timestamp;  // ns since the epoch when the data was received
+  uint64_t dropped;    // acquisitions lost before they could be sent
+  uint64_t offset;     // payload bytes of the acquisition in earlier frames
+  uint64_t size;       // payload bytes in this frame
+  uint64_t totalSize;  // payload bytes of the acquisition
+  uint32_t format;     // OutputHeader_t format of the values
+  uint32_t ndim;       // dimensions of the acquisition, outermost first:
+  uint32_t shape[4];   // digitizer: round robins, segments, waveforms,
+                       // samples; averager: segments, samples; correlator:
+                       // lags, segments, samples; histogram: segments,
+                       // bins; events: events, window samples
+  uint32_t count;      // volts of the values as in OutputHeader_t
+  uint32_t step;       // step of queue_acquisitions, otherwise 0
+  double scale;
+  double valueOffset;
+} FrameHeader_t;
 
 APIEXPORT int32_t connectBoard(uint32_t boardID, const char *);
 APIEXPORT int32_t disconnect(uint32_t boardID);
@@ -65,8 +200,47 @@ APIEXPORT int32_t setAll(uint32_t boardId, const ConfigData_t *config,
 APIEXPORT uint32_t boardCount();
 APIEXPORT const char * boardInfo(uint32_t boardID);
 
+// Configurations prepared ahead of time.  compile_config checks the
+// configuration and works out its buffer plan as setAll would, leaving the
+// board configured with it, and returns a handle for it along with its
+// parameters.  apply_config then switches to the configuration, restoring
+// what was worked out for it without checking it again and rewriting only
+// the board settings that differ from the current ones.  The handles are
+// good until disconnect.
+APIEXPORT int32_t compile_config(uint32_t boardID, const ConfigData_t *config,
+                                 AcquisitionParams_t *acqParams,
+                                 uint32_t *handle);
+APIEXPORT int32_t apply_config(uint32_t boardID, uint32_t handle,
+                               AcquisitionParams_t *acqParams);
+
+// The configurations of a sweep, run back to back by acquire: each step is
+// configured and armed as soon as the application has every acquisition of
+// the step before.  The parameters of each step are written to acqParams and
+// the acquisitions are tagged with their step, in the stream status and the
+// socket frames.  setAll, or an empty list, cancels the queue.  Continuous
+// acquisitions cannot be queued.
+APIEXPORT int32_t queue_acquisitions(uint32_t boardID,
+                                     const ConfigData_t *configs,
+                                     uint32_t nbrConfigs,
+                                     AcquisitionParams_t *acqParams);
 APIEXPORT int32_t acquire(uint32_t boardId);
 APIEXPORT int32_t wait_for_acquisition(uint32_t boardID, float *ch1, float *ch2);
+APIEXPORT int32_t wait_for_packed_acquisition(uint32_t boardID, void *ch1,
+                                              void *ch2,
+                                              OutputHeader_t *header);
+APIEXPORT int32_t wait_for_events(uint32_t boardID, float *ch1, float *ch2,
+                                  EventInfo_t *events, uint32_t *nbrEvents);
+APIEXPORT int32_t get_histogram(uint32_t boardID, uint64_t *ch1, uint64_t *ch2);
+APIEXPORT int32_t get_stream_status(uint32_t boardID, StreamStatus_t *status);
+APIEXPORT int32_t get_buffer_plan(uint32_t boardID, BufferPlan_t *plan);
+// Time the processing of the configuration on this host with a range of
+// buffer sizes, on generated buffers, and keep the fastest in a file named
+// by the ALAZAR_PLAN_CACHE environment variable, by default
+// libalazar_plans.txt.  Configurations of the same geometry that leave
+// bufferSize at 0 take it from there; the buffer count is not tuned.  The
+// board is then configured as with setAll, nothing is acquired.
+APIEXPORT int32_t tune_buffer_plan(uint32_t boardID, const ConfigData_t *config,
+                                   AcquisitionParams_t *acqParams);
 APIEXPORT int32_t stop(uint32_t boardID);
 APIEXPORT int32_t flash_led(int32_t numTimes, float period);
 APIEXPORT int32_t force_trigger( uint32_t boardID );
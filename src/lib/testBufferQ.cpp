@@ -1,45 +1,95 @@
-#include <array>
-#include <chrono>
-#include <cstring>
-#include <iostream>
-#include <string>
+#include <atomic>
 #include <thread>
+#include <vector>
 
 #include "alazarBuff.h"
 #include "catch.hpp"
 
-AlazarBufferQ<std::shared_ptr<std::vector<uint8_t>>> q;
+AlazarIndexRing<8> ring;
 
-#define TEST_BUFFER_SIZE 256
-#define TEST_Q_SIZE 32
+void ringPusher(void) {
+  for (uint32_t i = 0; i < 1000; i++) {
+    while (!ring.push(i))
+      std::this_thread::yield();
+  }
+}
 
-void pusher(void) {
-  for (uint32_t i = 0; i < TEST_Q_SIZE; i++) {
-    auto p = std::make_shared<std::vector<uint8_t>>(TEST_BUFFER_SIZE);
+TEST_CASE("Alazar Index Ring", "[bufferq]") {
+  uint32_t index;
+  REQUIRE(ring.empty());
+  REQUIRE(ring.pop(index) == false);
 
-    std::memset(p.get()->data(), i, TEST_BUFFER_SIZE);
-    q.push(p);
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // a full ring refuses the next index and takes it once one is popped
+  for (uint32_t i = 0; i < 8; i++) {
+    REQUIRE(ring.push(i));
   }
-}
+  REQUIRE(ring.push(8) == false);
+  REQUIRE(ring.pop(index));
+  REQUIRE(index == 0);
+  REQUIRE(ring.push(8));
+  ring.clear();
+  REQUIRE(ring.empty());
 
-void lockQ(void) {
-  std::lock_guard<std::mutex> lock(q.qmtx);
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // the indices arrive in order across threads, through many wraps
+  std::thread t1(ringPusher);
+  for (uint32_t i = 0; i < 1000; i++) {
+    while (!ring.pop(index))
+      std::this_thread::yield();
+    REQUIRE(index == i);
+  }
+  t1.join();
+  REQUIRE(ring.pop(index) == false);
 }
 
-TEST_CASE("Alazar Buffer Q", "[bufferq]") {
+#define RING_THREADS 4
+#define RING_INDICES 10000
+
+TEST_CASE("Alazar Index Ring shared", "[bufferq]") {
+  AlazarIndexRing<16> shared;
+  std::atomic<uint32_t> popped{0};
+  std::vector<std::vector<uint32_t>> received(RING_THREADS);
 
-  std::thread t1(pusher);
-  t1.detach();
+  // each producer pushes its own run of indices, the consumers take them
+  // until all of them are popped
+  std::vector<std::thread> threads;
+  for (uint32_t p = 0; p < RING_THREADS; p++) {
+    threads.emplace_back([&shared, p]() {
+      for (uint32_t i = 0; i < RING_INDICES; i++) {
+        while (!shared.push(p * RING_INDICES + i))
+          std::this_thread::yield();
+      }
+    });
+  }
+  for (uint32_t c = 0; c < RING_THREADS; c++) {
+    threads.emplace_back([&shared, &popped, &received, c]() {
+      uint32_t index;
+      while (popped < RING_THREADS * RING_INDICES) {
+        if (shared.pop(index)) {
+          received[c].push_back(index);
+          popped++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
 
-  std::shared_ptr<std::vector<uint8_t>> temp;
-  for (uint32_t i = 0; i < TEST_Q_SIZE; i++) {
-    // verify the lock by holding off the pusher thread
-    lockQ();
-    while (q.pop(temp) == false)
-      ;
-    REQUIRE(temp.get()->data()[0] == i);
+  // every index arrives once, and each consumer sees the indices of a
+  // producer in the order they were pushed
+  std::vector<uint32_t> seen(RING_THREADS * RING_INDICES, 0);
+  for (auto &indices : received) {
+    std::vector<int64_t> last(RING_THREADS, -1);
+    for (uint32_t index : indices) {
+      seen[index]++;
+      REQUIRE(int64_t(index) > last[index / RING_INDICES]);
+      last[index / RING_INDICES] = index;
+    }
   }
-  REQUIRE(q.pop(temp) == false);
-}
\ No newline at end of file
+  for (uint32_t count : seen) {
+    REQUIRE(count == 1);
+  }
+  REQUIRE(shared.empty());
+}
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "alazarKernels.h"
+#include "catch.hpp"
+
+TEST_CASE("Processing kernels", "[kernels]") {
+  ConvertTable table;
+  buildConvertTable(table, 2 * 0.4f / 256, 0.013f);
+
+  // every code in both channels, with a length that leaves a tail after the
+  // vector loops
+  const uint32_t nbrPairs = 517;
+  std::vector<uint8_t> buff(2 * nbrPairs);
+  for (uint32_t i = 0; i < buff.size(); i++) {
+    buff[i] = static_cast<uint8_t>(i * 7 + 3);
+  }
+
+  std::vector<float> ch1(nbrPairs), ch2(nbrPairs), ch(2 * nbrPairs);
+  for (uint32_t i = 0; i < nbrPairs; i++) {
+    ch1[i] = table.counts2Volts * (buff[2 * i] - 128) - table.channelOffset;
+    ch2[i] = table.counts2Volts * (buff[2 * i + 1] - 128) - table.channelOffset;
+  }
+  for (uint32_t i = 0; i < 2 * nbrPairs; i++) {
+    ch[i] = table.counts2Volts * (buff[i] - 128) - table.channelOffset;
+  }
+
+  // the accumulating kernels add to a non zero output
+  std::vector<float> start(2 * nbrPairs);
+  for (uint32_t i = 0; i < start.size(); i++) {
+    start[i] = 0.25f * i - 3.0f;
+  }
+  std::vector<float> sum1(nbrPairs), sum2(nbrPairs), sum(2 * nbrPairs);
+  for (uint32_t i = 0; i < nbrPairs; i++) {
+    sum1[i] = start[i] + ch1[i];
+    sum2[i] = start[i] + ch2[i];
+  }
+  for (uint32_t i = 0; i < 2 * nbrPairs; i++) {
+    sum[i] = start[i] + ch[i];
+  }
+
+  REQUIRE(kernelVariants().size() >= 2);
+  REQUIRE(std::string(kernelVariants()[0].name) == "scalar");
+  for (auto &variant : kernelVariants()) {
+    INFO(variant.name);
+    std::vector<float> out1(nbrPairs, 0), out2(nbrPairs, 0);
+    std::vector<float> out(2 * nbrPairs, 0);
+    variant.convertPairs(buff.data(), nbrPairs, table, out1.data(),
+                         out2.data());
+    variant.convertSamples(buff.data(), 2 * nbrPairs, table, out.data());
+
+    // bit for bit the same as the arithmetic
+    REQUIRE(std::memcmp(out1.data(), ch1.data(), nbrPairs * 4) == 0);
+    REQUIRE(std::memcmp(out2.data(), ch2.data(), nbrPairs * 4) == 0);
+    REQUIRE(std::memcmp(out.data(), ch.data(), 2 * nbrPairs * 4) == 0);
+
+    std::copy(start.begin(), start.begin() + nbrPairs, out1.begin());
+    std::copy(start.begin(), start.begin() + nbrPairs, out2.begin());
+    std::copy(start.begin(), start.end(), out.begin());
+    variant.accumulatePairs(buff.data(), nbrPairs, table, out1.data(),
+                            out2.data());
+    variant.accumulateSamples(buff.data(), 2 * nbrPairs, table, out.data());
+    REQUIRE(std::memcmp(out1.data(), sum1.data(), nbrPairs * 4) == 0);
+    REQUIRE(std::memcmp(out2.data(), sum2.data(), nbrPairs * 4) == 0);
+    REQUIRE(std::memcmp(out.data(), sum.data(), 2 * nbrPairs * 4) == 0);
+  }
+
+  // variants are found by name, the scalar one always runs
+  REQUIRE(kernelsByName("scalar") == &kernelVariants()[0]);
+  REQUIRE(kernelsByName("no-such-kernels") == nullptr);
+  REQUIRE(cpuSupports(ISA_SCALAR));
+
+  // the selection is one of the variants
+  const ProcessingKernels &selected = selectKernels();
+  REQUIRE(kernelsByName(selected.name) == &selected);
+}
+
+TEST_CASE("Fixed length record kernels", "[kernels]") {
+  ConvertTable table;
+  buildConvertTable(table, 2 * 0.4f / 256, 0.013f);
+
+  const uint32_t maxLength = 4096;
+  std::vector<uint8_t> buff(2 * maxLength);
+  for (uint32_t i = 0; i < buff.size(); i++) {
+    buff[i] = static_cast<uint8_t>(i * 13 + 5);
+  }
+
+  for (auto &variant : kernelVariants()) {
+    INFO(variant.name);
+    // lengths without a specialization fall back to the generic kernels
+    RecordKernels generic = recordKernels(variant, 300);
+    REQUIRE(generic.recordLength == 0);
+    REQUIRE(generic.convertPairs == variant.convertPairs);
+
+    for (uint32_t length = 256; length <= maxLength; length *= 2) {
+      INFO(length);
+      RecordKernels fixed = recordKernels(variant, length);
+      REQUIRE(fixed.recordLength == length);
+
+      // the count is ignored, the record length is built in
+      std::vector<float> ref1(length, 1), ref2(length, 2), ref(length, 3);
+      std::vector<float> out1(length, 1), out2(length, 2), out(length, 3);
+      variant.convertPairs(buff.data(), length, table, ref1.data(),
+                           ref2.data());
+      fixed.convertPairs(buff.data(), 0, table, out1.data(), out2.data());
+      variant.accumulateSamples(buff.data(), length, table, ref.data());
+      fixed.accumulateSamples(buff.data(), 0, table, out.data());
+      REQUIRE(std::memcmp(out1.data(), ref1.data(), length * 4) == 0);
+      REQUIRE(std::memcmp(out2.data(), ref2.data(), length * 4) == 0);
+      REQUIRE(std::memcmp(out.data(), ref.data(), length * 4) == 0);
+
+      variant.accumulatePairs(buff.data(), length, table, ref1.data(),
+                              ref2.data());
+      fixed.accumulatePairs(buff.data(), 0, table, out1.data(), out2.data());
+      variant.convertSamples(buff.data(), length, table, ref.data());
+      fixed.convertSamples(buff.data(), 0, table, out.data());
+      REQUIRE(std::memcmp(out1.data(), ref1.data(), length * 4) == 0);
+      REQUIRE(std::memcmp(out2.data(), ref2.data(), length * 4) == 0);
+      REQUIRE(std::memcmp(out.data(), ref.data(), length * 4) == 0);
+    }
+  }
+}
+
+TEST_CASE("Streaming kernels", "[kernels]") {
+  ConvertTable table;
+  buildConvertTable(table, 2 * 0.4f / 256, 0.013f);
+
+  const uint32_t nbrPairs = 1029;
+  std::vector<uint8_t> buff(2 * nbrPairs);
+  for (uint32_t i = 0; i < buff.size(); i++) {
+    buff[i] = static_cast<uint8_t>(i * 11 + 1);
+  }
+
+  for (auto &variant : kernelVariants()) {
+    INFO(variant.name);
+    std::vector<float> ref1(nbrPairs), ref2(nbrPairs), ref(2 * nbrPairs);
+    variant.convertPairs(buff.data(), nbrPairs, table, ref1.data(),
+                         ref2.data());
+    variant.convertSamples(buff.data(), 2 * nbrPairs, table, ref.data());
+
+    // outputs at every alignment, with the two channels aligned alike and
+    // differently
+    for (uint32_t shift1 = 0; shift1 < 16; shift1++) {
+      for (uint32_t shift2 : {shift1, (shift1 + 5) % 16}) {
+        std::vector<float> out1(nbrPairs + 16), out2(nbrPairs + 16);
+        std::vector<float> out(2 * nbrPairs + 16);
+        variant.streamPairs(buff.data(), nbrPairs, table,
+                            out1.data() + shift1, out2.data() + shift2);
+        variant.streamSamples(buff.data(), 2 * nbrPairs, table,
+                              out.data() + shift1);
+        streamFence();
+        REQUIRE(std::memcmp(out1.data() + shift1, ref1.data(),
+                            nbrPairs * 4) == 0);
+        REQUIRE(std::memcmp(out2.data() + shift2, ref2.data(),
+                            nbrPairs * 4) == 0);
+        REQUIRE(std::memcmp(out.data() + shift1, ref.data(),
+                            2 * nbrPairs * 4) == 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Pack kernels", "[kernels]") {
+  // half precision rounding, subnormals and overflow
+  REQUIRE(floatToHalf(1.0f) == 0x3c00);
+  REQUIRE(floatToHalf(-2.0f) == 0xc000);
+  REQUIRE(floatToHalf(65504.0f) == 0x7bff);
+  REQUIRE(floatToHalf(65520.0f) == 0x7c00);
+  REQUIRE(floatToHalf(1.0f + 1.0f / 2048) == 0x3c00);
+  REQUIRE(floatToHalf(1.0f + 3.0f / 2048) == 0x3c02);
+  REQUIRE(floatToHalf(std::ldexp(1.0f, -24)) == 0x0001);
+  REQUIRE(floatToHalf(std::ldexp(1.0f, -25)) == 0x0000);
+  REQUIRE(floatToHalf(std::ldexp(3.0f, -26)) == 0x0001);
+
+  // averages and sums of counts in volts, with ties and values that
+  // saturate the narrow types
+  const uint32_t nbrSamples = 1037;
+  std::vector<float> in(nbrSamples);
+  for (uint32_t i = 0; i < nbrSamples; i++) {
+    in[i] = (static_cast<int32_t>(i * 37 % 1001) - 500) * 0.125f;
+  }
+  in[0] = 1e6f;
+  in[1] = -1e6f;
+  in[2] = std::ldexp(1.0f, -20);
+
+  const ProcessingKernels &scalar = kernelVariants()[0];
+  std::vector<uint16_t> half(nbrSamples);
+  std::vector<int16_t> int16(nbrSamples);
+  std::vector<int8_t> int8(nbrSamples);
+  std::vector<int32_t> int32(nbrSamples);
+  scalar.packHalf(in.data(), nbrSamples, half.data());
+  scalar.packInt16(in.data(), nbrSamples, 256.0f, 0.5f, int16.data());
+  scalar.packInt8(in.data(), nbrSamples, 1.0f, 0.25f, int8.data());
+  scalar.packInt32(in.data(), nbrSamples, 2.0f, 0.0f, int32.data());
+  REQUIRE(half[3] == floatToHalf(in[3]));
+  REQUIRE(int16[0] == 32767);
+  REQUIRE(int16[1] == -32768);
+  REQUIRE(int8[0] == 127);
+  REQUIRE(int8[1] == -128);
+  REQUIRE(int32[0] == 2000000);
+  for (uint32_t i = 3; i < nbrSamples; i++) {
+    REQUIRE(int32[i] == std::lrint(in[i] * 2.0f));
+  }
+
+  for (auto &variant : kernelVariants()) {
+    INFO(variant.name);
+    std::vector<uint16_t> outHalf(nbrSamples);
+    std::vector<int16_t> out16(nbrSamples);
+    std::vector<int8_t> out8(nbrSamples);
+    std::vector<int32_t> out32(nbrSamples);
+    variant.packHalf(in.data(), nbrSamples, outHalf.data());
+    variant.packInt16(in.data(), nbrSamples, 256.0f, 0.5f, out16.data());
+    variant.packInt8(in.data(), nbrSamples, 1.0f, 0.25f, out8.data());
+    variant.packInt32(in.data(), nbrSamples, 2.0f, 0.0f, out32.data());
+    REQUIRE(outHalf == half);
+    REQUIRE(out16 == int16);
+    REQUIRE(out8 == int8);
+    REQUIRE(out32 == int32);
+  }
+}
@@ -0,0 +1,916 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "catch.hpp"
+#include "libAlazar.h"
+
+// default configuration used by the processing tests; each test overrides
+// the geometry and mode it exercises
+static ConfigData_t testConfig(const char *mode) {
+  ConfigData_t config = {};
+  config.acquireMode = mode;
+  config.bandwidth = "Full";
+  config.clockType = "ref";
+  config.recordLength = 256;
+  config.nbrSegments = 1;
+  config.nbrWaveforms = 1;
+  config.nbrRoundRobins = 1;
+  config.samplingRate = 500e6;
+  config.triggerCoupling = "DC";
+  config.triggerLevel = 1000;
+  config.triggerSlope = "rising";
+  config.triggerSource = "Ext";
+  config.verticalCoupling = "AC";
+  config.verticalOffset = 0.0;
+  config.verticalScale = 1.0;
+  return config;
+}
+
+// interleaved channel A/B counts that vary along the record and between
+// records so lags and segments are distinguishable
+static uint8_t patternA(uint32_t record, uint32_t i) {
+  return static_cast<uint8_t>(128 + ((i * 7 + record * 3) % 41) - 20);
+}
+
+static uint8_t patternB(uint32_t record, uint32_t i) {
+  return static_cast<uint8_t>(128 + ((i * 5 + record * 11) % 37) - 18);
+}
+
+// the buffers are laid out as the board delivers them: a single channel on
+// its own, both channels interleaved or in blocks of records
+static std::shared_ptr<std::vector<uint8_t>>
+makeBuffer(uint32_t firstRecord, uint32_t nbrRecords, uint32_t recordLength,
+           uint32_t channelSelect = CHANNEL_A | CHANNEL_B,
+           DmaLayout layout = INTERLEAVED_LAYOUT) {
+  uint32_t nc = channelSelect == (CHANNEL_A | CHANNEL_B) ? 2 : 1;
+  auto buff =
+      std::make_shared<std::vector<uint8_t>>(nc * recordLength * nbrRecords);
+  uint8_t *p = buff->data();
+  for (uint32_t r = 0; r < nbrRecords; r++) {
+    for (uint32_t i = 0; i < recordLength; i++) {
+      uint32_t n = r * recordLength + i;
+      if (nc == 2 && layout == INTERLEAVED_LAYOUT) {
+        p[2 * n] = patternA(firstRecord + r, i);
+        p[2 * n + 1] = patternB(firstRecord + r, i);
+      } else if (nc == 2) {
+        p[n] = patternA(firstRecord + r, i);
+        p[nbrRecords * recordLength + n] = patternB(firstRecord + r, i);
+      } else if (channelSelect == CHANNEL_A) {
+        p[n] = patternA(firstRecord + r, i);
+      } else {
+        p[n] = patternB(firstRecord + r, i);
+      }
+    }
+  }
+  return buff;
+}
+
+// Feed buffers of the test pattern to the board until an acquisition is
+// complete and return the number of records it spanned
+static uint32_t runAcquisition(AlazarATS9870 &board, float *ch1, float *ch2) {
+  uint32_t recordsPerBuffer =
+      board.bufferLen / (board.numChannels * board.recordLength);
+  uint32_t record = 0;
+  board.processCounter = 0;
+  while (true) {
+    auto buff = makeBuffer(record, recordsPerBuffer, board.recordLength,
+                           board.channelSelect, board.dmaLayout);
+    record += recordsPerBuffer;
+    int32_t ret = board.processBuffer(buff->data(), ch1, ch2);
+    REQUIRE(ret >= 0);
+    if (ret == 1) {
+      return record;
+    }
+  }
+}
+
+// Expected digitizer or averager output for nbrRecords records of the test
+// pattern, computed sample by sample
+static void expectedOutput(AlazarATS9870 &board, uint32_t nbrRecords,
+                           std::vector<float> &ch1, std::vector<float> &ch2) {
+  uint32_t nj = board.nbrWaveforms;
+  uint32_t nk = board.nbrSegments;
+  uint32_t nd = board.downsampleFactor;
+  uint32_t no = board.outputLength;
+  uint32_t ns = board.nbrRoiSegments;
+  bool average = board.acquireMode == AVERAGER_MODE;
+
+  ch1.assign(average ? no * ns : 0, 0);
+  ch2.assign(ch1.size(), 0);
+  for (uint32_t r = 0; r < nbrRecords; r++) {
+    int32_t s = board.roiSegmentIndex[(r / nj) % nk];
+    if (s < 0) {
+      continue;
+    }
+    uint32_t base = average ? s * no : ch1.size();
+    if (!average) {
+      ch1.resize(base + no, 0);
+      ch2.resize(base + no, 0);
+    }
+    for (auto &window : board.roiWindows) {
+      for (uint32_t i = 0; i < window.second / nd; i++) {
+        double sum1 = 0;
+        double sum2 = 0;
+        for (uint32_t d = 0; d < nd; d++) {
+          sum1 += patternA(r, window.first + i * nd + d);
+          sum2 += patternB(r, window.first + i * nd + d);
+        }
+        ch1[base] += board.counts2Volts * (sum1 / nd - 128) -
+                     board.channelOffset;
+        ch2[base] += board.counts2Volts * (sum2 / nd - 128) -
+                     board.channelOffset;
+        base++;
+      }
+    }
+  }
+  if (average) {
+    for (uint32_t i = 0; i < ch1.size(); i++) {
+      ch1[i] /= nbrRecords / nk;
+      ch2[i] /= nbrRecords / nk;
+    }
+  }
+}
+
+static double maxError(const std::vector<float> &actual,
+                       const std::vector<float> &expected) {
+  double error = 0;
+  for (size_t i = 0; i < expected.size(); i++) {
+    error = std::max(error, std::fabs(double(actual[i]) - expected[i]));
+  }
+  return error;
+}
+
+TEST_CASE("Correlator", "[processing]") {
+  AlazarATS9870 board;
+  ConfigData_t config = testConfig("correlator");
+  config.recordLength = 256;
+  config.nbrSegments = 3;
+  config.nbrWaveforms = 4;
+  config.nbrCorrelationLags = 5;
+  config.verticalOffset = 0.25;
+
+  AcquisitionParams_t acqParams;
+
+  bool partial = false;
+  SECTION("complete buffer") { config.nbrRoundRobins = 2; }
+  SECTION("partial buffer") {
+    // a round robin no longer fits in the preferred buffer size
+    config.recordLength = 256 * 1024;
+    partial = true;
+  }
+
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+  REQUIRE(board.partialBuffer == partial);
+
+  uint32_t ni = config.recordLength;
+  uint32_t nj = config.nbrWaveforms;
+  uint32_t nk = config.nbrSegments;
+  uint32_t nl = config.nbrCorrelationLags;
+  uint32_t recordsPerAcq = board.partialBuffer
+                               ? nj * nk
+                               : nj * nk * board.roundRobinsPerBuffer;
+  REQUIRE(acqParams.samplesPerAcquisition == ni * nk * nl);
+
+  std::vector<float> ch1(acqParams.samplesPerAcquisition);
+  std::vector<float> ch2(acqParams.samplesPerAcquisition);
+
+  board.processCounter = 0;
+  uint32_t nbrBuffers = board.partialBuffer ? board.buffersPerRoundRobin : 1;
+  uint32_t recordsPerBuffer = recordsPerAcq / nbrBuffers;
+  for (uint32_t n = 0; n < nbrBuffers; n++) {
+    auto buff = makeBuffer(n * recordsPerBuffer, recordsPerBuffer, ni);
+    int32_t ret =
+        board.processBuffer(buff->data(), ch1.data(), ch2.data());
+    REQUIRE(ret == (n == nbrBuffers - 1 ? 1 : 0));
+  }
+
+  double c = board.counts2Volts;
+  double o = board.channelOffset;
+  uint32_t nbrChecked = 0;
+  for (uint32_t l = 0; l < nl; l++) {
+    for (uint32_t k = 0; k < nk; k++) {
+      for (uint32_t i = 0; i < ni; i += 61) {
+        double expected12 = 0;
+        double expected21 = 0;
+        if (i + l < ni) {
+          uint32_t count = 0;
+          for (uint32_t r = 0; r < recordsPerAcq; r++) {
+            if ((r / nj) % nk != k) {
+              continue;
+            }
+            double a0 = c * (patternA(r, i) - 128) - o;
+            double b0 = c * (patternB(r, i) - 128) - o;
+            double al = c * (patternA(r, i + l) - 128) - o;
+            double bl = c * (patternB(r, i + l) - 128) - o;
+            expected12 += a0 * bl;
+            expected21 += b0 * al;
+            count++;
+          }
+          expected12 /= count;
+          expected21 /= count;
+        }
+        uint32_t idx = l * ni * nk + k * ni + i;
+        REQUIRE(ch1[idx] == Approx(expected12).epsilon(1e-5).margin(1e-6));
+        REQUIRE(ch2[idx] == Approx(expected21).epsilon(1e-5).margin(1e-6));
+        nbrChecked++;
+      }
+    }
+  }
+  REQUIRE(nbrChecked > 0);
+}
+
+TEST_CASE("Events", "[processing]") {
+  AlazarATS9870 board;
+  ConfigData_t config = testConfig("events");
+  config.recordLength = 256;
+  config.nbrSegments = 2;
+  config.nbrWaveforms = 4;
+  config.eventThresholdCh1 = 0.5;
+  config.eventThresholdCh2 = 0.25;
+  config.eventWindow = 64;
+
+  AcquisitionParams_t acqParams;
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+  REQUIRE(acqParams.samplesPerAcquisition == 256 * 8);
+
+  // flat baseline with a positive spike on channel A in record 1, a
+  // negative one on channel B in record 6 and one below both thresholds
+  auto buff = std::make_shared<std::vector<uint8_t>>(2 * 256 * 8, 128);
+  uint8_t *p = buff->data();
+  p[2 * (1 * 256 + 70)] = 128 + 64;
+  p[2 * (6 * 256 + 255) + 1] = 128 - 32;
+  p[2 * (3 * 256 + 10)] = 128 + 63;
+
+  std::vector<float> ch1(acqParams.samplesPerAcquisition);
+  std::vector<float> ch2(acqParams.samplesPerAcquisition);
+  board.processCounter = 5;
+  REQUIRE(board.processBuffer(buff->data(), ch1.data(), ch2.data()) == 2);
+
+  REQUIRE(board.eventList[0].bufferIndex == 5);
+  REQUIRE(board.eventList[0].recordIndex == 1);
+  REQUIRE(board.eventList[0].sampleIndex == 64);
+  REQUIRE(ch1[70 - 64] == Approx(0.5));
+  REQUIRE(ch1[0] == 0);
+
+  REQUIRE(board.eventList[1].recordIndex == 6);
+  REQUIRE(board.eventList[1].sampleIndex == 192);
+  REQUIRE(ch2[64 + 63] == Approx(-0.25));
+}
+
+TEST_CASE("Histogram", "[processing]") {
+  AlazarATS9870 board;
+  ConfigData_t config = testConfig("histogram");
+  // one round robin per buffer, so the counts carry over between buffers
+  config.recordLength = 256 * 1024;
+  config.nbrSegments = 3;
+  config.nbrWaveforms = 2;
+  config.nbrRoundRobins = 2;
+
+  AcquisitionParams_t acqParams;
+  SECTION("whole acquisition") { config.histogramPerSegment = false; }
+  SECTION("per segment") { config.histogramPerSegment = true; }
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+
+  uint32_t nk = config.histogramPerSegment ? config.nbrSegments : 1;
+  REQUIRE(acqParams.samplesPerAcquisition == 256 * nk);
+  REQUIRE(acqParams.numberAcquisitions == 1);
+
+  std::vector<float> ch1(acqParams.samplesPerAcquisition);
+  std::vector<float> ch2(acqParams.samplesPerAcquisition);
+
+  REQUIRE(board.nbrBuffers == 2);
+  board.processCounter = 0;
+  std::vector<uint64_t> expected1(acqParams.samplesPerAcquisition, 0);
+  std::vector<uint64_t> expected2(acqParams.samplesPerAcquisition, 0);
+  for (uint32_t n = 0; n < 2; n++) {
+    for (uint32_t r = 0; r < 6; r++) {
+      uint32_t k = config.histogramPerSegment ? r / 2 : 0;
+      for (uint32_t i = 0; i < config.recordLength; i++) {
+        expected1[k * 256 + patternA(n * 6 + r, i)]++;
+        expected2[k * 256 + patternB(n * 6 + r, i)]++;
+      }
+    }
+    auto buff = makeBuffer(n * 6, 6, config.recordLength);
+    int32_t ret =
+        board.processBuffer(buff->data(), ch1.data(), ch2.data());
+    REQUIRE(ret == (n == 1 ? 1 : 0));
+  }
+
+  REQUIRE(board.histCh1 == expected1);
+  REQUIRE(board.histCh2 == expected2);
+  for (uint32_t i = 0; i < acqParams.samplesPerAcquisition; i++) {
+    REQUIRE(ch1[i] == expected1[i]);
+    REQUIRE(ch2[i] == expected2[i]);
+  }
+}
+
+TEST_CASE("Downsampling", "[processing]") {
+  const char *modes[] = {"digitizer", "averager"};
+  for (const char *mode : modes) {
+    for (bool partial : {false, true}) {
+      AlazarATS9870 board;
+      ConfigData_t config = testConfig(mode);
+      config.nbrSegments = 3;
+      config.nbrWaveforms = 2;
+      config.nbrRoundRobins = 2;
+      config.downsampleFactor = 4;
+      config.verticalOffset = 0.1;
+      if (partial) {
+        // a round robin no longer fits in the preferred buffer size
+        config.recordLength = 512 * 1024;
+        config.nbrRoundRobins = 1;
+      } else {
+        config.recordLength = 1024;
+      }
+
+      AcquisitionParams_t acqParams;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(board.partialBuffer == partial);
+
+      std::vector<float> ch1(acqParams.samplesPerAcquisition);
+      std::vector<float> ch2(acqParams.samplesPerAcquisition);
+      uint32_t nbrRecords = runAcquisition(board, ch1.data(), ch2.data());
+
+      std::vector<float> expected1, expected2;
+      expectedOutput(board, nbrRecords, expected1, expected2);
+      REQUIRE(expected1.size() == acqParams.samplesPerAcquisition);
+      REQUIRE(maxError(ch1, expected1) < 1e-5);
+      REQUIRE(maxError(ch2, expected2) < 1e-5);
+
+      // the factor has to divide the record
+      config.downsampleFactor = 3;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+    }
+  }
+}
+
+TEST_CASE("Regions of interest", "[processing]") {
+  const char *modes[] = {"digitizer", "averager"};
+  for (const char *mode : modes) {
+    for (bool partial : {false, true}) {
+      AlazarATS9870 board;
+      ConfigData_t config = testConfig(mode);
+      config.nbrSegments = 4;
+      config.nbrWaveforms = 2;
+      config.nbrRoundRobins = 2;
+      config.downsampleFactor = 2;
+      if (partial) {
+        config.recordLength = 512 * 1024;
+        config.nbrRoundRobins = 1;
+      } else {
+        config.recordLength = 1024;
+      }
+
+      uint32_t roiStart[] = {16, 256};
+      uint32_t roiLength[] = {64, 128};
+      uint32_t roiSegments[] = {3, 1};
+      config.roiStart = roiStart;
+      config.roiLength = roiLength;
+      config.nbrRois = 2;
+      config.roiSegments = roiSegments;
+      config.nbrRoiSegments = 2;
+
+      AcquisitionParams_t acqParams;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(board.partialBuffer == partial);
+      REQUIRE(board.outputLength == 96);
+      REQUIRE(board.nbrRoiSegments == 2);
+
+      std::vector<float> ch1(acqParams.samplesPerAcquisition);
+      std::vector<float> ch2(acqParams.samplesPerAcquisition);
+      uint32_t nbrRecords = runAcquisition(board, ch1.data(), ch2.data());
+
+      std::vector<float> expected1, expected2;
+      expectedOutput(board, nbrRecords, expected1, expected2);
+      REQUIRE(expected1.size() == acqParams.samplesPerAcquisition);
+      REQUIRE(maxError(ch1, expected1) < 1e-5);
+      REQUIRE(maxError(ch2, expected2) < 1e-5);
+
+      // windows have to fit in the record and line up with the downsampling
+      roiStart[1] = config.recordLength - 64;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+      // an end past the range of the start is outside too
+      roiStart[1] = 0xFFFFFFC0;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+      roiStart[1] = 257;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+      roiStart[1] = 256;
+      roiSegments[0] = 4;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+    }
+  }
+}
+
+TEST_CASE("Averager tiling", "[processing]") {
+  for (bool partial : {false, true}) {
+    for (uint32_t downsample : {1u, 2u}) {
+      AlazarATS9870 board;
+      ConfigData_t config = testConfig("averager");
+      config.nbrSegments = 2;
+      config.nbrWaveforms = 3;
+      config.nbrRoundRobins = 2;
+      config.downsampleFactor = downsample;
+      if (partial) {
+        config.recordLength = 512 * 1024;
+        config.nbrRoundRobins = 1;
+      } else {
+        config.recordLength = 8192;
+      }
+
+      // windows longer than a tile, and tiles straddling the windows
+      uint32_t roiStart[] = {64, 4096};
+      uint32_t roiLength[] = {2560, 4000};
+      config.roiStart = roiStart;
+      config.roiLength = roiLength;
+      config.nbrRois = 2;
+
+      AcquisitionParams_t acqParams;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(board.partialBuffer == partial);
+      // the accumulators of these windows fit in the L2 cache
+      REQUIRE(board.averagerTile == board.outputLength);
+
+      std::vector<float> ch1(acqParams.samplesPerAcquisition);
+      std::vector<float> ch2(acqParams.samplesPerAcquisition);
+      uint32_t nbrRecords = runAcquisition(board, ch1.data(), ch2.data());
+
+      std::vector<float> expected1, expected2;
+      expectedOutput(board, nbrRecords, expected1, expected2);
+      REQUIRE(maxError(ch1, expected1) < 1e-5);
+      REQUIRE(maxError(ch2, expected2) < 1e-5);
+
+      // the tiles only change the traversal, every sample is summed in the
+      // same order
+      for (uint32_t tile : {37u, uint32_t(AVERAGER_TILE)}) {
+        INFO(tile);
+        board.averagerTile = tile;
+        std::vector<float> tiled1(acqParams.samplesPerAcquisition);
+        std::vector<float> tiled2(acqParams.samplesPerAcquisition);
+        runAcquisition(board, tiled1.data(), tiled2.data());
+        REQUIRE(tiled1 == ch1);
+        REQUIRE(tiled2 == ch2);
+      }
+    }
+  }
+
+  // records whose accumulators outgrow the L2 cache are tiled
+  AlazarATS9870 board;
+  ConfigData_t config = testConfig("averager");
+  config.nbrRoundRobins = 1;
+  config.recordLength = (l2CacheSize() / 4 + 63) / 64 * 64;
+  AcquisitionParams_t acqParams;
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+  REQUIRE(board.averagerTile == AVERAGER_TILE);
+}
+
+TEST_CASE("Streaming stores", "[processing]") {
+  for (bool partial : {false, true}) {
+    for (const char *dmaLayout : {"interleaved", "blocked"}) {
+      ConfigData_t config = testConfig("digitizer");
+      config.nbrSegments = 3;
+      config.nbrWaveforms = 2;
+      config.nbrRoundRobins = 2;
+      config.recordLength = partial ? 512 * 1024 : 1024;
+      config.dmaLayout = dmaLayout;
+
+      // the default threshold keeps this small output in the cache
+      AlazarATS9870 cached;
+      AcquisitionParams_t acqParams;
+      REQUIRE(cached.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(cached.partialBuffer == partial);
+      REQUIRE(cached.streamOutput == partial);
+      config.streamThreshold = 0xffffffff;
+      REQUIRE(cached.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(!cached.streamOutput);
+
+      AlazarATS9870 streamed;
+      config.streamThreshold = 1;
+      config.outputFormat = "int16";
+      REQUIRE(streamed.ConfigureBoard(1, 1, config, acqParams) == 0);
+      // packed outputs are read straight back from the work buffers
+      REQUIRE(!streamed.streamOutput);
+      config.outputFormat = "float32";
+      REQUIRE(streamed.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(streamed.streamOutput);
+
+      std::vector<float> ch1(acqParams.samplesPerAcquisition);
+      std::vector<float> ch2(acqParams.samplesPerAcquisition);
+      std::vector<float> streamed1(acqParams.samplesPerAcquisition);
+      std::vector<float> streamed2(acqParams.samplesPerAcquisition);
+      runAcquisition(cached, ch1.data(), ch2.data());
+      runAcquisition(streamed, streamed1.data(), streamed2.data());
+      REQUIRE(streamed1 == ch1);
+      REQUIRE(streamed2 == ch2);
+    }
+  }
+}
+
+TEST_CASE("Single channel", "[processing]") {
+  const char *channels[] = {"A", "B"};
+  for (const char *channel : channels) {
+    bool a = channel[0] == 'A';
+
+    const char *modes[] = {"digitizer", "averager"};
+    for (const char *mode : modes) {
+      for (bool partial : {false, true}) {
+        AlazarATS9870 board;
+        ConfigData_t config = testConfig(mode);
+        config.channels = channel;
+        config.nbrSegments = 3;
+        config.nbrWaveforms = 2;
+        config.nbrRoundRobins = 2;
+        config.downsampleFactor = 2;
+        if (partial) {
+          // twice the records of a dual channel buffer fit before splitting
+          config.recordLength = 1024 * 1024;
+          config.nbrRoundRobins = 1;
+        } else {
+          config.recordLength = 1024;
+        }
+
+        AcquisitionParams_t acqParams;
+        REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+        REQUIRE(board.partialBuffer == partial);
+        REQUIRE(board.numChannels == 1);
+
+        // only the captured channel is needed
+        std::vector<float> out(acqParams.samplesPerAcquisition);
+        float *ch1 = a ? out.data() : nullptr;
+        float *ch2 = a ? nullptr : out.data();
+        uint32_t nbrRecords = runAcquisition(board, ch1, ch2);
+
+        std::vector<float> expected1, expected2;
+        expectedOutput(board, nbrRecords, expected1, expected2);
+        REQUIRE(maxError(out, a ? expected1 : expected2) < 1e-5);
+      }
+    }
+
+    SECTION(std::string("histogram ") + channel) {
+      AlazarATS9870 board;
+      ConfigData_t config = testConfig("histogram");
+      config.channels = channel;
+      config.nbrWaveforms = 4;
+      AcquisitionParams_t acqParams;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+
+      std::vector<float> out(acqParams.samplesPerAcquisition);
+      auto buff = makeBuffer(0, 4, config.recordLength, board.channelSelect);
+      board.processCounter = 0;
+      REQUIRE(board.processBuffer(buff->data(), a ? out.data() : nullptr,
+                                  a ? nullptr : out.data()) == 1);
+
+      std::vector<uint64_t> expected(256, 0);
+      for (uint32_t r = 0; r < 4; r++) {
+        for (uint32_t i = 0; i < config.recordLength; i++) {
+          expected[a ? patternA(r, i) : patternB(r, i)]++;
+        }
+      }
+      REQUIRE((a ? board.histCh1 : board.histCh2) == expected);
+      for (uint32_t bin = 0; bin < 256; bin++) {
+        REQUIRE(out[bin] == expected[bin]);
+      }
+    }
+
+    SECTION(std::string("events ") + channel) {
+      AlazarATS9870 board;
+      ConfigData_t config = testConfig("events");
+      config.channels = channel;
+      config.nbrWaveforms = 2;
+      config.eventThresholdCh1 = 0.5;
+      config.eventThresholdCh2 = 0.5;
+      config.eventWindow = 64;
+      AcquisitionParams_t acqParams;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+
+      auto buff = std::make_shared<std::vector<uint8_t>>(256 * 2, 128);
+      (*buff)[256 + 130] = 128 + 64;
+      std::vector<float> out(acqParams.samplesPerAcquisition);
+      board.processCounter = 0;
+      REQUIRE(board.processBuffer(buff->data(), a ? out.data() : nullptr,
+                                  a ? nullptr : out.data()) == 1);
+      REQUIRE(board.eventList[0].recordIndex == 1);
+      REQUIRE(board.eventList[0].sampleIndex == 128);
+      REQUIRE(out[2] == Approx(0.5));
+    }
+  }
+
+  // the correlator needs both channels
+  AlazarATS9870 board;
+  ConfigData_t config = testConfig("correlator");
+  config.channels = "A";
+  AcquisitionParams_t acqParams;
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+}
+
+TEST_CASE("Blocked layout", "[processing]") {
+  // every mode has to give the same results from both layouts
+  const char *modes[] = {"digitizer", "averager", "correlator", "events",
+                         "histogram"};
+  for (const char *mode : modes) {
+    for (bool partial : {false, true}) {
+      AlazarATS9870 interleaved, blocked;
+      ConfigData_t config = testConfig(mode);
+      config.nbrSegments = 2;
+      config.nbrWaveforms = 3;
+      config.nbrRoundRobins = 2;
+      config.nbrCorrelationLags = 3;
+      config.eventThresholdCh1 = 0.14;
+      config.eventThresholdCh2 = 0.13;
+      config.eventWindow = 256;
+      config.recordLength = partial ? 512 * 1024 : 1024;
+
+      AcquisitionParams_t acqParams;
+      REQUIRE(interleaved.ConfigureBoard(1, 1, config, acqParams) == 0);
+      config.dmaLayout = "blocked";
+      REQUIRE(blocked.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(blocked.partialBuffer == partial);
+      REQUIRE(blocked.bufferLen == interleaved.bufferLen);
+
+      uint32_t size = acqParams.samplesPerAcquisition;
+      std::vector<float> ch1(size, 0), ch2(size, 0);
+      std::vector<float> blockedCh1(size, 0), blockedCh2(size, 0);
+      uint32_t recordsPerBuffer = blocked.bufferLen / (2 * config.recordLength);
+      interleaved.processCounter = 0;
+      blocked.processCounter = 0;
+      for (uint32_t n = 0; n < blocked.nbrBuffers; n++) {
+        uint32_t first = n * recordsPerBuffer;
+        auto buff = makeBuffer(first, recordsPerBuffer, config.recordLength);
+        auto blockedBuff =
+            makeBuffer(first, recordsPerBuffer, config.recordLength,
+                       CHANNEL_A | CHANNEL_B, BLOCKED_LAYOUT);
+        int32_t ret =
+            interleaved.processBuffer(buff->data(), ch1.data(), ch2.data());
+        REQUIRE(blocked.processBuffer(blockedBuff->data(), blockedCh1.data(),
+                                      blockedCh2.data()) == ret);
+        REQUIRE(maxError(blockedCh1, ch1) == 0);
+        REQUIRE(maxError(blockedCh2, ch2) == 0);
+        for (int32_t e = 0; mode[0] == 'e' && e < ret; e++) {
+          REQUIRE(blocked.eventList[e].recordIndex ==
+                  interleaved.eventList[e].recordIndex);
+          REQUIRE(blocked.eventList[e].sampleIndex ==
+                  interleaved.eventList[e].sampleIndex);
+        }
+      }
+    }
+  }
+}
+
+// volts of the packed values of an output format
+template <typename T>
+static std::vector<float> unpackOutput(const std::vector<uint8_t> &packed,
+                                       const OutputHeader_t &header) {
+  std::vector<float> volts(packed.size() / sizeof(T));
+  const T *values = reinterpret_cast<const T *>(packed.data());
+  for (size_t i = 0; i < volts.size(); i++) {
+    volts[i] = static_cast<float>(header.scale * values[i] / header.count +
+                                  header.offset);
+  }
+  return volts;
+}
+
+static std::vector<float> halfToFloat(const std::vector<uint8_t> &packed) {
+  std::vector<float> volts(packed.size() / 2);
+  const uint16_t *values = reinterpret_cast<const uint16_t *>(packed.data());
+  for (size_t i = 0; i < volts.size(); i++) {
+    int32_t exponent = (values[i] >> 10) & 0x1f;
+    int32_t mantissa = values[i] & 0x3ff;
+    double magnitude = exponent ? std::ldexp(1024 + mantissa, exponent - 25)
+                                : std::ldexp(mantissa, -24);
+    volts[i] = static_cast<float>(values[i] & 0x8000 ? -magnitude : magnitude);
+  }
+  return volts;
+}
+
+TEST_CASE("Output formats", "[processing]") {
+  struct Case {
+    const char *mode;
+    const char *format;
+    uint32_t downsample;
+  };
+  const Case cases[] = {
+      {"digitizer", "float16", 1}, {"digitizer", "int16", 2},
+      {"digitizer", "int8", 1},    {"averager", "float16", 1},
+      {"averager", "int16", 2},    {"averager", "int32", 1},
+  };
+  for (bool partial : {false, true}) {
+    for (auto &c : cases) {
+      INFO(c.mode << " " << c.format << " partial " << partial);
+      ConfigData_t config = testConfig(c.mode);
+      config.nbrSegments = 2;
+      config.nbrWaveforms = 3;
+      config.nbrRoundRobins = partial ? 1 : 2;
+      config.recordLength = partial ? 512 * 1024 : 1024;
+      config.downsampleFactor = c.downsample;
+      config.verticalOffset = 0.0625;
+
+      // the float32 output is the reference
+      AlazarATS9870 reference;
+      AcquisitionParams_t acqParams;
+      REQUIRE(reference.ConfigureBoard(1, 1, config, acqParams) == 0);
+      REQUIRE(reference.partialBuffer == partial);
+      std::vector<float> ch1(acqParams.samplesPerAcquisition);
+      std::vector<float> ch2(acqParams.samplesPerAcquisition);
+      runAcquisition(reference, ch1.data(), ch2.data());
+
+      AlazarATS9870 board;
+      config.outputFormat = c.format;
+      REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+      uint32_t size =
+          acqParams.samplesPerAcquisition * board.outputSampleSize();
+      std::vector<uint8_t> packed1(size), packed2(size);
+      runAcquisition(board, board.ch1WorkBuff.data(), board.ch2WorkBuff.data());
+      board.packOutput(board.ch1WorkBuff.data(), board.ch2WorkBuff.data(),
+                       packed1.data(), packed2.data());
+
+      const OutputHeader_t &header = board.outputHeader;
+      std::vector<float> out1, out2;
+      double tolerance = 1e-6;
+      if (board.outputFormat == FLOAT16_OUTPUT) {
+        REQUIRE(header.scale == 1.0);
+        out1 = halfToFloat(packed1);
+        out2 = halfToFloat(packed2);
+        // 11 bit mantissa of volts below 1
+        tolerance = std::ldexp(1.0, -11);
+      } else if (board.outputFormat == INT16_OUTPUT) {
+        out1 = unpackOutput<int16_t>(packed1, header);
+        out2 = unpackOutput<int16_t>(packed2, header);
+        tolerance = board.counts2Volts / 512 + 1e-6;
+      } else if (board.outputFormat == INT8_OUTPUT) {
+        out1 = unpackOutput<int8_t>(packed1, header);
+        out2 = unpackOutput<int8_t>(packed2, header);
+      } else {
+        REQUIRE(board.outputFormat == INT32_OUTPUT);
+        REQUIRE(header.count == (partial ? 3u : 6u));
+        out1 = unpackOutput<int32_t>(packed1, header);
+        out2 = unpackOutput<int32_t>(packed2, header);
+        // the sums are exact integers
+        const int32_t *sums = reinterpret_cast<int32_t *>(packed1.data());
+        int64_t expected = 0;
+        for (uint32_t l = 0; l < config.nbrRoundRobins; l++) {
+          for (uint32_t j = 0; j < 3; j++) {
+            expected += patternA(j + 6 * l, 5) - 128;
+          }
+        }
+        REQUIRE(sums[5] == expected);
+      }
+      REQUIRE(maxError(out1, ch1) <= tolerance);
+      REQUIRE(maxError(out2, ch2) <= tolerance);
+    }
+  }
+
+  // formats that would lose information, or that the mode cannot produce
+  AlazarATS9870 board;
+  AcquisitionParams_t acqParams;
+  ConfigData_t config = testConfig("averager");
+  config.outputFormat = "int8";
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+  config = testConfig("digitizer");
+  config.outputFormat = "int32";
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+  config.outputFormat = "int64";
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+  config.outputFormat = "int8";
+  config.downsampleFactor = 2;
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+  config = testConfig("correlator");
+  config.outputFormat = "float16";
+  REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == -1);
+}
+
+TEST_CASE("Buffer planner", "[processing]") {
+  AlazarATS9870 board;
+  AcquisitionParams_t acqParams;
+  ConfigData_t config = testConfig("averager");
+  config.recordLength = 256;
+  // a prime number of round robins of 512 bytes, with room for 40 of them
+  config.nbrRoundRobins = 101;
+  config.bufferSize = 40 * 512;
+  BufferPlan_t plan;
+
+  SECTION("exact") {
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    board.bufferPlan(plan);
+    REQUIRE(plan.roundRobinsPerBuffer == 1);
+    REQUIRE(plan.nbrBuffers == 101);
+    REQUIRE(plan.paddingRecords == 0);
+    REQUIRE(plan.postedBuffers == MAX_NUM_BUFFERS);
+
+    // divisors of at least half the target are kept
+    config.nbrRoundRobins = 100;
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    board.bufferPlan(plan);
+    REQUIRE(plan.roundRobinsPerBuffer == 25);
+    REQUIRE(plan.nbrBuffers == 4);
+  }
+
+  SECTION("posted buffers") {
+    config.bufferCount = 5;
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    board.bufferPlan(plan);
+    REQUIRE(plan.postedBuffers == 5);
+    config.bufferCount = 1000;
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    board.bufferPlan(plan);
+    REQUIRE(plan.postedBuffers == MAX_NUM_BUFFERS);
+  }
+
+  SECTION("round robins spanning buffers") {
+    // 7 * 11 records of 512 bytes, with room for 30 of them
+    config.nbrSegments = 7;
+    config.nbrWaveforms = 11;
+    config.nbrRoundRobins = 2;
+    config.bufferSize = 30 * 512;
+    config.padBuffers = true;
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    board.bufferPlan(plan);
+    REQUIRE(plan.recordsPerBuffer == 11);
+    REQUIRE(plan.buffersPerRoundRobin == 7);
+    REQUIRE(plan.roundRobinsPerBuffer == 0);
+    REQUIRE(plan.nbrBuffers == 14);
+    REQUIRE(plan.paddingRecords == 0);
+  }
+
+  SECTION("padded") {
+    config.padBuffers = true;
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    board.bufferPlan(plan);
+    REQUIRE(plan.roundRobinsPerBuffer == 34);
+    REQUIRE(plan.nbrBuffers == 3);
+    REQUIRE(plan.paddingRecords == 1);
+    REQUIRE(plan.bufferSize == 34 * 512);
+    REQUIRE(acqParams.numberAcquisitions == 3);
+
+    // the final average leaves the padding record out
+    std::vector<float> ch1(acqParams.samplesPerAcquisition);
+    std::vector<float> ch2(acqParams.samplesPerAcquisition);
+    board.processCounter = 0;
+    for (uint32_t n = 0; n < 3; n++) {
+      auto buff = makeBuffer(n * 34, 34, config.recordLength);
+      REQUIRE(board.processBuffer(buff->data(), ch1.data(), ch2.data()) ==
+              1);
+    }
+    double error = 0;
+    for (uint32_t i = 0; i < config.recordLength; i++) {
+      double sum1 = 0;
+      double sum2 = 0;
+      for (uint32_t r = 68; r < 101; r++) {
+        sum1 += board.counts2Volts * (patternA(r, i) - 128.0) -
+                board.channelOffset;
+        sum2 += board.counts2Volts * (patternB(r, i) - 128.0) -
+                board.channelOffset;
+      }
+      error = std::max(error, std::fabs(ch1[i] - sum1 / 33));
+      error = std::max(error, std::fabs(ch2[i] - sum2 / 33));
+    }
+    REQUIRE(error < 1e-5);
+
+    // the int32 sums of the final acquisition count the records summed
+    config.outputFormat = "int32";
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    std::vector<int32_t> out1(acqParams.samplesPerAcquisition);
+    std::vector<int32_t> out2(acqParams.samplesPerAcquisition);
+    board.processCounter = 0;
+    for (uint32_t n = 0; n < 3; n++) {
+      auto buff = makeBuffer(n * 34, 34, config.recordLength);
+      REQUIRE(board.processBuffer(buff->data(), ch1.data(), ch2.data()) ==
+              1);
+      REQUIRE(board.outputHeader.count == (n < 2 ? 34u : 33u));
+    }
+    board.packOutput(ch1.data(), ch2.data(), out1.data(), out2.data());
+    const OutputHeader_t &header = board.outputHeader;
+    error = 0;
+    for (uint32_t i = 0; i < config.recordLength; i++) {
+      double sum1 = 0;
+      for (uint32_t r = 68; r < 101; r++) {
+        sum1 += board.counts2Volts * (patternA(r, i) - 128.0) -
+                board.channelOffset;
+      }
+      double volts = header.scale * out1[i] / header.count + header.offset;
+      error = std::max(error, std::fabs(volts - sum1 / 33));
+    }
+    REQUIRE(error < 1e-5);
+    config.outputFormat = nullptr;
+
+    // the digitizer zeroes the record of padding and writes the others
+    config.acquireMode = "digitizer";
+    REQUIRE(board.ConfigureBoard(1, 1, config, acqParams) == 0);
+    REQUIRE(board.paddingRecords == 1);
+    ch1.assign(acqParams.samplesPerAcquisition, 1.0f);
+    ch2.assign(acqParams.samplesPerAcquisition, 1.0f);
+    board.processCounter = 2;
+    auto buff = makeBuffer(68, 34, config.recordLength);
+    REQUIRE(board.processBuffer(buff->data(), ch1.data(), ch2.data()) == 1);
+    uint32_t written = 33 * config.recordLength;
+    REQUIRE(std::all_of(ch1.begin() + written, ch1.end(),
+                        [](float v) { return v == 0; }));
+    REQUIRE(std::all_of(ch2.begin() + written, ch2.end(),
+                        [](float v) { return v == 0; }));
+    REQUIRE(ch1[written - 1] ==
+            board.counts2Volts *
+                    (patternA(100, config.recordLength - 1) - 128.0f) -
+                board.channelOffset);
+  }
+}
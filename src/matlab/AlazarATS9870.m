@@ -127,6 +127,26 @@ classdef AlazarATS9870 < hgsetget
             conf.verticalCoupling   = settings.vertical.verticalCoupling;
             conf.verticalOffset     = settings.vertical.verticalOffset;
             conf.verticalScale      = settings.vertical.verticalScale;
+            % the library defaults for the remaining fields: 0 or NULL
+            conf.nbrCorrelationLags = 0;
+            conf.eventThresholdCh1  = 0;
+            conf.eventThresholdCh2  = 0;
+            conf.eventWindow        = 0;
+            conf.histogramPerSegment = false;
+            conf.downsampleFactor   = 0;
+            conf.roiStart           = [];
+            conf.roiLength          = [];
+            conf.nbrRois            = 0;
+            conf.roiSegments        = [];
+            conf.nbrRoiSegments     = 0;
+            conf.channels           = [];
+            conf.dmaLayout          = [];
+            conf.streamThreshold    = 0;
+            conf.outputFormat       = [];
+            conf.continuous         = false;
+            conf.bufferSize         = 0;
+            conf.bufferCount        = 0;
+            conf.padBuffers         = false;
             
 
             acq.samplesPerAcquisition = 0;
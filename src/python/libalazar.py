@@ -15,6 +15,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import copy
 import sys
 from ctypes import *
 from ctypes.util import find_library
@@ -53,12 +54,176 @@ class ConfigData(Structure):
                 ("verticalCoupling",c_char_p),
                 ("verticalOffset",  c_double),
                 ("verticalScale",   c_double),
+                ("nbrCorrelationLags", c_uint32),
+                ("eventThresholdCh1", c_double),
+                ("eventThresholdCh2", c_double),
+                ("eventWindow",     c_uint32),
+                ("histogramPerSegment", c_bool),
+                ("downsampleFactor", c_uint32),
+                ("roiStart",        POINTER(c_uint32)),
+                ("roiLength",       POINTER(c_uint32)),
+                ("nbrRois",         c_uint32),
+                ("roiSegments",     POINTER(c_uint32)),
+                ("nbrRoiSegments",  c_uint32),
+                ("channels",        c_char_p),
+                ("dmaLayout",       c_char_p),
+                ("streamThreshold", c_uint32),
+                ("outputFormat",    c_char_p),
+                ("continuous",      c_bool),
+                ("bufferSize",      c_uint32),
+                ("bufferCount",     c_uint32),
+                ("padBuffers",      c_bool),
                ]
 
+# ConfigData fields filled from the region of interest lists in configureBoard
+roiFields = ['roiStart', 'roiLength', 'nbrRois', 'roiSegments', 'nbrRoiSegments']
+
 class AcquisitionParams(Structure):
     _fields_ = [("samplesPerAcquisition", c_uint32),
                 ("numberAcquisitions",     c_uint32)]
 
+# describes the values of the output formats other than float32, whose volts
+# are scale * value / count + offset
+class OutputHeader(Structure):
+    _fields_ = [("format", c_uint32),
+                ("count",  c_uint32),
+                ("scale",  c_double),
+                ("offset", c_double)]
+
+# output formats in the order of their format numbers, and the numpy type of
+# the channel buffers for each
+outputFormats = ['float32', 'float16', 'int16', 'int8', 'int32']
+outputDtypes = {'float32': np.float32, 'float16': np.float16,
+                'int16': np.int16, 'int8': np.int8, 'int32': np.int32}
+
+# counters of the acquisition; in continuous mode a jump in sequence means
+# acquisitions were dropped because they were not read in time
+class StreamStatus(Structure):
+    _fields_ = [("received",  c_uint64),
+                ("delivered", c_uint64),
+                ("sequence",  c_uint64),
+                ("dropped",   c_uint64),
+                ("overflow",  c_uint32),
+                ("running",   c_uint32),
+                ("step",      c_uint32),
+                ("nbrSteps",  c_uint32)]
+
+class BufferPlan(Structure):
+    _fields_ = [("bufferSize",           c_uint32),
+                ("nbrBuffers",           c_uint32),
+                ("postedBuffers",        c_uint32),
+                ("recordsPerBuffer",     c_uint32),
+                ("roundRobinsPerBuffer", c_uint32),
+                ("buffersPerRoundRobin", c_uint32),
+                ("paddingRecords",       c_uint32)]
+
+class EventInfo(Structure):
+    _fields_ = [("bufferIndex", c_uint32),
+                ("recordIndex", c_uint32),
+                ("sampleIndex", c_uint32)]
+
+# header of the frames sent through the registered sockets, see libAlazarAPI.h
+FRAME_MAGIC = 0x465a4c41
+FRAME_VERSION = 1
+FRAME_LAST = 0x1
+FRAME_EVENTS = 0x2
+
+class FrameHeader(Structure):
+    _fields_ = [("magic",       c_uint32),
+                ("version",     c_uint16),
+                ("flags",       c_uint16),
+                ("headerSize",  c_uint32),
+                ("channel",     c_uint32),
+                ("sequence",    c_uint64),
+                ("acquisition", c_uint64),
+                ("timestamp",   c_uint64),
+                ("dropped",     c_uint64),
+                ("offset",      c_uint64),
+                ("size",        c_uint64),
+                ("totalSize",   c_uint64),
+                ("format",      c_uint32),
+                ("ndim",        c_uint32),
+                ("shape",       c_uint32 * 4),
+                ("count",       c_uint32),
+                ("step",        c_uint32),
+                ("scale",       c_double),
+                ("valueOffset", c_double)]
+
+class FrameReceiver():
+    """Reassembles the frames of one channel socket into numpy arrays.
+
+    The payloads are received straight into the array of the acquisition,
+    which is kept and reused while the shape and type stay the same; copy it
+    to keep it past the next call of receive.
+
+    The frames are numbered from 0 by each acquire, so a receiver can be
+    kept across acquisitions: frame 0 starts the numbering again, any other
+    frame must follow the last one.
+    """
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.headerBuffer = bytearray(sizeof(FrameHeader))
+        self.header = FrameHeader.from_buffer(self.headerBuffer)
+        self.data = None
+        self.lastSequence = None
+
+    def _recv_exactly(self, view):
+        received = 0
+        while received < len(view):
+            n = self.sock.recv_into(view[received:])
+            if n == 0:
+                raise AlazarError('ERROR: socket closed within a frame')
+            received += n
+
+    def _array(self):
+        # values of the output format, or events with their window of samples
+        header = self.header
+        shape = tuple(header.shape[:header.ndim])
+        if header.flags & FRAME_EVENTS:
+            dtype = np.dtype([('bufferIndex', np.uint32), ('recordIndex', np.uint32),
+                              ('sampleIndex', np.uint32),
+                              ('samples', np.float32, (shape[1],))])
+            shape = shape[:1]
+        else:
+            dtype = np.dtype(outputDtypes[outputFormats[header.format]])
+        if self.data is None or self.data.shape != shape or self.data.dtype != dtype:
+            self.data = np.empty(shape, dtype=dtype)
+        if self.data.nbytes != header.totalSize:
+            raise AlazarError('ERROR: frame of %d bytes for an array of %d bytes' %
+                              (header.totalSize, self.data.nbytes))
+        return memoryview(self.data.reshape(-1).view(np.uint8))
+
+    def receive(self):
+        # returns the header of the last frame and the array of the next
+        # complete acquisition
+        view = None
+        while True:
+            self._recv_exactly(memoryview(self.headerBuffer))
+            header = self.header
+            if header.magic != FRAME_MAGIC or header.version != FRAME_VERSION:
+                raise AlazarError('ERROR: not a version %d frame' % FRAME_VERSION)
+            if (self.lastSequence is not None and header.sequence != 0 and
+                    header.sequence != self.lastSequence + 1):
+                raise AlazarError('ERROR: frame %d follows frame %d' %
+                                  (header.sequence, self.lastSequence))
+            self.lastSequence = header.sequence
+            if header.offset == 0:
+                view = self._array()
+            elif view is None:
+                raise AlazarError('ERROR: frame within an acquisition that did not start')
+            self._recv_exactly(view[header.offset:header.offset + header.size])
+            if header.flags & FRAME_LAST:
+                return header, self.data
+
+    def to_volts(self, data):
+        # values of the packed output formats converted with the frame header
+        header = self.header
+        if header.format == 0:
+            return data
+        volts = header.scale * data.astype(np.float64) / header.count + header.valueOffset
+        return volts.astype(np.float32)
+
 _connectBoard = lib.connectBoard
 _connectBoard.argtypes = [c_uint32,c_char_p]
 _connectBoard.restype = c_int32
@@ -83,6 +248,18 @@ _stop = lib.stop
 _stop.argtypes = [c_uint32]
 _stop.restype = c_int32
 
+_queue_acquisitions = lib.queue_acquisitions
+_queue_acquisitions.argtypes = [c_uint32,POINTER(ConfigData),c_uint32,POINTER(AcquisitionParams)]
+_queue_acquisitions.restype = c_int32
+
+_compile_config = lib.compile_config
+_compile_config.argtypes = [c_uint32,POINTER(ConfigData),POINTER(AcquisitionParams),POINTER(c_uint32)]
+_compile_config.restype = c_int32
+
+_apply_config = lib.apply_config
+_apply_config.argtypes = [c_uint32,c_uint32,POINTER(AcquisitionParams)]
+_apply_config.restype = c_int32
+
 _acquire = lib.acquire
 _acquire.argtypes = [c_uint32]
 _acquire.restype = c_int32
@@ -91,6 +268,30 @@ _wait_for_acquisition = lib.wait_for_acquisition
 _wait_for_acquisition.argtypes = [c_uint32,POINTER(c_float),POINTER(c_float)]
 _wait_for_acquisition.restype = c_int32
 
+_wait_for_packed_acquisition = lib.wait_for_packed_acquisition
+_wait_for_packed_acquisition.argtypes = [c_uint32,c_void_p,c_void_p,POINTER(OutputHeader)]
+_wait_for_packed_acquisition.restype = c_int32
+
+_wait_for_events = lib.wait_for_events
+_wait_for_events.argtypes = [c_uint32,POINTER(c_float),POINTER(c_float),POINTER(EventInfo),POINTER(c_uint32)]
+_wait_for_events.restype = c_int32
+
+_get_histogram = lib.get_histogram
+_get_histogram.argtypes = [c_uint32,POINTER(c_uint64),POINTER(c_uint64)]
+_get_histogram.restype = c_int32
+
+_get_stream_status = lib.get_stream_status
+_get_stream_status.argtypes = [c_uint32,POINTER(StreamStatus)]
+_get_stream_status.restype = c_int32
+
+_get_buffer_plan = lib.get_buffer_plan
+_get_buffer_plan.argtypes = [c_uint32,POINTER(BufferPlan)]
+_get_buffer_plan.restype = c_int32
+
+_tune_buffer_plan = lib.tune_buffer_plan
+_tune_buffer_plan.argtypes = [c_uint32,POINTER(ConfigData),POINTER(AcquisitionParams)]
+_tune_buffer_plan.restype = c_int32
+
 _force_trigger = lib.force_trigger
 _force_trigger.argtypes = [c_uint32]
 _force_trigger.restype = c_int32
@@ -139,8 +340,34 @@ class ATS9870():
             'verticalCoupling':'AC',
             'verticalOffset':0.0,
             'verticalScale':1.0,
+            'nbrCorrelationLags':1,
+            'eventThresholdCh1':0.0,
+            'eventThresholdCh2':0.0,
+            'eventWindow':0,
+            'histogramPerSegment':False,
+            'downsampleFactor':1,
+            'roiWindows':[],
+            'roiSegments':[],
+            'channels':'AB',
+            'dmaLayout':'interleaved',
+            'streamThreshold':0,
+            'outputFormat':'float32',
+            'continuous':False,
+            'bufferSize':0,
+            'bufferCount':0,
+            'padBuffers':False,
         }
 
+        # parameters added after the original interface may be left out of
+        # the config passed to setAll, in which case they keep their defaults
+        self.optionalParams = ['nbrCorrelationLags', 'eventThresholdCh1',
+                               'eventThresholdCh2', 'eventWindow',
+                               'histogramPerSegment', 'downsampleFactor',
+                               'roiWindows', 'roiSegments', 'channels',
+                               'dmaLayout', 'streamThreshold',
+                               'outputFormat', 'continuous', 'bufferSize',
+                               'bufferCount', 'padBuffers']
+
         self.logFile = logFile
         self.bufferType = bufferType
 
@@ -151,6 +378,8 @@ class ATS9870():
         retVal = _connectBoard(self.addr,self.logFile.encode('ascii'));
         if retVal < 0:
             raise AlazarError('ERROR %s: connectBoard failed'%self.name)
+        self.appliedConfig = None
+        self.compiledConfigs = {}
         return retVal
 
     #todo - anyway to automate creating the get/set methods?
@@ -262,12 +491,113 @@ class ATS9870():
         return self.readConfig('verticalScale')
     verticalScale = property(get_verticalScale, set_verticalScale )
 
+    def set_nbrCorrelationLags(self,value):
+        self.writeConfig('nbrCorrelationLags',value)
+    def get_nbrCorrelationLags(self):
+        return self.readConfig('nbrCorrelationLags')
+    nbrCorrelationLags = property(get_nbrCorrelationLags, set_nbrCorrelationLags )
+
+    def set_eventThresholdCh1(self,value):
+        self.writeConfig('eventThresholdCh1',value)
+    def get_eventThresholdCh1(self):
+        return self.readConfig('eventThresholdCh1')
+    eventThresholdCh1 = property(get_eventThresholdCh1, set_eventThresholdCh1 )
+
+    def set_eventThresholdCh2(self,value):
+        self.writeConfig('eventThresholdCh2',value)
+    def get_eventThresholdCh2(self):
+        return self.readConfig('eventThresholdCh2')
+    eventThresholdCh2 = property(get_eventThresholdCh2, set_eventThresholdCh2 )
+
+    def set_eventWindow(self,value):
+        self.writeConfig('eventWindow',value)
+    def get_eventWindow(self):
+        return self.readConfig('eventWindow')
+    eventWindow = property(get_eventWindow, set_eventWindow )
+
+    def set_histogramPerSegment(self,value):
+        self.writeConfig('histogramPerSegment',value)
+    def get_histogramPerSegment(self):
+        return self.readConfig('histogramPerSegment')
+    histogramPerSegment = property(get_histogramPerSegment, set_histogramPerSegment )
+
+    def set_downsampleFactor(self,value):
+        self.writeConfig('downsampleFactor',value)
+    def get_downsampleFactor(self):
+        return self.readConfig('downsampleFactor')
+    downsampleFactor = property(get_downsampleFactor, set_downsampleFactor )
+
+    # list of (start, length) sample windows, empty for the whole record
+    def set_roiWindows(self,value):
+        self.writeConfig('roiWindows',value)
+    def get_roiWindows(self):
+        return self.readConfig('roiWindows')
+    roiWindows = property(get_roiWindows, set_roiWindows )
+
+    # list of segments, empty for all of them
+    def set_roiSegments(self,value):
+        self.writeConfig('roiSegments',value)
+    def get_roiSegments(self):
+        return self.readConfig('roiSegments')
+    roiSegments = property(get_roiSegments, set_roiSegments )
+
+    # 'AB', 'A' or 'B'; the buffer of a channel that is not captured is not
+    # written
+    def set_channels(self,value):
+        self.writeConfig('channels',value)
+    def get_channels(self):
+        return self.readConfig('channels')
+    channels = property(get_channels, set_channels )
+
+    # 'interleaved' or 'blocked' DMA buffers when both channels are captured
+    def set_dmaLayout(self,value):
+        self.writeConfig('dmaLayout',value)
+    def get_dmaLayout(self):
+        return self.readConfig('dmaLayout')
+    dmaLayout = property(get_dmaLayout, set_dmaLayout )
+
+    def set_streamThreshold(self,value):
+        self.writeConfig('streamThreshold',value)
+    def get_streamThreshold(self):
+        return self.readConfig('streamThreshold')
+    streamThreshold = property(get_streamThreshold, set_streamThreshold )
+
+    # 'float32', 'float16', 'int16', 'int8' or 'int32'; data_available fills
+    # the channel buffers with values of that type, see to_volts
+    def set_outputFormat(self,value):
+        self.writeConfig('outputFormat',value)
+    def get_outputFormat(self):
+        return self.readConfig('outputFormat')
+    outputFormat = property(get_outputFormat, set_outputFormat )
+
+    # acquire until stop; nbrRoundRobins is then per acquisition
+    def set_continuous(self,value):
+        self.writeConfig('continuous',value)
+    def get_continuous(self):
+        return self.readConfig('continuous')
+    continuous = property(get_continuous, set_continuous )
+
+    # target bytes of the DMA buffers and how many are posted at a time, 0
+    # for the defaults; padBuffers allows a padded final buffer, see
+    # get_buffer_plan
     def set_bufferSize(self,value):
         self.writeConfig('bufferSize',value)
     def get_bufferSize(self):
         return self.readConfig('bufferSize')
     bufferSize = property(get_bufferSize, set_bufferSize )
 
+    def set_bufferCount(self,value):
+        self.writeConfig('bufferCount',value)
+    def get_bufferCount(self):
+        return self.readConfig('bufferCount')
+    bufferCount = property(get_bufferCount, set_bufferCount )
+
+    def set_padBuffers(self,value):
+        self.writeConfig('padBuffers',value)
+    def get_padBuffers(self):
+        return self.readConfig('padBuffers')
+    padBuffers = property(get_padBuffers, set_padBuffers )
+
     def writeConfig(self,param,value):
         self.config[param] = value
 
@@ -277,7 +607,7 @@ class ATS9870():
     def setAll(self, config):
 
         for param in self.config.keys():
-            if param not in config.keys():
+            if param not in config.keys() and param not in self.optionalParams:
                 raise AlazarError('ERROR: config is missing %s'%param)
 
         for param in config.keys():
@@ -288,52 +618,233 @@ class ATS9870():
 
         self.configureBoard()
 
-    # from memory_profiler import profile
-    # @profile
-    def configureBoard(self):
-        self.configData = ConfigData()
+    def fillConfigData(self, configData):
+        # from the current config; the arrays the pointers refer to are
+        # returned and have to be kept while the library reads them
         fieldNames = [ name for name, ftype in ConfigData._fields_]
 
         for field in fieldNames:
+            if field in roiFields:
+                continue
             value = getattr(self,field)
             if isinstance(value,str):
                 value = value.encode('ascii')
-            setattr(self.configData,field,value)
+            setattr(configData,field,value)
+
+        windows = self.config['roiWindows']
+        segments = self.config['roiSegments']
+        roiStart = (c_uint32 * len(windows))(*[w[0] for w in windows])
+        roiLength = (c_uint32 * len(windows))(*[w[1] for w in windows])
+        roiSegmentArray = (c_uint32 * len(segments))(*segments)
+        configData.roiStart = roiStart
+        configData.roiLength = roiLength
+        configData.nbrRois = len(windows)
+        configData.roiSegments = roiSegmentArray
+        configData.nbrRoiSegments = len(segments)
+        return roiStart, roiLength, roiSegmentArray
+
+    # from memory_profiler import profile
+    # @profile
+    def configureBoard(self):
+        self.configData = ConfigData()
+        # the arrays are kept so the pointers stay valid during setAll
+        self.roiArrays = self.fillConfigData(self.configData)
+        # setAll replaces a queued sequence
+        self.steps = []
+        self.appliedConfig = None
 
         self.acquisitionParams = AcquisitionParams()
 
         retVal = _setAll(self.addr,byref(self.configData),byref(self.acquisitionParams))
         if retVal < 0:
             raise AlazarError('ERROR %s: setAll failed'%self.name)
+        self.allocateBuffers()
 
+    def allocateBuffers(self):
+        # the output buffers for the current config and its acquisitionParams
         self.numberAcquisitions     = self.acquisitionParams.numberAcquisitions
         self.samplesPerAcquisition = self.acquisitionParams.samplesPerAcquisition
 
+        dtype = outputDtypes[self.config['outputFormat']]
         if not hasattr(self, 'ch1Buffer'):
-            self.ch1Buffer = np.empty(self.samplesPerAcquisition,dtype=np.float32)
-        elif len(self.ch1Buffer) != self.samplesPerAcquisition:
-            self.ch1Buffer = np.empty(self.samplesPerAcquisition,dtype=np.float32)
+            self.ch1Buffer = np.empty(self.samplesPerAcquisition,dtype=dtype)
+        elif len(self.ch1Buffer) != self.samplesPerAcquisition or self.ch1Buffer.dtype != dtype:
+            self.ch1Buffer = np.empty(self.samplesPerAcquisition,dtype=dtype)
         if not hasattr(self, 'ch2Buffer'):
-            self.ch2Buffer = np.empty(self.samplesPerAcquisition,dtype=np.float32)
-        elif len(self.ch2Buffer) != self.samplesPerAcquisition:
-            self.ch2Buffer = np.empty(self.samplesPerAcquisition,dtype=np.float32)
+            self.ch2Buffer = np.empty(self.samplesPerAcquisition,dtype=dtype)
+        elif len(self.ch2Buffer) != self.samplesPerAcquisition or self.ch2Buffer.dtype != dtype:
+            self.ch2Buffer = np.empty(self.samplesPerAcquisition,dtype=dtype)
 
         self.ch1Buffer_p = self.ch1Buffer.ctypes.data_as(POINTER(c_float))
         self.ch2Buffer_p = self.ch2Buffer.ctypes.data_as(POINTER(c_float))
+        self.outputHeader = OutputHeader()
+
+        # the sample buffers hold at most one event per window
+        eventWindow = self.config['eventWindow'] or self.config['recordLength']
+        self.events = (EventInfo * (self.samplesPerAcquisition // eventWindow))()
+        self.nbrEvents = 0
+        self.appliedConfig = copy.deepcopy(self.config)
+
+    def compile_config(self, changes={}):
+        # prepares the current config, with the parameters of the changes
+        # dict, for apply_config and returns its handle
+        base = dict(self.config)
+        for param in changes.keys():
+            if param not in base.keys():
+                raise AlazarError('ERROR: %s is not a config parameter'%param)
+        configData = ConfigData()
+        try:
+            self.config = dict(base, **changes)
+            keep = self.fillConfigData(configData)
+        finally:
+            self.config = base
+        params = AcquisitionParams()
+        handle = c_uint32()
+        retVal = _compile_config(self.addr, byref(configData), byref(params), byref(handle))
+        if retVal < 0:
+            raise AlazarError('ERROR %s: compile_config failed' % self.name)
+        # the board is left configured with the compiled config
+        self.steps = []
+        self.appliedConfig = None
+        self.compiledConfigs[handle.value] = dict(base, **changes)
+        return handle.value
+
+    def apply_config(self, handle):
+        # switches to a config of compile_config, which becomes the current
+        # config
+        if handle not in getattr(self, 'compiledConfigs', {}):
+            raise AlazarError('ERROR: %s is not a compiled config'%handle)
+        self.acquisitionParams = AcquisitionParams()
+        retVal = _apply_config(self.addr, handle, byref(self.acquisitionParams))
+        if retVal < 0:
+            raise AlazarError('ERROR %s: apply_config failed' % self.name)
+        self.config = dict(self.compiledConfigs[handle])
+        self.steps = []
+        self.allocateBuffers()
+
+    def queue_acquisitions(self, steps):
+        # steps are dicts of the parameters that change from the current
+        # config; acquire then runs them back to back
+        base = dict(self.config)
+        configs = (ConfigData * len(steps))()
+        keep = []
+        try:
+            for n, step in enumerate(steps):
+                for param in step.keys():
+                    if param not in base.keys():
+                        raise AlazarError('ERROR: %s is not a config parameter'%param)
+                self.config = dict(base, **step)
+                keep.append(self.fillConfigData(configs[n]))
+        finally:
+            self.config = base
+        params = (AcquisitionParams * len(steps))()
+        retVal = _queue_acquisitions(self.addr, configs, len(steps), params)
+        if retVal < 0:
+            raise AlazarError('ERROR %s: queue_acquisitions failed' % self.name)
+        self.steps = [dict(base, **step) for step in steps]
+        self.appliedConfig = None
+        self.stepParams = [(p.samplesPerAcquisition, p.numberAcquisitions) for p in params]
+
+        # one pair of buffers large enough for any step
+        size = max([n * np.dtype(outputDtypes[step['outputFormat']]).itemsize
+                    for step, (n, count) in zip(self.steps, self.stepParams)] + [1])
+        self.stepBuffers = [np.empty(size, dtype=np.uint8) for ch in range(2)]
+        self.outputHeader = OutputHeader()
+
+    def step_available(self):
+        # the step of a new acquisition of the queued sequence, or None;
+        # step_data returns its channels
+        status = _wait_for_packed_acquisition(self.addr,
+                                              self.stepBuffers[0].ctypes.data,
+                                              self.stepBuffers[1].ctypes.data,
+                                              byref(self.outputHeader))
+        if status < 0:
+            raise AlazarError('ERROR %s: step_available failed' % self.name)
+        if status == 0:
+            return None
+        return self.get_stream_status().step
+
+    def step_data(self, step):
+        samples = self.stepParams[step][0]
+        dtype = np.dtype(outputDtypes[self.steps[step]['outputFormat']])
+        return [buff[:samples * dtype.itemsize].view(dtype) for buff in self.stepBuffers]
 
     # @profile
     def acquire(self):
-        self.configureBoard()
+        # a queued sequence configures its steps itself, and the board keeps
+        # the config last applied
+        if not getattr(self, 'steps', []) and \
+           self.config != getattr(self, 'appliedConfig', None):
+            self.configureBoard()
         retVal = _acquire(self.addr)
         if retVal < 0:
             raise AlazarError('ERROR %s: acquire failed'%self.name)
 
     def data_available(self):
-        status = _wait_for_acquisition(self.addr, self.ch1Buffer_p, self.ch2Buffer_p)
+        if self.config['outputFormat'] == 'float32':
+            status = _wait_for_acquisition(self.addr, self.ch1Buffer_p, self.ch2Buffer_p)
+        else:
+            status = _wait_for_packed_acquisition(self.addr, self.ch1Buffer_p,
+                                                  self.ch2Buffer_p, byref(self.outputHeader))
         if status < 0:
             raise AlazarError('ERROR %s: data_available failed' % self.name)
         return status
 
+    def to_volts(self, data):
+        # the channel buffers of the packed output formats converted to volts
+        if self.config['outputFormat'] == 'float32':
+            return data
+        header = self.outputHeader
+        volts = header.scale * data.astype(np.float64) / header.count + header.offset
+        return volts.astype(np.float32)
+
+    def events_available(self):
+        # the first nbrEvents windows of the channel buffers are valid and are
+        # described by the first nbrEvents entries of events
+        nbrEvents = c_uint32(0)
+        status = _wait_for_events(self.addr, self.ch1Buffer_p, self.ch2Buffer_p,
+                                  self.events, byref(nbrEvents))
+        if status < 0:
+            raise AlazarError('ERROR %s: events_available failed' % self.name)
+        self.nbrEvents = nbrEvents.value
+        return status
+
+    def get_histogram(self):
+        # exact counts, the channel buffers hold them converted to float
+        ch1 = np.zeros(self.samplesPerAcquisition,dtype=np.uint64)
+        ch2 = np.zeros(self.samplesPerAcquisition,dtype=np.uint64)
+        retVal = _get_histogram(self.addr, ch1.ctypes.data_as(POINTER(c_uint64)),
+                                ch2.ctypes.data_as(POINTER(c_uint64)))
+        if retVal < 0:
+            raise AlazarError('ERROR %s: get_histogram failed' % self.name)
+        return ch1,ch2
+
+    def get_stream_status(self):
+        status = StreamStatus()
+        retVal = _get_stream_status(self.addr, byref(status))
+        if retVal < 0:
+            raise AlazarError('ERROR %s: get_stream_status failed' % self.name)
+        return status
+
+    def get_buffer_plan(self):
+        plan = BufferPlan()
+        retVal = _get_buffer_plan(self.addr, byref(plan))
+        if retVal < 0:
+            raise AlazarError('ERROR %s: get_buffer_plan failed' % self.name)
+        return plan
+
+    def tune_buffer_plan(self):
+        # times the buffer sizes for the current config on this host, keeps
+        # the fastest for its geometry and configures the board with it
+        configData = ConfigData()
+        keep = self.fillConfigData(configData)
+        self.steps = []
+        self.acquisitionParams = AcquisitionParams()
+        retVal = _tune_buffer_plan(self.addr, byref(configData), byref(self.acquisitionParams))
+        if retVal < 0:
+            raise AlazarError('ERROR %s: tune_buffer_plan failed' % self.name)
+        self.allocateBuffers()
+
     def stop(self):
         # Don't bother if we've never connected
         if self.addr is not None:
@@ -374,9 +885,32 @@ class ATS9870():
                 ch1[:,r] = (np.mod(r,256) - 128.)*self.config['verticalScale']/128.
                 ch2[:,r] = (np.mod(r+1,256) - 128.)*self.config['verticalScale']/128.
 
+            #boxcar average adjacent samples if downsampling
+            downsample = max(self.config['downsampleFactor'],1)
+            if downsample > 1:
+                boxcarShape = (self.config['recordLength']//downsample,downsample,numRecords)
+                ch1 = np.average(np.reshape(ch1,boxcarShape),axis=1).astype(np.float32)
+                ch2 = np.average(np.reshape(ch2,boxcarShape),axis=1).astype(np.float32)
+
+            #keep the regions of interest of the selected segments
+            outputLength = self.config['recordLength']//downsample
+            nbrSegments = self.config['nbrSegments']
+            if self.config['roiWindows']:
+                samples = np.concatenate([np.arange(start,start+length)[::downsample]//downsample
+                                          for start,length in self.config['roiWindows']])
+                ch1 = ch1[samples]
+                ch2 = ch2[samples]
+                outputLength = len(samples)
+            if self.config['roiSegments']:
+                segment = (np.arange(numRecords)//self.config['nbrWaveforms']) % nbrSegments
+                keep = np.isin(segment,self.config['roiSegments'])
+                ch1 = ch1[:,keep]
+                ch2 = ch2[:,keep]
+                nbrSegments = len(set(self.config['roiSegments']))
+
             #average the data if ebabled
             if self.config['acquireMode'] == 'averager':
-                newShape = (self.config['recordLength'],self.config['nbrWaveforms'],self.config['nbrSegments'],self.config['nbrRoundRobins'])
+                newShape = (outputLength,self.config['nbrWaveforms'],nbrSegments,self.config['nbrRoundRobins'])
                 ch1 = np.reshape(ch1,newShape,order='F')
                 ch2 = np.reshape(ch2,newShape,order='F')
 
@@ -387,4 +921,21 @@ class ATS9870():
                 ch2=np.average(ch2,axis=1)
                 ch2=np.average(ch2,axis=2)
 
+            #correlate the channels at each lag if enabled
+            elif self.config['acquireMode'] == 'correlator':
+                recordLength = self.config['recordLength']
+                newShape = (recordLength,self.config['nbrWaveforms'],self.config['nbrSegments'],self.config['nbrRoundRobins'])
+                ch1 = np.reshape(ch1,newShape,order='F')
+                ch2 = np.reshape(ch2,newShape,order='F')
+
+                nbrLags = max(self.config['nbrCorrelationLags'],1)
+                corrShape = (recordLength,self.config['nbrSegments'],nbrLags)
+                corr12 = np.zeros(corrShape,dtype=np.float32)
+                corr21 = np.zeros(corrShape,dtype=np.float32)
+                for lag in range(nbrLags):
+                    n = recordLength - lag
+                    corr12[:n,:,lag] = np.average(np.average(ch1[:n]*ch2[lag:],axis=1),axis=2)
+                    corr21[:n,:,lag] = np.average(np.average(ch2[:n]*ch1[lag:],axis=1),axis=2)
+                ch1,ch2 = corr12,corr21
+
             return ch1,ch2
@@ -1,10 +1,13 @@
 import sys
 import os
+import socket
+import threading
 import time
 import unittest
 import numpy as np
 
-from libalazar import ATS9870,AlazarError
+from ctypes import c_uint32
+from libalazar import ATS9870,AlazarError,FrameReceiver,FRAME_LAST,lib
 
 class AlazarDriverTest(unittest.TestCase):
     @classmethod
@@ -122,7 +125,7 @@ class TestLib(unittest.TestCase):
         test = self.parseLog(keyword)
         self.assertEqual(value,myType(test))
 
-    def compareData(self):
+    def compareData(self, tolerance=0.0):
 
         ch1 = np.array([],dtype=np.float32)
         ch2 = np.array([],dtype=np.float32)
@@ -135,17 +138,20 @@ class TestLib(unittest.TestCase):
                 if time.time() - t > timeout:
                     break
                 time.sleep(.0001)
-            ch1=np.append(ch1,self.ats9870.ch1Buffer)
-            ch2=np.append(ch2,self.ats9870.ch2Buffer)
+            ch1=np.append(ch1,self.ats9870.to_volts(self.ats9870.ch1Buffer))
+            ch2=np.append(ch2,self.ats9870.to_volts(self.ats9870.ch2Buffer))
 
         #generate the test pattern to match
         t1,t2 = self.ats9870.generateTestPattern()
 
-        maxErrorCh1 = np.max(ch1 - t1.T.flat)
-        self.assertEqual(maxErrorCh1,0.0)
+        #only the captured channels are written
+        if 'A' in self.ats9870.channels:
+            maxErrorCh1 = np.max(np.abs(ch1 - t1.T.flat))
+            self.assertLessEqual(maxErrorCh1,tolerance)
 
-        maxErrorCh2 = np.max(ch2 - t2.T.flat)
-        self.assertEqual(maxErrorCh2,0.0)
+        if 'B' in self.ats9870.channels:
+            maxErrorCh2 = np.max(np.abs(ch2 - t2.T.flat))
+            self.assertLessEqual(maxErrorCh2,tolerance)
 
         return
 
@@ -174,6 +180,8 @@ class TestLib(unittest.TestCase):
 
     def setUp(self):
         self.initConfig()
+        #start each test from the default driver settings
+        self.ats9870=ATS9870()
 
     def tearDown(self):
         self.ats9870.disconnect()
@@ -310,6 +318,166 @@ class TestLib(unittest.TestCase):
         self.compareData()
         self.ats9870.disconnect()
 
+    def test_correlator(self):
+        logFile = self.test_correlator.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode        = 'correlator'
+        self.ats9870.recordLength       = 1024
+        self.ats9870.nbrWaveforms       = 5
+        self.ats9870.nbrSegments        = 3
+        self.ats9870.nbrCorrelationLags = 4
+
+        #pattern generator currently only supports 1 round robin
+        self.ats9870.nbrRoundRobins   = 1
+
+        self.ats9870.acquire()
+
+        self.compareData()
+        self.ats9870.disconnect()
+
+    def test_events(self):
+        logFile = self.test_events.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode       = 'events'
+        self.ats9870.recordLength      = 256
+        self.ats9870.nbrWaveforms      = 64
+        self.ats9870.nbrSegments       = 4
+        self.ats9870.nbrRoundRobins    = 2
+        self.ats9870.eventThresholdCh1 = 0.9
+        self.ats9870.eventThresholdCh2 = 0.0
+
+        self.ats9870.acquire()
+        self.assertEqual(self.ats9870.numberAcquisitions,1)
+
+        timeout = 1
+        t = time.time()
+        while not self.ats9870.events_available():
+            if time.time() - t > timeout:
+                break
+            time.sleep(.0001)
+
+        #the simulator fills record r with r mod 256, which is at least 0.9 V
+        #away from zero for counts up to 12 and from 244 on
+        records = [e.recordIndex for e in self.ats9870.events[:self.ats9870.nbrEvents]]
+        expected = [r for r in range(512) if np.mod(r,256) <= 12 or np.mod(r,256) >= 244]
+        self.assertEqual(records,expected)
+        self.ats9870.disconnect()
+
+    def test_histogram(self):
+        logFile = self.test_histogram.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'histogram'
+        self.ats9870.recordLength     = 256
+        self.ats9870.nbrWaveforms     = 16
+        self.ats9870.nbrSegments      = 4
+        self.ats9870.nbrRoundRobins   = 8
+
+        self.ats9870.acquire()
+        self.assertEqual(self.ats9870.samplesPerAcquisition,256)
+
+        timeout = 1
+        t = time.time()
+        while not self.ats9870.data_available():
+            if time.time() - t > timeout:
+                break
+            time.sleep(.0001)
+
+        #the simulator fills record r with r mod 256 on ch1 and r+1 on ch2, so
+        #the 512 records hit every code twice
+        ch1,ch2 = self.ats9870.get_histogram()
+        self.assertTrue(np.all(ch1 == 2*256))
+        self.assertTrue(np.all(ch2 == 2*256))
+        self.assertTrue(np.all(self.ats9870.ch1Buffer == 2*256))
+        self.ats9870.disconnect()
+
+    def test_downsample(self):
+        logFile = self.test_downsample.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 1024
+        self.ats9870.nbrWaveforms     = 3
+        self.ats9870.nbrSegments      = 5
+        self.ats9870.nbrRoundRobins   = 3
+        self.ats9870.downsampleFactor = 8
+
+        self.ats9870.acquire()
+        self.assertEqual(self.ats9870.samplesPerAcquisition,128*3*5*3)
+
+        self.compareData()
+        self.ats9870.disconnect()
+
+    def test_roi(self):
+        logFile = self.test_roi.__name__+'.log'
+
+        self.connect(logFile)
+
+        for mode in ['digitizer','averager']:
+            self.ats9870.acquireMode      = mode
+            self.ats9870.recordLength     = 1024
+            self.ats9870.nbrWaveforms     = 3
+            self.ats9870.nbrSegments      = 5
+            self.ats9870.nbrRoundRobins   = 3
+            self.ats9870.downsampleFactor = 4
+            self.ats9870.roiWindows       = [(0,64),(512,256)]
+            self.ats9870.roiSegments      = [4,0,2]
+
+            self.ats9870.acquire()
+            self.assertEqual(self.ats9870.samplesPerAcquisition,
+                             80*3*(1 if mode == 'averager' else 3*3))
+
+            self.compareData()
+            self.ats9870.stop()
+        self.ats9870.disconnect()
+
+    def test_single_channel(self):
+        logFile = self.test_single_channel.__name__+'.log'
+
+        self.connect(logFile)
+
+        for channels in ['A','B']:
+            for mode in ['digitizer','averager']:
+                self.ats9870.acquireMode      = mode
+                self.ats9870.channels         = channels
+                self.ats9870.recordLength     = 1024
+                self.ats9870.nbrWaveforms     = 3
+                self.ats9870.nbrSegments      = 5
+                self.ats9870.nbrRoundRobins   = 3
+
+                self.ats9870.acquire()
+                self.compareData()
+                self.ats9870.stop()
+
+        #the correlator needs both channels
+        self.ats9870.acquireMode = 'correlator'
+        self.assertRaises(AlazarError,self.ats9870.acquire)
+        self.ats9870.disconnect()
+
+    def test_blocked_layout(self):
+        logFile = self.test_blocked_layout.__name__+'.log'
+
+        self.connect(logFile)
+
+        for mode in ['digitizer','averager']:
+            self.ats9870.acquireMode      = mode
+            self.ats9870.dmaLayout        = 'blocked'
+            self.ats9870.recordLength     = 1024
+            self.ats9870.nbrWaveforms     = 3
+            self.ats9870.nbrSegments      = 5
+            self.ats9870.nbrRoundRobins   = 3
+
+            self.ats9870.acquire()
+            self.compareData()
+            self.ats9870.stop()
+        self.ats9870.disconnect()
+
     def test_partial_buffer_digitizer(self):
         logFile = self.test_partial_buffer_digitizer.__name__+'.log'
 
@@ -341,6 +509,456 @@ class TestLib(unittest.TestCase):
 
         self.compareData()
 
+    def test_output_formats(self):
+        logFile = self.test_output_formats.__name__+'.log'
+
+        self.connect(logFile)
+
+        # the packed values are converted back to volts with the header;
+        # int16 keeps 1/256 count, float16 an 11 bit mantissa
+        counts2Volts = 2 * self.ats9870.verticalScale / 256
+        formats = [('digitizer', 'float16', 2.0**-11),
+                   ('digitizer', 'int16', counts2Volts / 512),
+                   ('digitizer', 'int8', 1e-6),
+                   ('averager', 'float16', 2.0**-11),
+                   ('averager', 'int16', counts2Volts / 512),
+                   ('averager', 'int32', 1e-6)]
+        for mode, outputFormat, tolerance in formats:
+            self.ats9870.acquireMode      = mode
+            self.ats9870.outputFormat     = outputFormat
+            self.ats9870.recordLength     = 1024
+            self.ats9870.nbrWaveforms     = 3
+            self.ats9870.nbrSegments      = 5
+            self.ats9870.nbrRoundRobins   = 1
+
+            self.ats9870.acquire()
+            self.compareData(tolerance)
+            self.assertEqual(self.ats9870.ch1Buffer.dtype, np.dtype(outputFormat))
+            self.ats9870.stop()
+
+        # int8 only holds the raw counts of the digitizer
+        self.ats9870.acquireMode = 'averager'
+        self.ats9870.outputFormat = 'int8'
+        self.assertRaises(AlazarError,self.ats9870.acquire)
+
+    def test_socket_frames(self):
+        logFile = self.test_socket_frames.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.outputFormat     = 'int16'
+        self.ats9870.recordLength     = 1024
+        self.ats9870.nbrWaveforms     = 3
+        self.ats9870.nbrSegments      = 5
+        self.ats9870.nbrRoundRobins   = 3
+
+        # each channel is read on its own thread, the frames alternate
+        # between the sockets
+        pairs = [socket.socketpair() for ch in range(2)]
+        for ch, (send, recv) in enumerate(pairs):
+            self.ats9870.register_socket(ch, send)
+        self.ats9870.acquire()
+        received = [[], []]
+        def receive(ch):
+            receiver = FrameReceiver(pairs[ch][1])
+            for n in range(self.ats9870.numberAcquisitions):
+                header, data = receiver.receive()
+                received[ch].append((header.acquisition, header.channel,
+                                     header.flags, data.shape,
+                                     receiver.to_volts(data)))
+        threads = [threading.Thread(target=receive, args=(ch,)) for ch in range(2)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join(10)
+        self.ats9870.stop()
+        self.ats9870.unregister_sockets()
+        for send, recv in pairs:
+            send.close()
+            recv.close()
+
+        t1,t2 = self.ats9870.generateTestPattern()
+        counts2Volts = 2 * self.ats9870.verticalScale / 256
+        for ch, pattern in enumerate([t1, t2]):
+            self.assertEqual(len(received[ch]), self.ats9870.numberAcquisitions)
+            volts = []
+            for n, (acquisition, channel, flags, shape, data) in enumerate(received[ch]):
+                self.assertEqual(acquisition, n)
+                self.assertEqual(channel, ch)
+                self.assertTrue(flags & FRAME_LAST)
+                self.assertEqual(shape[1:], (5, 3, 1024))
+                volts.append(data.flatten())
+            error = np.max(np.abs(np.concatenate(volts) - pattern.T.flat))
+            self.assertLessEqual(error, counts2Volts / 512)
+
+    def test_socket_backpressure(self):
+        logFile = self.test_socket_backpressure.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 4096
+        self.ats9870.nbrWaveforms     = 1
+        self.ats9870.nbrSegments      = 4
+        self.ats9870.nbrRoundRobins   = 32
+        self.ats9870.bufferSize       = 2 * 4096 * 4
+
+        # the client is late: the sender blocks on the full socket, the output
+        # slots fill up and hold off the processing, nothing is lost
+        send, recv = socket.socketpair()
+        self.ats9870.register_socket(0, send)
+        self.ats9870.acquire()
+        time.sleep(0.2)
+        receiver = FrameReceiver(recv)
+        acquisitions = []
+        for n in range(self.ats9870.numberAcquisitions):
+            header, data = receiver.receive()
+            acquisitions.append(header.acquisition)
+        t = time.time()
+        while self.ats9870.get_stream_status().running and time.time() - t < 5:
+            time.sleep(0.01)
+        status = self.ats9870.get_stream_status()
+        self.ats9870.stop()
+
+        # the receiver is kept for the next acquisition, numbered from 0 again
+        self.ats9870.acquire()
+        header, data = receiver.receive()
+        self.assertEqual(header.acquisition, 0)
+        self.ats9870.stop()
+        self.ats9870.unregister_sockets()
+        send.close()
+        recv.close()
+
+        self.assertGreater(self.ats9870.numberAcquisitions, 2)
+        self.assertEqual(acquisitions, list(range(self.ats9870.numberAcquisitions)))
+        self.assertEqual(status.delivered, self.ats9870.numberAcquisitions)
+
+    def test_continuous(self):
+        logFile = self.test_continuous.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 1024
+        self.ats9870.nbrWaveforms     = 1
+        self.ats9870.nbrSegments      = 1
+        self.ats9870.nbrRoundRobins   = 1
+        self.ats9870.continuous       = True
+
+        # the simulated records count up, so each acquisition shows its place
+        # in the stream
+        counts2Volts = 2 * self.ats9870.verticalScale / 256
+        def readSequences(nbrAcquisitions):
+            sequences = []
+            t = time.time()
+            while len(sequences) < nbrAcquisitions and time.time() - t < 5:
+                if self.ats9870.data_available():
+                    status = self.ats9870.get_stream_status()
+                    code = int(round(self.ats9870.ch1Buffer[0] / counts2Volts)) + 128
+                    self.assertEqual(code % 256, status.sequence % 256)
+                    sequences.append(status.sequence)
+            return sequences
+
+        self.ats9870.acquire()
+        self.assertEqual(self.ats9870.numberAcquisitions, 0)
+        sequences = readSequences(8)
+        self.assertEqual(len(sequences), 8)
+        self.assertTrue(all(b > a for a, b in zip(sequences, sequences[1:])))
+
+        # falling behind drops the oldest acquisitions, not the capture
+        time.sleep(0.1)
+        sequences = readSequences(2)
+        status = self.ats9870.get_stream_status()
+        self.assertTrue(status.running)
+        self.assertFalse(status.overflow)
+        self.assertGreater(status.dropped, 0)
+        self.assertGreaterEqual(status.received, status.delivered + status.dropped)
+        self.ats9870.stop()
+
+        # a board overflow ends the capture and is reported
+        os.environ['ALAZAR_SIM_OVERFLOW'] = '4'
+        try:
+            self.ats9870.acquire()
+            time.sleep(0.1)
+            status = self.ats9870.get_stream_status()
+            self.assertTrue(status.overflow)
+            self.assertFalse(status.running)
+            self.assertEqual(status.received, 4)
+        finally:
+            del os.environ['ALAZAR_SIM_OVERFLOW']
+            self.ats9870.stop()
+
+        # continuous acquisitions are one buffer each
+        self.ats9870.nbrRoundRobins = 100000
+        with self.assertRaises(AlazarError):
+            self.ats9870.acquire()
+
+    def test_rearm(self):
+        logFile = self.test_rearm.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 1024
+        self.ats9870.nbrWaveforms     = 1
+        self.ats9870.nbrSegments      = 1
+        self.ats9870.nbrRoundRobins   = 1
+
+        # the receive thread is kept between acquisitions, so arming costs
+        # far less than the time of an acquisition
+        nbrAcquisitions = 50
+        t = time.time()
+        for n in range(nbrAcquisitions):
+            self.ats9870.acquire()
+            self.compareData()
+            self.ats9870.stop()
+        self.assertLess((time.time() - t) / nbrAcquisitions, 0.02)
+
+    def test_stop_latency(self):
+        logFile = self.test_stop_latency.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 1024
+        self.ats9870.nbrWaveforms     = 1
+        self.ats9870.nbrSegments      = 1
+        self.ats9870.nbrRoundRobins   = 1
+        self.ats9870.continuous       = True
+
+        # streaming as fast as the simulator goes, with nobody reading; the
+        # bounds leave room for a loaded machine, well short of the 500 ms
+        # buffers below
+        self.ats9870.acquire()
+        time.sleep(0.05)
+        t = time.time()
+        self.ats9870.stop()
+        self.assertLess(time.time() - t, 0.05)
+
+        # waiting for a trigger that is slow to come
+        os.environ['ALAZAR_SIM_BUFFER_MS'] = '500'
+        try:
+            self.ats9870.acquire()
+            time.sleep(0.05)
+            t = time.time()
+            self.ats9870.stop()
+            self.assertLess(time.time() - t, 0.05)
+        finally:
+            del os.environ['ALAZAR_SIM_BUFFER_MS']
+            self.ats9870.stop()
+
+    def test_stop_latency_socket(self):
+        logFile = self.test_stop_latency_socket.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 4096
+        self.ats9870.nbrWaveforms     = 1
+        self.ats9870.nbrSegments      = 16
+        self.ats9870.nbrRoundRobins   = 1
+        self.ats9870.continuous       = True
+
+        # the client never reads, the sender is stuck on the full socket with
+        # every output slot waiting behind it
+        send, recv = socket.socketpair()
+        self.ats9870.register_socket(0, send)
+        try:
+            self.ats9870.acquire()
+            time.sleep(0.1)
+            self.assertTrue(self.ats9870.get_stream_status().running)
+            t = time.time()
+            self.ats9870.stop()
+            self.assertLess(time.time() - t, 0.05)
+        finally:
+            self.ats9870.stop()
+            self.ats9870.unregister_sockets()
+            send.close()
+            recv.close()
+
+    def test_sequence(self):
+        logFile = self.test_sequence.__name__+'.log'
+
+        self.connect(logFile)
+
+        self.ats9870.acquireMode      = 'digitizer'
+        self.ats9870.recordLength     = 1024
+        self.ats9870.nbrWaveforms     = 3
+        self.ats9870.nbrSegments      = 1
+        self.ats9870.nbrRoundRobins   = 2
+
+        steps = [{'nbrSegments': 1},
+                 {'nbrSegments': 5, 'recordLength': 2048},
+                 {'nbrSegments': 2, 'acquireMode': 'averager', 'nbrRoundRobins': 1}]
+        self.ats9870.queue_acquisitions(steps)
+
+        # the acquisitions of the steps follow each other without a stop
+        received = []
+        self.ats9870.acquire()
+        total = sum(count for n, count in self.ats9870.stepParams)
+        t = time.time()
+        while len(received) < total and time.time() - t < 5:
+            step = self.ats9870.step_available()
+            if step is not None:
+                received.append((step, [np.copy(ch) for ch in self.ats9870.step_data(step)]))
+        self.ats9870.stop()
+
+        self.assertEqual(len(received), total)
+        self.assertEqual([step for step, data in received],
+                         sorted(step for step, data in received))
+        base = dict(self.ats9870.config)
+        for n in range(len(steps)):
+            self.ats9870.config = self.ats9870.steps[n]
+            t1,t2 = self.ats9870.generateTestPattern()
+            data = [d for step, d in received if step == n]
+            self.assertEqual(len(data), self.ats9870.stepParams[n][1])
+            ch1 = np.concatenate([d[0] for d in data])
+            ch2 = np.concatenate([d[1] for d in data])
+            self.assertLessEqual(np.max(np.abs(ch1 - t1.T.flat)), 0.0)
+            self.assertLessEqual(np.max(np.abs(ch2 - t2.T.flat)), 0.0)
+        self.ats9870.config = base
+
+        # a step that cannot be configured is refused up front
+        with self.assertRaises(AlazarError):
+            self.ats9870.queue_acquisitions([{'recordLength': 257}])
+
+    def test_incremental_config(self):
+        self.connect(self.test_incremental_config.__name__+'.log')
+        settingCalls = c_uint32.in_dll(lib, 'simSettingCalls')
+
+        # the first configuration writes every setting
+        start = settingCalls.value
+        self.ats9870.setAll(self.config)
+        self.assertEqual(settingCalls.value - start, 10)
+
+        # only the settings that change are written again
+        start = settingCalls.value
+        self.ats9870.setAll(self.config)
+        self.assertEqual(settingCalls.value, start)
+        self.config['delay'] = 0.02
+        self.ats9870.setAll(self.config)
+        self.assertEqual(settingCalls.value - start, 1)
+        start = settingCalls.value
+        self.config['verticalScale'] = 0.1
+        self.ats9870.setAll(self.config)
+        self.assertEqual(settingCalls.value - start, 2)
+
+        # acquiring again with the same config leaves the board alone
+        self.ats9870.acquire()
+        self.ats9870.stop()
+        start = settingCalls.value
+        self.ats9870.acquire()
+        self.compareData()
+        self.ats9870.stop()
+        self.assertEqual(settingCalls.value, start)
+
+    def test_compiled_config(self):
+        self.connect(self.test_compiled_config.__name__+'.log')
+        settingCalls = c_uint32.in_dll(lib, 'simSettingCalls')
+
+        self.ats9870.acquireMode = 'digitizer'
+        self.ats9870.nbrWaveforms = 2
+        first = self.ats9870.compile_config()
+        second = self.ats9870.compile_config({'recordLength': 1024,
+                                              'nbrSegments': 3,
+                                              'delay': 0.02})
+
+        # switching writes the trigger delay and the record size, the
+        # settings that differ, and plans nothing
+        for n in range(4):
+            start = settingCalls.value
+            t = time.time()
+            self.ats9870.apply_config(second if n % 2 else first)
+            elapsed = time.time() - t
+            self.assertEqual(settingCalls.value - start, 2)
+            self.assertLess(elapsed, 0.005)
+            self.assertEqual(self.ats9870.recordLength, 1024 if n % 2 else 4096)
+            self.ats9870.acquire()
+            self.compareData()
+            self.ats9870.stop()
+
+        with self.assertRaises(AlazarError):
+            self.ats9870.apply_config(2)
+
+    def test_buffer_plan(self):
+        self.connect(self.test_buffer_plan.__name__+'.log')
+
+        # a prime number of round robins, with room for 40 in a buffer
+        self.ats9870.acquireMode = 'averager'
+        self.ats9870.recordLength = 1024
+        self.ats9870.nbrRoundRobins = 101
+        self.ats9870.bufferSize = 40*2*1024
+        self.ats9870.bufferCount = 4
+        self.ats9870.configureBoard()
+        plan = self.ats9870.get_buffer_plan()
+        self.assertEqual((plan.roundRobinsPerBuffer, plan.nbrBuffers), (1, 101))
+        self.assertEqual(plan.postedBuffers, 4)
+
+        # padding fills the buffers, the final one averages what it holds
+        self.ats9870.padBuffers = True
+        self.ats9870.configureBoard()
+        plan = self.ats9870.get_buffer_plan()
+        self.assertEqual((plan.roundRobinsPerBuffer, plan.nbrBuffers), (34, 3))
+        self.assertEqual(plan.paddingRecords, 1)
+        self.assertEqual(plan.bufferSize, 34*2*1024)
+
+        self.ats9870.acquire()
+        t = time.time()
+        for n in range(self.ats9870.numberAcquisitions):
+            while not self.ats9870.data_available():
+                self.assertLess(time.time() - t, 1)
+                time.sleep(.0001)
+            records = np.arange(34*n, min(34*(n+1), 101))
+            expected = np.mean(np.mod(records, 256) - 128.)/128.
+            self.assertAlmostEqual(self.ats9870.ch1Buffer[0], expected, places=5)
+        self.ats9870.stop()
+
+    def test_tune_buffer_plan(self):
+        self.connect(self.test_tune_buffer_plan.__name__+'.log')
+        cache = os.path.join(os.getcwd(), 'test_tune_buffer_plan.plans')
+        if os.path.exists(cache):
+            os.remove(cache)
+        os.environ['ALAZAR_PLAN_CACHE'] = cache
+        # a plan stored by another process
+        other = 'other host mode 1\t262144'
+        with open(cache, 'w') as f:
+            f.write(other + '\n')
+
+        self.ats9870.acquireMode = 'digitizer'
+        self.ats9870.recordLength = 2048
+        self.ats9870.nbrSegments = 3
+        self.ats9870.nbrRoundRobins = 1200
+        try:
+            self.ats9870.tune_buffer_plan()
+        finally:
+            del os.environ['ALAZAR_PLAN_CACHE']
+        tuned = self.ats9870.get_buffer_plan()
+
+        # the plan is kept for the geometry on this host, with the others
+        with open(cache) as f:
+            lines = f.read().splitlines()
+        self.assertEqual(len(lines), 2)
+        self.assertIn(other, lines)
+        lines.remove(other)
+        self.assertIn('format float32', lines[0])
+        # only the buffer size is tuned, the count is the configuration's
+        size = int(lines[0].split('\t')[1])
+        self.assertLessEqual(tuned.bufferSize, size)
+
+        # and taken by the configurations that leave the plan to the library
+        self.ats9870.nbrRoundRobins = 1
+        self.ats9870.configureBoard()
+        self.ats9870.nbrRoundRobins = 1200
+        self.ats9870.configureBoard()
+        plan = self.ats9870.get_buffer_plan()
+        self.assertEqual((plan.bufferSize, plan.postedBuffers),
+                         (tuned.bufferSize, tuned.postedBuffers))
+        self.ats9870.acquire()
+        self.compareData()
+        self.ats9870.stop()
+        os.remove(cache)
+
 
 if __name__ == '__main__':
     unittest.main(verbosity=True)